@@ -1,6 +1,7 @@
 #include "AudioObject.h"
 
 #include "OSException.h"
+#include "types.h"
 
 AudioObject::AudioObject(AudioObjectID objectID,
                          AudioClassID classID,
@@ -119,18 +120,36 @@ void CheckInDataSize(UInt32 provided, UInt32 required) {
                       kAudioHardwareBadPropertySizeError);
 }
 
+std::mutex AudioObjectMap::mutex_;
+
 std::map<AudioObjectID, AudioObjectMap::AudioObjectPtr>
     AudioObjectMap::audioObjects_;
 
+AudioObjectID AudioObjectMap::nextObjectID_ { kObjectID_FirstDynamic };
+
+AudioObjectID AudioObjectMap::AllocateObjectIDs(unsigned count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto objectID = nextObjectID_;
+  nextObjectID_ += count;
+  return objectID;
+}
+
 void AudioObjectMap::AddObject(AudioObjectID objectID, AudioObjectPtr object) {
+  std::lock_guard<std::mutex> lock(mutex_);
   auto result = audioObjects_.emplace(objectID, object);
   if (!result.second)
     throw OSException("object already exists");
 }
 
-AudioObject& AudioObjectMap::FindObject(AudioObjectID objectID) {
+void AudioObjectMap::RemoveObject(AudioObjectID objectID) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  audioObjects_.erase(objectID);
+}
+
+AudioObjectMap::AudioObjectPtr AudioObjectMap::FindObject(AudioObjectID objectID) {
+  std::lock_guard<std::mutex> lock(mutex_);
   auto it = audioObjects_.find(objectID);
   if (it == end(audioObjects_))
     throw OSException("invalid object ID", kAudioHardwareBadObjectError);
-  return *it->second;
+  return it->second;
 }
@@ -4,6 +4,7 @@
 #include <array>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <utility>
 
 #include <CoreAudio/AudioServerPlugIn.h>
@@ -136,11 +137,22 @@ UInt32 GetPropertyDataImpl(UInt32 dataSize, T value, void* data) {
   return sizeof(T);
 }
 
-/** Map of objects based on their IDs. */
+/** Map of objects based on their IDs.
+ *
+ * Objects can be added and removed at any time (e.g., when a device is
+ * created or destroyed), so all the operations are thread-safe.
+ */
 class AudioObjectMap {
 public:
   typedef std::shared_ptr<AudioObject> AudioObjectPtr;
 
+  /** Reserves a block of consecutive, never used before, object IDs.
+   *
+   * @param count Number of IDs to reserve.
+   * @return The first ID in the block.
+   */
+  static AudioObjectID AllocateObjectIDs(unsigned count);
+
   /** Adds an object to the map.
    *
    * @param objectID Object identifier.
@@ -148,16 +160,27 @@ public:
    */
   static void AddObject(AudioObjectID objectID, AudioObjectPtr object);
   
+  /** Removes an object from the map.
+   *
+   * @param objectID Object identifier.
+   * @note Nothing happens if the object ID is not found.
+   */
+  static void RemoveObject(AudioObjectID objectID);
+  
   /** Finds an object based on the given ID.
    *
    * @param objectID Object identifier.
-   * @return The object instance associated with the given identifier.
+   * @return The object instance associated with the given identifier. The
+   *         object stays alive for as long as the returned pointer does, even
+   *         if it is removed from the map in the meantime.
    * @note An exception is thrown if the object ID is not found.
    */
-  static AudioObject& FindObject(AudioObjectID objectID);
+  static AudioObjectPtr FindObject(AudioObjectID objectID);
   
 private:
+  static std::mutex mutex_;
   static std::map<AudioObjectID, AudioObjectPtr> audioObjects_;
+  static AudioObjectID nextObjectID_;
 };
 
 #endif /* AudioObject_h */
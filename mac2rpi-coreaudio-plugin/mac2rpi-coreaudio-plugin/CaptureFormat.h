@@ -0,0 +1,65 @@
+#ifndef CaptureFormat_h
+#define CaptureFormat_h
+
+#include <cstdint>
+
+/* Layout of the packet capture file. Shared with the replay tool in tools/,
+ * which is built on Linux, so only standard types are used here.
+ */
+
+/** Identifies a capture file ("m2rc"). */
+constexpr uint32_t kCaptureMagic { 0x6d327263 };
+
+/** Version of the capture file layout. */
+constexpr uint32_t kCaptureVersion { 1 };
+
+/** Records are aligned on this many bytes. */
+constexpr uint32_t kCaptureAlignment { 8 };
+
+/** Placed at the start of the capture file, followed by the records. */
+struct CaptureFileHeader {
+  uint32_t magic;
+  uint32_t version;
+
+  /** Size of a record header, for forward compatibility. */
+  uint32_t recordSize;
+  uint32_t reserved;
+
+  /** When the capture started, in nanoseconds of the wall clock. */
+  uint64_t startTime;
+
+  /** Number of bytes of records after this header. Updated after every
+   * record, so the file can be read while it is written; the file itself
+   * may be longer.
+   */
+  uint64_t dataSize;
+
+  /** Number of datagrams that could not be captured because the writer
+   * fell behind.
+   */
+  uint64_t droppedCount;
+
+  uint64_t reserved2;
+};
+
+static_assert(sizeof(CaptureFileHeader) == 48, "Unexpected capture header size");
+
+/** One datagram, followed by its \p size bytes and padded to
+ * kCaptureAlignment.
+ */
+struct CaptureRecord {
+  /** When the datagram was first sent, in nanoseconds since the start of
+   * the capture.
+   */
+  uint64_t sendTime;
+
+  /** Device that sent the datagram. */
+  uint32_t deviceID;
+
+  uint16_t size;
+  uint16_t reserved;
+};
+
+static_assert(sizeof(CaptureRecord) == 16, "Unexpected capture record size");
+
+#endif /* CaptureFormat_h */
@@ -0,0 +1,205 @@
+#include "CaptureWriter.h"
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "log.h"
+
+constexpr size_t CaptureWriter::capacity;
+constexpr uint64_t CaptureWriter::growSize;
+constexpr uint64_t CaptureWriter::maxFileSize;
+
+namespace {
+  /** How long the writer thread sleeps when the ring is empty. */
+  constexpr std::chrono::milliseconds pollInterval { 20 };
+
+  /** Starts the writer thread when the plug-in is loaded, rather than on the
+   * first call from the IO thread.
+   */
+  CaptureWriter& writerAtLoad = CaptureWriter::GetInstance();
+}
+
+CaptureWriter& CaptureWriter::GetInstance() {
+  static CaptureWriter writer;
+  return writer;
+}
+
+CaptureWriter::CaptureWriter() {
+  for (size_t i = 0; i < capacity; i++)
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+
+  mach_timebase_info_data_t timebase;
+  mach_timebase_info(&timebase);
+  nanosecondsPerHostTick_ = static_cast<Float64>(timebase.numer) / timebase.denom;
+
+  thread_ = std::thread(&CaptureWriter::Run, this);
+}
+
+CaptureWriter::~CaptureWriter() {
+  running_ = false;
+  thread_.join();
+  std::lock_guard<std::mutex> lock(fileMutex_);
+  CloseFile();
+}
+
+void CaptureWriter::SetFile(const std::string& path) {
+  std::lock_guard<std::mutex> lock(fileMutex_);
+  if (path == path_)
+    return;
+
+  // What is already in the ring belongs to the old file.
+  capturing_ = false;
+  Drain();
+  CloseFile();
+  path_ = path;
+  if (path.empty())
+    return;
+
+  // The path comes from the settings; a symbolic link planted there must
+  // not make coreaudiod truncate the file it points to.
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644);
+  if (fd_ < 0) {
+    LOG(Network, Error,
+        boost::format("Cannot open capture file %1%, capture disabled") % path);
+    return;
+  }
+
+  // The whole maximum size is mapped up front and the file grows under the
+  // mapping, so records never move.
+  void* mapping = MAP_FAILED;
+  if (ftruncate(fd_, growSize) == 0)
+    mapping = mmap(nullptr, maxFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (mapping == MAP_FAILED) {
+    LOG(Network, Error,
+        boost::format("Cannot map capture file %1%, capture disabled") % path);
+    close(fd_);
+    fd_ = -1;
+    return;
+  }
+  fileSize_ = growSize;
+
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  startHostTime_ = mach_absolute_time();
+
+  header_ = static_cast<CaptureFileHeader*>(mapping);
+  header_->magic = kCaptureMagic;
+  header_->version = kCaptureVersion;
+  header_->recordSize = sizeof(CaptureRecord);
+  header_->reserved = 0;
+  header_->startTime = static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+  header_->dataSize = 0;
+  header_->droppedCount = 0;
+  header_->reserved2 = 0;
+
+  dropped_ = 0;
+  capturing_ = true;
+  LOG(Network, Info, boost::format("Capturing datagrams to %1%") % path);
+}
+
+CaptureWriter::Slot* CaptureWriter::Claim() noexcept {
+  auto position = head_.load(std::memory_order_relaxed);
+  for (;;) {
+    auto& slot = slots_[position & (capacity - 1)];
+    auto sequence = slot.sequence.load(std::memory_order_acquire);
+    auto diff = static_cast<ptrdiff_t>(sequence - position);
+
+    if (diff == 0) {
+      if (head_.compare_exchange_weak(position, position + 1,
+                                      std::memory_order_relaxed))
+        return &slot;
+    } else if (diff < 0) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    } else {
+      position = head_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void CaptureWriter::Publish(Slot& slot) noexcept {
+  // The slot was claimed at sequence == position; position + 1 marks it
+  // full.
+  slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_release);
+}
+
+void CaptureWriter::Run() {
+  while (running_) {
+    {
+      std::lock_guard<std::mutex> lock(fileMutex_);
+      Drain();
+    }
+    std::this_thread::sleep_for(pollInterval);
+  }
+}
+
+void CaptureWriter::Drain() {
+  for (;;) {
+    auto& slot = slots_[tail_ & (capacity - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != tail_ + 1)
+      break;
+
+    if (header_ != nullptr && !Append(slot)) {
+      LOG(Network, Warning,
+          boost::format("Capture file %1% full, capture stopped") % path_);
+      capturing_ = false;
+      CloseFile();
+    }
+    slot.sequence.store(tail_ + capacity, std::memory_order_release);
+    tail_++;
+  }
+
+  if (header_ != nullptr)
+    header_->droppedCount = dropped_.load(std::memory_order_relaxed);
+}
+
+bool CaptureWriter::Append(const Slot& slot) {
+  const uint64_t recordSize = (sizeof(CaptureRecord) + slot.size + kCaptureAlignment - 1)
+      / kCaptureAlignment * kCaptureAlignment;
+  const auto offset = sizeof(CaptureFileHeader) + header_->dataSize;
+  if (offset + recordSize > maxFileSize)
+    return false;
+  if (offset + recordSize > fileSize_) {
+    if (ftruncate(fd_, fileSize_ + growSize) != 0)
+      return false;
+    fileSize_ += growSize;
+  }
+
+  auto destination = reinterpret_cast<uint8_t*>(header_) + offset;
+  CaptureRecord record;
+  record.sendTime = slot.hostTime > startHostTime_
+      ? static_cast<uint64_t>((slot.hostTime - startHostTime_) * nanosecondsPerHostTick_)
+      : 0;
+  record.deviceID = slot.deviceID;
+  record.size = slot.size;
+  record.reserved = 0;
+  std::memcpy(destination, &record, sizeof(record));
+  std::memcpy(destination + sizeof(record), slot.data.data(), slot.size);
+  std::memset(destination + sizeof(record) + slot.size, 0,
+              recordSize - sizeof(record) - slot.size);
+
+  // Readers of a file being written trust dataSize, so it moves last.
+  __atomic_store_n(&header_->dataSize, header_->dataSize + recordSize,
+                   __ATOMIC_RELEASE);
+  return true;
+}
+
+void CaptureWriter::CloseFile() {
+  if (header_ != nullptr) {
+    auto size = sizeof(CaptureFileHeader) + header_->dataSize;
+    munmap(header_, maxFileSize);
+    header_ = nullptr;
+    if (ftruncate(fd_, size) != 0)
+      LOG(Network, Warning, boost::format("Cannot truncate capture file %1%") % path_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
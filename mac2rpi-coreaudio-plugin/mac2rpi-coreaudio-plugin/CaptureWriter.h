@@ -0,0 +1,135 @@
+#ifndef CaptureWriter_h
+#define CaptureWriter_h
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <MacTypes.h>
+#include <mach/mach_time.h>
+
+#include <boost/asio/buffer.hpp>
+
+#include "CaptureFormat.h"
+#include "Packetizer.h"
+
+/** Records the datagrams sent by the devices into a capture file, so that
+ * the exact stream a receiver got can be replayed with tools/replay.
+ *
+ * Capturing is off unless the settings name a file. The IO thread only
+ * copies each datagram into a fixed lock-free ring; a background thread
+ * appends them to the file through a memory mapping. When the ring is full
+ * the datagram is dropped from the capture (not from the stream) and
+ * counted in the file header.
+ */
+class CaptureWriter {
+public:
+  /** Number of datagrams the ring can hold (must be a power of two): about
+   * 250 ms of stereo float at 48 kHz.
+   */
+  static constexpr size_t capacity { 256 };
+
+  /** The file grows by this many bytes at a time. */
+  static constexpr uint64_t growSize { 16 << 20 };
+
+  /** Capturing stops when the file reaches this size. */
+  static constexpr uint64_t maxFileSize { 1ull << 30 };
+
+  /** Returns the only instance of this class. */
+  static CaptureWriter& GetInstance();
+
+  CaptureWriter(const CaptureWriter&) = delete;
+  CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+  /** Closes the current capture file, if any, and starts writing a new one.
+   * Does nothing if the path is the one in use. Must not be called from the
+   * IO thread.
+   *
+   * @param path The file to write, truncated first, or empty to stop
+   *        capturing.
+   */
+  void SetFile(const std::string& path);
+
+  /** Appends a datagram to the capture. Safe to call from the IO thread;
+   * does nothing unless capturing.
+   *
+   * @param deviceID The device sending the datagram.
+   * @param buffers The content of the datagram.
+   */
+  template<typename ConstBufferSequence>
+  void Capture(UInt32 deviceID, const ConstBufferSequence& buffers) noexcept {
+    if (!capturing_.load(std::memory_order_relaxed))
+      return;
+
+    auto slot = Claim();
+    if (slot == nullptr)
+      return;
+    slot->hostTime = mach_absolute_time();
+    slot->deviceID = deviceID;
+    slot->size = static_cast<UInt16>(
+        boost::asio::buffer_copy(boost::asio::buffer(slot->data), buffers));
+    Publish(*slot);
+  }
+
+private:
+  static_assert((capacity & (capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+  struct Slot {
+    /** Tells producers and consumer whose turn it is to use the slot (see
+     * LogRing).
+     */
+    std::atomic<size_t> sequence;
+    UInt64 hostTime;
+    UInt32 deviceID;
+    UInt16 size;
+    std::array<UInt8, Packetizer::maxDatagramSize> data;
+  };
+
+  CaptureWriter();
+  ~CaptureWriter();
+
+  /** Reserves the next slot of the ring, or returns nullptr if it is full. */
+  Slot* Claim() noexcept;
+
+  /** Hands a slot filled by Claim() to the writer thread. */
+  void Publish(Slot& slot) noexcept;
+
+  void Run();
+
+  /** Moves the datagrams of the ring to the file. */
+  void Drain();
+
+  /** Appends a datagram to the file. Requires fileMutex_.
+   *
+   * @return false if the file is full or cannot grow.
+   */
+  bool Append(const Slot& slot);
+
+  /** Truncates the file to its content and unmaps it. Requires fileMutex_. */
+  void CloseFile();
+
+  std::array<Slot, capacity> slots_;
+  std::atomic<size_t> head_ { 0 };
+  size_t tail_ { 0 };
+  std::atomic<UInt64> dropped_ { 0 };
+
+  /** Whether the IO thread should copy datagrams to the ring. */
+  std::atomic<bool> capturing_ { false };
+
+  /** Protects the fields below, used by the writer thread and SetFile(). */
+  std::mutex fileMutex_;
+  std::string path_;
+  int fd_ { -1 };
+  CaptureFileHeader* header_ { nullptr };
+  uint64_t fileSize_ { 0 };
+  UInt64 startHostTime_ { 0 };
+  Float64 nanosecondsPerHostTick_ { 1 };
+
+  std::atomic<bool> running_ { true };
+  std::thread thread_;
+};
+
+#endif /* CaptureWriter_h */
@@ -0,0 +1,65 @@
+#ifndef ChannelLayout_h
+#define ChannelLayout_h
+
+#include <array>
+
+#include <CoreAudio/AudioServerPlugIn.h>
+
+/** Describes the speaker arrangement of a device. */
+struct ChannelLayout {
+  /** Maximum number of channels supported by any layout. */
+  static constexpr unsigned maxChannels { 8 };
+
+  /** The CoreAudio tag identifying the layout. */
+  AudioChannelLayoutTag tag;
+
+  /** Number of interleaved channels in a frame. */
+  unsigned channels;
+
+  /** Speaker of every channel, in the order they appear in a frame. Only the
+   * first \p channels entries are used.
+   */
+  std::array<AudioChannelLabel, maxChannels> labels;
+};
+
+/** 2.0: L R */
+constexpr ChannelLayout kChannelLayoutStereo {
+  kAudioChannelLayoutTag_Stereo,
+  2,
+  {{
+    kAudioChannelLabel_Left,
+    kAudioChannelLabel_Right,
+  }}
+};
+
+/** 5.1: L R C LFE Ls Rs */
+constexpr ChannelLayout kChannelLayout5_1 {
+  kAudioChannelLayoutTag_MPEG_5_1_A,
+  6,
+  {{
+    kAudioChannelLabel_Left,
+    kAudioChannelLabel_Right,
+    kAudioChannelLabel_Center,
+    kAudioChannelLabel_LFEScreen,
+    kAudioChannelLabel_LeftSurround,
+    kAudioChannelLabel_RightSurround,
+  }}
+};
+
+/** 7.1: L R C LFE Ls Rs Rls Rrs */
+constexpr ChannelLayout kChannelLayout7_1 {
+  kAudioChannelLayoutTag_MPEG_7_1_C,
+  8,
+  {{
+    kAudioChannelLabel_Left,
+    kAudioChannelLabel_Right,
+    kAudioChannelLabel_Center,
+    kAudioChannelLabel_LFEScreen,
+    kAudioChannelLabel_LeftSurround,
+    kAudioChannelLabel_RightSurround,
+    kAudioChannelLabel_RearSurroundLeft,
+    kAudioChannelLabel_RearSurroundRight,
+  }}
+};
+
+#endif /* ChannelLayout_h */
@@ -5,6 +5,7 @@
 #include "Device.h"
 #include "log.h"
 #include "OSException.h"
+#include "VolumeCurve.h"
 
 #pragma mark VolumeControl
 
@@ -19,7 +20,7 @@ VolumeControl::VolumeControl(AudioObjectID objectID, Device& device)
 Boolean VolumeControl::HasProperty(pid_t clientProcessID,
                                    const AudioObjectPropertyAddress& address) const {
 
-  LOG(boost::format("VolumeControlHasProperty: selector=%1%")
+  LOG(Property, Trace, boost::format("VolumeControlHasProperty: selector=%1%")
       % ControlPropertyToString(address.mSelector));
 
   switch (address.mSelector) {
@@ -90,7 +91,8 @@ UInt32 VolumeControl::GetPropertyData(pid_t clientProcessID,
                                       UInt32 dataSize,
                                       void* data) const {
   
-  LOG(boost::format("VolumeControlGetPropertyData: selector=%1%")
+  LOG(Property, Trace,
+      boost::format("VolumeControlGetPropertyData: selector=%1%")
       % ControlPropertyToString(address.mSelector));
 
   switch (address.mSelector) {
@@ -107,22 +109,15 @@ UInt32 VolumeControl::GetPropertyData(pid_t clientProcessID,
           (dataSize, device_.OutputVolume(), data);
       
     case kAudioLevelControlPropertyDecibelValue:
-    {
-      GetPropertyDataImpl<Float32>
-          (dataSize, device_.OutputVolume(), data);
-      auto& volume = *(static_cast<Float32*>(data));
-      volume = volume * volume;
-      volume = Device::volumeMinDB
-          + (volume * (Device::volumeMaxDB - Device::volumeMinDB));
-      return sizeof(Float32);
-    }
+      return GetPropertyDataImpl<Float32>
+          (dataSize, ScalarToDecibels(device_.OutputVolume()), data);
 
     case kAudioLevelControlPropertyDecibelRange:
     {
       CheckOutDataSize(dataSize, sizeof(AudioValueRange));
       auto& range = *(static_cast<AudioValueRange*>(data));
-      range.mMinimum = Device::volumeMinDB;
-      range.mMaximum = Device::volumeMaxDB;
+      range.mMinimum = kVolumeMinDB;
+      range.mMaximum = kVolumeMaxDB;
       return sizeof(AudioValueRange);
     }
 
@@ -130,22 +125,14 @@ UInt32 VolumeControl::GetPropertyData(pid_t clientProcessID,
     {
       CheckOutDataSize(dataSize, sizeof(Float32));
       auto& volume = *(static_cast<Float32*>(data));
-      if (volume < 0.0) volume = 0;
-      if (volume > 1.0) volume = 1;
-      volume = volume * volume;
-      volume = Device::volumeMinDB
-          + (volume * (Device::volumeMaxDB - Device::volumeMinDB));
+      volume = ScalarToDecibels(volume);
       return sizeof(Float32);
     }
 
     case kAudioLevelControlPropertyConvertDecibelsToScalar:
       CheckOutDataSize(dataSize, sizeof(Float32));
       auto& volume = *(static_cast<Float32*>(data));
-      if (volume < Device::volumeMinDB) volume = Device::volumeMinDB;
-      if (volume > Device::volumeMaxDB) volume = Device::volumeMaxDB;
-      volume = volume - Device::volumeMinDB;
-      volume = volume / (Device::volumeMaxDB - Device::volumeMinDB);
-      volume = std::sqrt(volume);
+      volume = DecibelsToScalar(volume);
       return sizeof(Float32);
   };
   
@@ -171,47 +158,20 @@ VolumeControl::SetPropertyData(pid_t clientProcessID,
       auto volume = *(static_cast<const Float32*>(data));
       volume = std::max<Float32>(volume, 0);
       volume = std::min<Float32>(volume, 1);
-      LOG(boost::format("###### Volume set scalar value (%1%) !!!") % volume);
-      if (volume != device_.OutputVolume()) {
-        device_.SetOutputVolume(volume);
-        ChangedPropertyList changedProperties;
-        changedProperties[0].mSelector = kAudioLevelControlPropertyScalarValue;
-        changedProperties[0].mScope = kAudioObjectPropertyScopeGlobal;
-        changedProperties[0].mElement = kAudioObjectPropertyElementMaster;
-        changedProperties[1].mSelector = kAudioLevelControlPropertyDecibelValue;
-        changedProperties[1].mScope = kAudioObjectPropertyScopeGlobal;
-        changedProperties[1].mElement = kAudioObjectPropertyElementMaster;
-        return std::make_pair(2, changedProperties);
-      }
-      
-      return std::make_pair(0, ChangedPropertyList{});
+      LOG(Control, Debug,
+          boost::format("###### Volume set scalar value (%1%) !!!") % volume);
+      return SetVolume(volume);
     }
       
     case kAudioLevelControlPropertyDecibelValue:
     {
       CheckInDataSize(dataSize, sizeof(Float32));
       auto volume = *(static_cast<const Float32*>(data));
-      volume = std::max<Float32>(volume, Device::volumeMinDB);
-      volume = std::min<Float32>(volume, Device::volumeMaxDB);
-      LOG(boost::format("###### Volume set decibel value (%1%) !!!") % volume);
-      
-      volume = volume - Device::volumeMinDB;
-      volume = volume / (Device::volumeMaxDB - Device::volumeMinDB);
-      volume = std::sqrt(volume);
-      
-      if (volume != device_.OutputVolume()) {
-        device_.SetOutputVolume(volume);
-        ChangedPropertyList changedProperties;
-        changedProperties[0].mSelector = kAudioLevelControlPropertyScalarValue;
-        changedProperties[0].mScope = kAudioObjectPropertyScopeGlobal;
-        changedProperties[0].mElement = kAudioObjectPropertyElementMaster;
-        changedProperties[1].mSelector = kAudioLevelControlPropertyDecibelValue;
-        changedProperties[1].mScope = kAudioObjectPropertyScopeGlobal;
-        changedProperties[1].mElement = kAudioObjectPropertyElementMaster;
-        return std::make_pair(2, changedProperties);
-      }
-      
-      return std::make_pair(0, ChangedPropertyList{});
+      volume = std::max<Float32>(volume, kVolumeMinDB);
+      volume = std::min<Float32>(volume, kVolumeMaxDB);
+      LOG(Control, Debug,
+          boost::format("###### Volume set decibel value (%1%) !!!") % volume);
+      return SetVolume(DecibelsToScalar(volume));
     }
   };
   
@@ -223,6 +183,22 @@ VolumeControl::SetPropertyData(pid_t clientProcessID,
                                       data);
 }
 
+std::pair<UInt32, VolumeControl::ChangedPropertyList>
+VolumeControl::SetVolume(Float32 scalar) {
+  if (scalar == device_.OutputVolume())
+    return std::make_pair(0, ChangedPropertyList{});
+  
+  device_.SetOutputVolume(scalar);
+  ChangedPropertyList changedProperties;
+  changedProperties[0].mSelector = kAudioLevelControlPropertyScalarValue;
+  changedProperties[0].mScope = kAudioObjectPropertyScopeGlobal;
+  changedProperties[0].mElement = kAudioObjectPropertyElementMaster;
+  changedProperties[1].mSelector = kAudioLevelControlPropertyDecibelValue;
+  changedProperties[1].mScope = kAudioObjectPropertyScopeGlobal;
+  changedProperties[1].mElement = kAudioObjectPropertyElementMaster;
+  return std::make_pair(2, changedProperties);
+}
+
 /////////////////
 // MuteControl //
 /////////////////
@@ -240,7 +216,7 @@ MuteControl::MuteControl(AudioObjectID objectID, Device& device)
 Boolean MuteControl::HasProperty(pid_t clientProcessID,
                                  const AudioObjectPropertyAddress& address) const {
   
-  LOG(boost::format("MuteControlHasProperty: selector=%1%")
+  LOG(Property, Trace, boost::format("MuteControlHasProperty: selector=%1%")
       % ControlPropertyToString(address.mSelector));
 
   switch (address.mSelector) {
@@ -295,7 +271,7 @@ UInt32 MuteControl::GetPropertyData(pid_t clientProcessID,
                                     UInt32 dataSize,
                                     void* data) const {
   
-  LOG(boost::format("MuteControlGetPropertyData: selector=%1%")
+  LOG(Property, Trace, boost::format("MuteControlGetPropertyData: selector=%1%")
       % ControlPropertyToString(address.mSelector));
 
   switch (address.mSelector) {
@@ -332,7 +308,8 @@ MuteControl::SetPropertyData(pid_t clientProcessID,
     {
       CheckInDataSize(dataSize, sizeof(UInt32));
       bool mute = *(static_cast<const UInt32*>(data)) != 0;
-      LOG(boost::format("###### Mute set value (%1%) !!!") % mute);
+      LOG(Control, Debug,
+          boost::format("###### Mute set value (%1%) !!!") % mute);
       
       if (mute != device_.OutputMute()) {
         device_.SetOutputMute(mute);
@@ -36,6 +36,13 @@ public:
                   const void* data) override;
   
 private:
+  /** Updates the volume of the device.
+   *
+   * @return The properties that changed: either none or both the scalar and
+   *         the decibel values.
+   */
+  std::pair<UInt32, ChangedPropertyList> SetVolume(Float32 scalar);
+  
   Device& device_;
 };
 
@@ -1,50 +1,151 @@
 #include "Device.h"
 
 #include <algorithm>
+#include <cmath>
+#include <ctime>
 #include <numeric>
+#include <thread>
 
+#include <dispatch/dispatch.h>
 #include <mach/mach_time.h>
 
 #include "Control.h"
 #include "log.h"
 #include "OSException.h"
+#include "PlugIn.h"
+#include "SettingsWatcher.h"
 #include "Stream.h"
+#include "TraceRecorder.h"
 #include "types.h"
 
 namespace asio = boost::asio;
 
-constexpr std::array<Float64, 2> Device::availableSampleRates;
-constexpr Float32 Device::volumeMinDB;
-constexpr Float32 Device::volumeMaxDB;
+namespace {
+
+/** Keeps track of the number of output writes in progress, so that a
+ * configuration change can wait for them to finish.
+ */
+class WriteInFlight {
+public:
+  explicit WriteInFlight(std::atomic<UInt32>& counter)
+    : counter_(counter)
+  { ++counter_; }
+  
+  ~WriteInFlight() { --counter_; }
+  
+private:
+  std::atomic<UInt32>& counter_;
+  
+  WriteInFlight(const WriteInFlight&) = delete;
+  WriteInFlight& operator=(const WriteInFlight&) = delete;
+};
+
+/** Returns whether a buffer only contains zeros. */
+bool IsSilent(const void* buffer, size_t size) {
+  auto bytes = static_cast<const UInt8*>(buffer);
+  return std::all_of(bytes, bytes + size, [](UInt8 b) { return b == 0; });
+}
+
+/** Converts a level in dB to a linear gain. */
+Float32 DecibelsToGain(Float64 decibels) {
+  return static_cast<Float32>(std::pow(10.0, decibels / 20.0));
+}
+
+/** Converts a full-scale level to dBFS, down to Device::levelFloorDB. */
+Float32 GainToDecibels(Float32 gain) {
+  return gain > 0
+      ? std::max(Device::levelFloorDB, 20.0f * std::log10(gain))
+      : Device::levelFloorDB;
+}
+
+/** Builds an array of dBFS values from full-scale levels. */
+CFArrayRef CreateLevelArray(const std::atomic<Float32>* levels, unsigned count) {
+  auto array = CFArrayCreateMutable(nullptr, count, &kCFTypeArrayCallBacks);
+  for (unsigned i = 0; i < count; i++) {
+    auto decibels = GainToDecibels(levels[i].load(std::memory_order_relaxed));
+    auto number = CFNumberCreate(nullptr, kCFNumberFloat32Type, &decibels);
+    CFArrayAppendValue(array, number);
+    CFRelease(number);
+  }
+  return array;
+}
+
+static_assert(ChannelLayout::maxChannels <= kMetricsMaxChannels,
+              "Not enough channels in the metrics");
+
+}
+
+constexpr std::array<Float64, 6> Device::availableSampleRates;
+constexpr std::array<SampleFormat, 4> Device::availablePhysicalFormats;
+constexpr AudioObjectPropertySelector Device::outputLevelsProperty;
+constexpr Float32 Device::levelFloorDB;
 constexpr unsigned Device::numberOfStreams;
 constexpr unsigned Device::numberOfControls;
 constexpr unsigned Device::numberOfSubObjects;
-constexpr unsigned Device::numberOfChannels;
-constexpr unsigned Device::ringBufferSize;
 
-Device::Device()
-  : AudioObject(kObjectID_Device,
+Device::Device(AudioObjectID objectID,
+               const DeviceConfiguration& configuration,
+               boost::asio::io_service& ioService)
+  : AudioObject(objectID + kObjectIDOffset_Device,
               kAudioDeviceClassID,
               kAudioObjectClassID,
               kObjectID_PlugIn)
+  , configuration_(configuration)
+  , metrics_(Metrics::GetInstance().Acquire(objectID + kObjectIDOffset_Device))
+  , name_(CFStringCreateWithCString(nullptr,
+                                    configuration.name.c_str(),
+                                    kCFStringEncodingUTF8))
+  , uid_(CFStringCreateWithCString(nullptr,
+                                   configuration.uid.c_str(),
+                                   kCFStringEncodingUTF8))
+  , limiter_(configuration.channelLayout.channels)
   , outputStream_(std::make_shared<Stream>
-                  (kObjectID_Stream_Output, *this))
+                  (objectID + kObjectIDOffset_Stream_Output, *this))
   , volumeControl_(std::make_shared<VolumeControl>
-                   (kObjectID_Volume_Output_Master, *this))
+                   (objectID + kObjectIDOffset_Volume_Output_Master, *this))
   , muteControl_(std::make_shared<MuteControl>
-                 (kObjectID_Mute_Output_Master, *this))
-  , endpoint_(asio::ip::make_address("239.255.0.1"), 30001)
-  , outputSocket_(ioService_, endpoint_.protocol())
+                 (objectID + kObjectIDOffset_Mute_Output_Master, *this))
+  , transport_(ioService, objectID, configuration, metrics_)
 {
-  AudioObjectMap::AddObject(kObjectID_Stream_Output, outputStream_);
-  AudioObjectMap::AddObject(kObjectID_Volume_Output_Master, volumeControl_);
-  AudioObjectMap::AddObject(kObjectID_Mute_Output_Master, muteControl_);
+  const auto& settings = SettingsWatcher::Current();
+  ringBufferSize_ = settings.ringBufferSize;
+  wireBitRateBudget_ = settings.wireBitRateBudget;
+  limiterEnabled_ = settings.limiterCeiling < 0;
+  limiter_.SetCeiling(DecibelsToGain(settings.limiterCeiling));
+  limiter_.Reset(sampleRate_);
+  metrics_.channels = NumberOfChannels();
+  
+  AudioObjectMap::AddObject(outputStream_->ObjectID(), outputStream_);
+  AudioObjectMap::AddObject(volumeControl_->ObjectID(), volumeControl_);
+  AudioObjectMap::AddObject(muteControl_->ObjectID(), muteControl_);
+  
+  ComputeHostTicksPerFrame();
+  UpdatePacketizerFormat();
+}
+
+Device::~Device() {
+  Metrics::GetInstance().Release(metrics_);
+  CFRelease(name_);
+  CFRelease(uid_);
+}
+
+void Device::SetDestinations(const std::vector<Destination>& destinations) {
+  // Every audio packet carries the format, so new receivers pick up the
+  // stream from the next cycle.
+  transport_.SetDestinations(destinations);
+  configuration_.destinations = destinations;
+}
+
+void Device::UnregisterSubObjects() {
+  AudioObjectMap::RemoveObject(outputStream_->ObjectID());
+  AudioObjectMap::RemoveObject(volumeControl_->ObjectID());
+  AudioObjectMap::RemoveObject(muteControl_->ObjectID());
 }
 
 Boolean Device::HasProperty(pid_t clientProcessID,
                             const AudioObjectPropertyAddress& address) const {
 
-  LOG(boost::format("DeviceHasProperty: selector=%1%")
+  LOG(Property, Trace, boost::format("DeviceHasProperty: selector=%1%")
       % DevicePropertyToString(address.mSelector));
 
   switch (address.mSelector) {
@@ -63,6 +164,8 @@ Boolean Device::HasProperty(pid_t clientProcessID,
     case kAudioDevicePropertyIsHidden:
     case kAudioDevicePropertyZeroTimeStampPeriod:
     case kAudioDevicePropertyStreams:
+    case kAudioObjectPropertyCustomPropertyInfoList:
+    case outputLevelsProperty:
       return true;
       
     case kAudioDevicePropertyLatency:
@@ -100,6 +203,8 @@ Boolean Device::IsPropertySettable(pid_t clientProcessID,
     case kAudioDevicePropertyPreferredChannelsForStereo:
     case kAudioDevicePropertyPreferredChannelLayout:
     case kAudioDevicePropertyZeroTimeStampPeriod:
+    case kAudioObjectPropertyCustomPropertyInfoList:
+    case outputLevelsProperty:
       return false;
       
     case kAudioDevicePropertyNominalSampleRate:
@@ -170,14 +275,20 @@ UInt32 Device::GetPropertyDataSize(pid_t clientProcessID,
       return sizeof(UInt32);
       
     case kAudioDevicePropertyPreferredChannelsForStereo:
-      return numberOfChannels * sizeof(UInt32);
+      return 2 * sizeof(UInt32);
       
     case kAudioDevicePropertyPreferredChannelLayout:
       return offsetof(AudioChannelLayout, mChannelDescriptions)
-          + (numberOfChannels * sizeof(AudioChannelDescription));
+          + (NumberOfChannels() * sizeof(AudioChannelDescription));
       
     case kAudioDevicePropertyZeroTimeStampPeriod:
       return sizeof(UInt32);
+      
+    case kAudioObjectPropertyCustomPropertyInfoList:
+      return sizeof(AudioServerPlugInCustomPropertyInfo);
+      
+    case outputLevelsProperty:
+      return sizeof(CFPropertyListRef);
   };
   
   return AudioObject::GetPropertyDataSize(clientProcessID,
@@ -193,13 +304,14 @@ UInt32 Device::GetPropertyData(pid_t clientProcessID,
                                UInt32 dataSize,
                                void* data) const {
   
-  LOG(boost::format("DeviceGetPropertyData: selector=%1%")
+  LOG(Property, Trace, boost::format("DeviceGetPropertyData: selector=%1%")
       % DevicePropertyToString(address.mSelector));
 
   switch (address.mSelector) {
     case kAudioObjectPropertyName:
+      // The caller releases the returned string.
       return GetPropertyDataImpl<CFStringRef>
-          (dataSize, CFSTR("mac2rpi-plugin"), data);
+          (dataSize, static_cast<CFStringRef>(CFRetain(name_)), data);
       
     case kAudioObjectPropertyManufacturer:
       return GetPropertyDataImpl<CFStringRef>
@@ -214,7 +326,7 @@ UInt32 Device::GetPropertyData(pid_t clientProcessID,
         auto objData = static_cast<AudioObjectID*>(data);
         std::iota(objData,
                   objData + itemCount,
-                  static_cast<AudioObjectID>(kObjectID_Stream_Output));
+                  outputStream_->ObjectID());
         return itemCount * sizeof(AudioObjectID);
       }
       return 0;
@@ -222,7 +334,7 @@ UInt32 Device::GetPropertyData(pid_t clientProcessID,
       
     case kAudioDevicePropertyDeviceUID:
       return GetPropertyDataImpl<CFStringRef>
-          (dataSize, CFSTR("mac2rpi-device"), data);
+          (dataSize, static_cast<CFStringRef>(CFRetain(uid_)), data);
       
     case kAudioDevicePropertyModelUID:
       return GetPropertyDataImpl<CFStringRef>
@@ -262,6 +374,8 @@ UInt32 Device::GetPropertyData(pid_t clientProcessID,
       return GetPropertyDataImpl<UInt32>(dataSize, 1, data);
       
     case kAudioDevicePropertyLatency:
+      // The delay of the limiter is the latency of the output stream, which
+      // the host adds to this one.
       return GetPropertyDataImpl<UInt32>(dataSize, 0, data);
       
     case kAudioDevicePropertyStreams:
@@ -273,7 +387,7 @@ UInt32 Device::GetPropertyData(pid_t clientProcessID,
         if (itemCount > 0) {
           static_assert(numberOfStreams == 1, "Wrong number of streams");
           auto objData = static_cast<AudioObjectID*>(data);
-          objData[0] = kObjectID_Stream_Output;
+          objData[0] = outputStream_->ObjectID();
           return sizeof(AudioObjectID);
         }
       }
@@ -289,7 +403,7 @@ UInt32 Device::GetPropertyData(pid_t clientProcessID,
         auto objData = static_cast<AudioObjectID*>(data);
         std::iota(objData,
                   objData + itemCount,
-                  static_cast<AudioObjectID>(kObjectID_Volume_Output_Master));
+                  volumeControl_->ObjectID());
         return itemCount * sizeof(AudioObjectID);
       }
       return 0;
@@ -317,26 +431,25 @@ UInt32 Device::GetPropertyData(pid_t clientProcessID,
       return GetPropertyDataImpl<UInt32>(dataSize, 0, data);
       
     case kAudioDevicePropertyPreferredChannelsForStereo:
-      static_assert(numberOfChannels == 2, "Wrong number of channels");
-      CheckOutDataSize(dataSize, numberOfChannels * sizeof(UInt32));
+      // Every layout starts with the left and right channels.
+      CheckOutDataSize(dataSize, 2 * sizeof(UInt32));
       static_cast<UInt32*>(data)[0] = 1;
       static_cast<UInt32*>(data)[1] = 2;
-      return numberOfChannels * sizeof(UInt32);
+      return 2 * sizeof(UInt32);
       
     case kAudioDevicePropertyPreferredChannelLayout:
-      // Return a stereo ACL.
     {
       UInt32 ACLsize = offsetof(AudioChannelLayout, mChannelDescriptions)
-          + (numberOfChannels * sizeof(AudioChannelDescription));
+          + (NumberOfChannels() * sizeof(AudioChannelDescription));
       CheckOutDataSize(dataSize, ACLsize);
       auto ACLdata = static_cast<AudioChannelLayout*>(data);
       ACLdata->mChannelLayoutTag = kAudioChannelLayoutTag_UseChannelDescriptions;
       ACLdata->mChannelBitmap = 0;
-      ACLdata->mNumberChannelDescriptions = numberOfChannels;
+      ACLdata->mNumberChannelDescriptions = NumberOfChannels();
       
-      for (unsigned i = 0; i < numberOfChannels; i++) {
+      for (unsigned i = 0; i < NumberOfChannels(); i++) {
         auto& desc = ACLdata->mChannelDescriptions[i];
-        desc.mChannelLabel = kAudioChannelLabel_Left + i;
+        desc.mChannelLabel = configuration_.channelLayout.labels[i];
         desc.mChannelFlags = 0;
         desc.mCoordinates[0] = 0;
         desc.mCoordinates[1] = 0;
@@ -348,7 +461,35 @@ UInt32 Device::GetPropertyData(pid_t clientProcessID,
       
     case kAudioDevicePropertyZeroTimeStampPeriod:
       return GetPropertyDataImpl<UInt32>
-          (dataSize, ringBufferSize, data);
+          (dataSize, ringBufferSize_.load(), data);
+      
+    case kAudioObjectPropertyCustomPropertyInfoList:
+    {
+      AudioServerPlugInCustomPropertyInfo info;
+      info.mSelector = outputLevelsProperty;
+      info.mPropertyDataType = kAudioServerPlugInCustomPropertyDataTypeCFPropertyList;
+      info.mQualifierDataType = kAudioServerPlugInCustomPropertyDataTypeNone;
+      return GetPropertyDataImpl<AudioServerPlugInCustomPropertyInfo>
+          (dataSize, info, data);
+    }
+      
+    case outputLevelsProperty:
+    {
+      // Checked first, so the dictionary cannot leak. The caller releases
+      // it.
+      CheckOutDataSize(dataSize, sizeof(CFPropertyListRef));
+      auto peaks = CreateLevelArray(peakLevels_.data(), NumberOfChannels());
+      auto rms = CreateLevelArray(rmsLevels_.data(), NumberOfChannels());
+      auto levels = CFDictionaryCreateMutable(nullptr,
+                                              2,
+                                              &kCFTypeDictionaryKeyCallBacks,
+                                              &kCFTypeDictionaryValueCallBacks);
+      CFDictionarySetValue(levels, CFSTR("peak"), peaks);
+      CFDictionarySetValue(levels, CFSTR("rms"), rms);
+      CFRelease(peaks);
+      CFRelease(rms);
+      return GetPropertyDataImpl<CFPropertyListRef>(dataSize, levels, data);
+    }
   };
   
   return AudioObject::GetPropertyData(clientProcessID,
@@ -370,34 +511,11 @@ Device::SetPropertyData(pid_t clientProcessID,
     case kAudioDevicePropertyNominalSampleRate:
     {
       CheckInDataSize(dataSize, sizeof(Float64));
+      RequestSampleRateChange(*(static_cast<const Float64*>(data)));
       
-      LOG("############## Set nominal sample rate: UNSUPPORTED");
-      // TODO
-#if 0
-      auto sampleRate = *(static_cast<const Float64*>(data));
-      if (sampleRate != 44100.0 && sampleRate != 48000.0)
-        throw OSException("invalid sample rate",
-                          kAudioHardwareIllegalOperationError);
-      
-      LOG(boost::format("Changing sample rate: %1%") % sampleRate);
-      
-      // XXX can't we just use atomics?
-      Float64 oldSampleRate;
-      {
-      std::lock_guard<std::mutex> lock(gPlugInStateMutex);
-      oldSampleRate = gDeviceSampleRate;
-      }
-      
-      if (sampleRate != oldSampleRate) {
-        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
-          ^{ gPlugInHost->RequestDeviceConfigurationChange(gPluginHost,
-                                                           kObjectID_Device,
-                                                           static_cast<UInt64>(sampleRate),
-                                                           nullptr);
-          });
-      }
-#endif
-      
+      // The new sample rate is not applied until the host performs the
+      // configuration change, so nothing has changed yet.
+      return std::make_pair(0, ChangedPropertyList{});
     }
   };
   
@@ -415,8 +533,139 @@ void Device::ComputeHostTicksPerFrame() {
   auto hostClockFrequency =
   static_cast<Float64>(timeBaseInfo.denom) / timeBaseInfo.numer;
   hostClockFrequency *= 1000000000.0;
+  nanosecondsPerHostTick_ =
+      static_cast<Float64>(timeBaseInfo.numer) / timeBaseInfo.denom;
   hostTicksPerFrame_ = hostClockFrequency / sampleRate_;
-  LOG(boost::format("###### host ticks per frame: %1%") % hostTicksPerFrame_);
+  LOG(Timing, Info,
+      boost::format("###### host ticks per frame: %1%") % hostTicksPerFrame_);
+}
+
+bool Device::IsSampleRateSupported(Float64 sampleRate) {
+  return std::find(begin(availableSampleRates),
+                   end(availableSampleRates),
+                   sampleRate) != end(availableSampleRates);
+}
+
+void Device::RequestFormatChange(Float64 sampleRate,
+                                 SampleFormat physicalFormat) {
+  if (!IsSampleRateSupported(sampleRate))
+    throw OSException("unsupported sample rate",
+                      kAudioHardwareIllegalOperationError);
+  
+  if (sampleRate == sampleRate_ && physicalFormat == physicalFormat_)
+    return;
+  
+  LOG(Control, Info,
+      boost::format("Requesting format change: %1% Hz, format %2%")
+      % sampleRate
+      % static_cast<unsigned>(physicalFormat));
+  pendingSampleRate_ = sampleRate;
+  pendingPhysicalFormat_ = physicalFormat;
+  RequestConfigurationChange(kConfigurationChangeFormat);
+}
+
+void Device::ApplySettings(const Settings& settings) {
+  limiter_.SetCeiling(DecibelsToGain(settings.limiterCeiling));
+  
+  if (settings.ringBufferSize == ringBufferSize_
+      && settings.wireBitRateBudget == wireBitRateBudget_
+      && (settings.limiterCeiling < 0) == limiterEnabled_)
+    return;
+  
+  LOG(Control, Info,
+      boost::format("Requesting settings change: ring buffer %1% frames, "
+                    "bit rate budget %2%, limiter ceiling %3% dBFS")
+      % settings.ringBufferSize
+      % settings.wireBitRateBudget
+      % settings.limiterCeiling);
+  RequestConfigurationChange(kConfigurationChangeSettings);
+}
+
+void Device::RequestConfigurationChange(ConfigurationChange change) {
+  // The host must not be called back from within a property operation, so
+  // the request is sent from another thread.
+  // The device might be destroyed before the request is sent, so only its
+  // ID is passed along.
+  // The change is packed along with the ID, in the context pointer.
+  static_assert(sizeof(void*) >= 8, "context pointer too small");
+  auto context = (static_cast<UInt64>(change) << 32) | ObjectID();
+  dispatch_async_f(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                   reinterpret_cast<void*>(static_cast<uintptr_t>(context)),
+                   [](void* context) {
+    auto value = static_cast<UInt64>(reinterpret_cast<uintptr_t>(context));
+    auto objectID = static_cast<AudioObjectID>(value & 0xffffffff);
+    auto host = PlugIn::GetInstance().Host();
+    if (host == nullptr) {
+      LOG(Control, Warning, "RequestConfigurationChange: no host");
+      return;
+    }
+    host->RequestDeviceConfigurationChange(host,
+                                           objectID,
+                                           value >> 32,
+                                           nullptr);
+  });
+}
+
+void Device::PerformConfigurationChange(UInt64 changeAction) {
+  if (changeAction != kConfigurationChangeFormat
+      && changeAction != kConfigurationChangeSettings)
+    throw OSException("unknown configuration change",
+                      kAudioHardwareIllegalOperationError);
+  
+  std::lock_guard<std::mutex> lock(drainMutex_);
+  DrainOutput();
+  outputState_ = OutputState::Reconfiguring;
+  
+  if (changeAction == kConfigurationChangeFormat) {
+    sampleRate_ = pendingSampleRate_.load();
+    physicalFormat_ = pendingPhysicalFormat_.load();
+    LOG(Control, Info,
+        boost::format("Performing format change: %1% Hz, format %2%")
+        % sampleRate_
+        % static_cast<unsigned>(physicalFormat_.load()));
+  } else {
+    const auto& settings = SettingsWatcher::Current();
+    ringBufferSize_ = settings.ringBufferSize;
+    wireBitRateBudget_ = settings.wireBitRateBudget;
+    limiterEnabled_ = settings.limiterCeiling < 0;
+    LOG(Control, Info,
+        boost::format("Performing settings change: ring buffer %1% frames, "
+                      "bit rate budget %2%, limiter %3%")
+        % ringBufferSize_
+        % wireBitRateBudget_
+        % (limiterEnabled_ ? "on" : "off"));
+  }
+  
+  // Re-anchor the clock, as the length of a ring buffer in host ticks has
+  // changed along with the sample rate or the ring buffer size.
+  ComputeHostTicksPerFrame();
+  numberTimeStamps_ = 0;
+  anchorHostTime_ = mach_absolute_time();
+  nextWriteSampleTime_ = -1;
+  Metrics::Add(metrics_.timeStampReanchors);
+  
+  degradedCycles_ = 0;
+  limiter_.Reset(sampleRate_);
+  UpdatePacketizerFormat();
+  SendFormatPacket();
+  
+  outputState_ = OutputState::Running;
+}
+
+void Device::DrainOutput() {
+  // Once the state is no longer running, new writes are dropped, so only
+  // those that were already sending need to be waited for.
+  outputState_ = OutputState::Draining;
+  while (writesInFlight_ > 0)
+    std::this_thread::yield();
+}
+
+void Device::AbortConfigurationChange(UInt64 changeAction) {
+#pragma unused(changeAction)
+  
+  pendingSampleRate_ = sampleRate_.load();
+  pendingPhysicalFormat_ = physicalFormat_.load();
+  outputState_ = OutputState::Running;
 }
 
 void Device::StartIO() {
@@ -426,8 +675,14 @@ void Device::StartIO() {
 
   if (ioIsRunning_ == 0) {
     ioIsRunning_ = 1;
+    streamStarting_ = true;
+    suspended_ = false;
+    silentFrames_ = 0;
+    limiter_.Reset(sampleRate_);
     numberTimeStamps_ = 0;
     anchorHostTime_ = mach_absolute_time();
+    nextWriteSampleTime_ = -1;
+    Metrics::Add(metrics_.timeStampReanchors);
   } else {
     ++ioIsRunning_;
   }
@@ -438,13 +693,16 @@ void Device::StopIO() {
     throw OSException("IO is not running",
                       kAudioHardwareIllegalOperationError);
   
-  --ioIsRunning_;
+  if (--ioIsRunning_ == 0)
+    EndStream();
 }
 
 void Device::GetZeroTimeStamp(Float64& sampleTime,
                               UInt64& hostTime,
                               UInt64& seed) {
+  TraceScope trace(TraceEvent::GetZeroTimeStamp, ObjectID());
   auto currentHostTime = mach_absolute_time();
+  const UInt32 ringBufferSize = ringBufferSize_;
   auto hostTicksPerRingBuffer = hostTicksPerFrame_ * ringBufferSize;
   auto hostTickOffset = (numberTimeStamps_ + 1) * hostTicksPerRingBuffer;
   auto nextHostTime = anchorHostTime_ + static_cast<UInt64>(hostTickOffset);
@@ -455,6 +713,7 @@ void Device::GetZeroTimeStamp(Float64& sampleTime,
   sampleTime = numberTimeStamps_ * ringBufferSize;
   hostTime = anchorHostTime_ + numberTimeStamps_ * hostTicksPerRingBuffer;
   seed = 1;
+  trace.SetTimeStamp(sampleTime, hostTime);
 }
 
 std::pair<bool, bool> Device::WillDoIOOperation(UInt32 operationID) const {
@@ -467,7 +726,11 @@ std::pair<bool, bool> Device::WillDoIOOperation(UInt32 operationID) const {
 void Device::BeginIOOperation(UInt32 operationID,
                               UInt32 ioBufferFrameSize,
                               const AudioServerPlugInIOCycleInfo& ioCycleInfo) {
-#pragma unused(operationID, ioBufferFrameSize, ioCycleInfo)
+#pragma unused(operationID)
+  TraceScope trace(TraceEvent::BeginIOOperation,
+                   ObjectID(),
+                   ioCycleInfo.mOutputTime.mSampleTime,
+                   ioBufferFrameSize);
 }
 
 void Device::DoIOOperation(AudioObjectID streamObjectID,
@@ -476,10 +739,15 @@ void Device::DoIOOperation(AudioObjectID streamObjectID,
                            const AudioServerPlugInIOCycleInfo& ioCycleInfo,
                            void* ioMainBuffer,
                            void* ioSecondaryBuffer) {
-  if (operationID == kAudioServerPlugInIOOperationWriteMix)
-    WriteOutputData(ioBufferFrameSize,
-                    ioCycleInfo.mOutputTime.mSampleTime,
-                    ioMainBuffer);
+  TraceScope trace(TraceEvent::DoIOOperation,
+                   ObjectID(),
+                   ioCycleInfo.mOutputTime.mSampleTime,
+                   ioBufferFrameSize);
+  if (operationID == kAudioServerPlugInIOOperationWriteMix) {
+    auto start = mach_absolute_time();
+    WriteOutputData(ioBufferFrameSize, ioCycleInfo, ioMainBuffer);
+    Metrics::Record(metrics_.ioOperationDuration, mach_absolute_time() - start);
+  }
 }
 
 void Device::EndIOOperation(UInt32 operationID,
@@ -489,18 +757,361 @@ void Device::EndIOOperation(UInt32 operationID,
 }
 
 void Device::WriteOutputData(UInt32 ioBufferFrameSize,
-                             Float64 sampleTime,
-                             const void* buffer) {
-  try {
-    LOG(boost::format("WriteOutputData: ioBufferFrameSize=%1%")
-        % ioBufferFrameSize);
-    outputSocket_.send_to(
-                          asio::buffer(buffer, ioBufferFrameSize * 8),
-                          endpoint_
-                          );
-  } catch (const boost::system::system_error& e) {
-    // TODO: check this again after moving to multicast
-    LOG(boost::format("### WriteOutputData: unexpected error (%1%)") % e.what());
-    throw OSException(e.what());
+                             const AudioServerPlugInIOCycleInfo& ioCycleInfo,
+                             void* buffer) {
+  const auto writeStartHostTime = mach_absolute_time();
+  const auto sampleTime = ioCycleInfo.mOutputTime.mSampleTime;
+  TraceScope trace(TraceEvent::WriteOutputData,
+                   ObjectID(),
+                   sampleTime,
+                   ioBufferFrameSize);
+  WriteInFlight writeInFlight(writesInFlight_);
+  if (outputState_ != OutputState::Running)
+    return;
+  
+  Metrics::Add(metrics_.ioCycles);
+  if (nextWriteSampleTime_ >= 0 && sampleTime != nextWriteSampleTime_)
+    Metrics::Add(metrics_.ringOverruns);
+  nextWriteSampleTime_ = sampleTime + ioBufferFrameSize;
+  
+  // Only float buffers can carry invalid values or overs: the HAL clips
+  // the mix when it converts it to an integer format. The limiter keeps
+  // running while the output is suspended, so nothing is lost on resume.
+  if (physicalFormat_ == SampleFormat::Float32) {
+    auto samples = static_cast<Float32*>(buffer);
+    auto sanitized = SanitizeSamples(samples, ioBufferFrameSize * NumberOfChannels());
+    if (sanitized > 0)
+      Metrics::Add(metrics_.sanitizedSamples, sanitized);
+    if (limiterEnabled_ && limiter_.Process(samples, ioBufferFrameSize))
+      Metrics::Add(metrics_.limitedCycles);
+  }
+  
+  const bool silent = IsSilent(buffer,
+                               ioBufferFrameSize * NumberOfChannels()
+                               * BytesPerSample(physicalFormat_));
+  if (silent) {
+    Metrics::Add(metrics_.silenceCycles);
+    silentFrames_ += ioBufferFrameSize;
+  } else {
+    silentFrames_ = 0;
+  }
+  UpdateLevels(buffer, ioBufferFrameSize, silent);
+  
+  const auto suspendAfterSilence = SettingsWatcher::Current().suspendAfterSilence;
+  const bool idle = !outputActive_
+      || (suspendAfterSilence > 0
+          && silentFrames_ >= suspendAfterSilence * sampleRate_);
+  if (idle) {
+    if (!suspended_)
+      SuspendStream(sampleTime, buffer, ioBufferFrameSize);
+    Metrics::Add(metrics_.suspendedCycles);
+    return;
+  }
+  const bool resuming = suspended_;
+  if (resuming)
+    ResumeStream(sampleTime);
+  
+  LOG_RT(IO, Trace,
+         LogMessageID::WriteOutputData,
+         ioBufferFrameSize,
+         static_cast<UInt64>(sampleTime));
+  
+  // Nothing in here may allocate: errors are reported through error codes
+  // rather than exceptions, and logged through the real-time log.
+  transport_.Flush();
+  
+  if (streamStarting_.exchange(false))
+    StartStream(sampleTime);
+  if (fadeInFramesLeft_ > 0) {
+    auto frames = std::min(fadeInFramesLeft_, ioBufferFrameSize);
+    ApplyGainRamp(buffer,
+                  physicalFormat_,
+                  NumberOfChannels(),
+                  frames,
+                  static_cast<Float32>(fadeInFrames_ - fadeInFramesLeft_) / fadeInFrames_,
+                  1.0f / fadeInFrames_);
+    fadeInFramesLeft_ -= frames;
+  }
+  
+  UInt32 failedPackets = 0;
+  boost::system::error_code sendError;
+  bool overloaded = false;
+  packetizer_.Packetize(buffer,
+                        ioBufferFrameSize,
+                        sampleTime + wireSampleTimeOffset_,
+                        [&](const std::array<asio::const_buffer, 2>& buffers) {
+    boost::system::error_code error;
+    switch (transport_.Send(buffers, error)) {
+      case Transport::SendResult::Sent:
+      case Transport::SendResult::Queued:
+        break;
+      case Transport::SendResult::Dropped:
+        overloaded = true;
+        break;
+      case Transport::SendResult::Failed:
+        failedPackets++;
+        sendError = error;
+        break;
+    }
+  });
+  
+  // A lost cycle is not worth failing the IO operation for: the receiver
+  // conceals the gap.
+  if (failedPackets > 0)
+    LOG_RT(Network, Error,
+           LogMessageID::SendFailed,
+           failedPackets,
+           static_cast<UInt64>(sendError.value()));
+  
+  if (resuming)
+    Metrics::Record(metrics_.resumeDuration,
+                    mach_absolute_time() - writeStartHostTime);
+  
+  if (configuration_.overloadPolicy == OverloadPolicy::Degrade)
+    UpdateDegradedFormat(overloaded);
+  
+  auto probeInterval = SettingsWatcher::Current().latencyProbeInterval;
+  if (probeInterval > 0 && ++cyclesSinceProbe_ >= probeInterval) {
+    cyclesSinceProbe_ = 0;
+    SendLatencyProbe(ioCycleInfo, ioBufferFrameSize, writeStartHostTime);
+  }
+}
+
+void Device::StartStream(Float64 sampleTime) noexcept {
+  const auto& settings = SettingsWatcher::Current();
+  const UInt32 preRollFrames = settings.preRollFrames;
+  fadeInFrames_ = settings.fadeFrames;
+  fadeInFramesLeft_ = settings.fadeFrames;
+  
+  // The pre-roll takes the place of the frames before the first cycle.
+  wireSampleTimeOffset_ = preRollFrames;
+  auto header = packetizer_.MakeHeader(PacketType::Start, preRollFrames, sampleTime);
+  transport_.Send({{
+    asio::buffer(&header, sizeof(header)),
+    asio::const_buffer(),
+  }});
+  
+  // Zero bytes are silence in every sample format.
+  static const std::array<UInt8, Packetizer::maxPayloadSize> silence {};
+  const auto bytesPerFrame = NumberOfChannels() * BytesPerSample(physicalFormat_);
+  const UInt32 chunkFrames = static_cast<UInt32>(silence.size() / bytesPerFrame);
+  for (UInt32 sent = 0; sent < preRollFrames;) {
+    auto frames = std::min(chunkFrames, preRollFrames - sent);
+    packetizer_.Packetize(silence.data(),
+                          frames,
+                          sampleTime + sent,
+                          [this](const std::array<asio::const_buffer, 2>& buffers) {
+      transport_.Send(buffers);
+    });
+    sent += frames;
+  }
+}
+
+void Device::EndStream() {
+  // The state of the stream belongs to the IO thread, even once the host
+  // stopped calling it: an IO cycle may still be finishing.
+  std::lock_guard<std::mutex> lock(drainMutex_);
+  DrainOutput();
+  
+  // Nothing was sent if no IO cycle ran since StartIO(), and the end marker
+  // was sent already if the stream is suspended.
+  if (!streamStarting_.exchange(false) && nextWriteSampleTime_ >= 0 && !suspended_) {
+    auto endSampleTime = nextWriteSampleTime_ + wireSampleTimeOffset_;
+    
+    // The limiter still holds the last frames of the stream: silence
+    // pushes them out.
+    if (IsLimiting()) {
+      std::array<Float32, Limiter::lookaheadFrames * ChannelLayout::maxChannels> tail {};
+      limiter_.Process(tail.data(), Limiter::lookaheadFrames);
+      transport_.Flush();
+      SendFrames(tail.data(), Limiter::lookaheadFrames, endSampleTime);
+      endSampleTime += Limiter::lookaheadFrames;
+    }
+    
+    auto header = packetizer_.MakeHeader(PacketType::End,
+                                         SettingsWatcher::Current().fadeFrames,
+                                         endSampleTime);
+    auto error = SendDrained(header);
+    if (error) {
+      // The receiver times out instead.
+      LOG(Network, Warning,
+          boost::format("### EndStream: unexpected error (%1%)")
+          % error.message());
+    }
+  }
+  
+  outputState_ = OutputState::Running;
+}
+
+void Device::SuspendStream(Float64 sampleTime,
+                           const void* buffer,
+                           UInt32 ioBufferFrameSize) noexcept {
+  suspended_ = true;
+  Metrics::Add(metrics_.suspensions);
+  LOG_RT(IO, Info,
+         LogMessageID::StreamSuspended,
+         static_cast<UInt32>(silentFrames_),
+         static_cast<UInt64>(sampleTime));
+  
+  // The stream ends where this cycle would have started. If it has not
+  // started yet, there is nothing to end.
+  if (streamStarting_)
+    return;
+  transport_.Flush();
+  
+  // The limiter delayed the end of the stream into this cycle.
+  auto endSampleTime = sampleTime + wireSampleTimeOffset_;
+  if (IsLimiting()) {
+    const auto frames = std::min(Limiter::lookaheadFrames, ioBufferFrameSize);
+    SendFrames(buffer, frames, endSampleTime);
+    endSampleTime += frames;
+  }
+  
+  auto header = packetizer_.MakeHeader(PacketType::End,
+                                       SettingsWatcher::Current().fadeFrames,
+                                       endSampleTime);
+  transport_.Send({{
+    asio::buffer(&header, sizeof(header)),
+    asio::const_buffer(),
+  }});
+}
+
+void Device::SendFrames(const void* frames,
+                        UInt32 frameCount,
+                        Float64 wireSampleTime) noexcept {
+  packetizer_.Packetize(frames,
+                        frameCount,
+                        wireSampleTime,
+                        [this](const std::array<asio::const_buffer, 2>& buffers) {
+    transport_.Send(buffers);
+  });
+}
+
+void Device::ResumeStream(Float64 sampleTime) noexcept {
+  suspended_ = false;
+  LOG_RT(IO, Info,
+         LogMessageID::StreamResumed,
+         static_cast<UInt64>(sampleTime));
+  
+  // The receiver dropped the stream at the end marker: start a new one,
+  // with its pre-roll and fade-in, in this very cycle.
+  streamStarting_ = true;
+  degradedCycles_ = 0;
+  cyclesSinceProbe_ = 0;
+  UpdatePacketizerFormat();
+}
+
+void Device::UpdateLevels(const void* buffer,
+                          UInt32 ioBufferFrameSize,
+                          bool silent) noexcept {
+  std::array<Float32, ChannelLayout::maxChannels> peaks {};
+  std::array<Float32, ChannelLayout::maxChannels> rms {};
+  if (!silent)
+    MeasureLevels(buffer,
+                  physicalFormat_,
+                  NumberOfChannels(),
+                  ioBufferFrameSize,
+                  peaks.data(),
+                  rms.data());
+  
+  for (unsigned channel = 0; channel < NumberOfChannels(); channel++) {
+    peakLevels_[channel].store(peaks[channel], std::memory_order_relaxed);
+    rmsLevels_[channel].store(rms[channel], std::memory_order_relaxed);
+    Metrics::Set(metrics_.peakLevels[channel], peaks[channel]);
+    Metrics::Set(metrics_.rmsLevels[channel], rms[channel]);
+  }
+}
+
+void Device::SendLatencyProbe(const AudioServerPlugInIOCycleInfo& ioCycleInfo,
+                              UInt32 ioBufferFrameSize,
+                              UInt64 writeStartHostTime) noexcept {
+  // Host times are relative to the boot of this machine; the receiver can
+  // only compare wall clock times with its own.
+  const auto nowHostTime = mach_absolute_time();
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  const auto nowWallClock = static_cast<SInt64>(now.tv_sec) * 1000000000
+      + now.tv_nsec;
+  auto toWallClock = [&](UInt64 hostTime) {
+    auto ticksAgo = static_cast<SInt64>(nowHostTime - hostTime);
+    return static_cast<UInt64>(nowWallClock - static_cast<SInt64>(
+        ticksAgo * nanosecondsPerHostTick_));
+  };
+  
+  ProbePayload probe;
+  probe.cycleStartTime = toWallClock(ioCycleInfo.mCurrentTime.mHostTime);
+  probe.writeStartTime = toWallClock(writeStartHostTime);
+  probe.sendEndTime = static_cast<UInt64>(nowWallClock);
+  probe.outputTime = toWallClock(ioCycleInfo.mOutputTime.mHostTime);
+  
+  auto header = packetizer_.MakeHeader(PacketType::Probe,
+                                       ioBufferFrameSize,
+                                       ioCycleInfo.mOutputTime.mSampleTime
+                                       + wireSampleTimeOffset_);
+  transport_.Send({{
+    asio::buffer(&header, sizeof(header)),
+    asio::buffer(&probe, sizeof(probe)),
+  }});
+}
+
+void Device::UpdateDegradedFormat(bool overloaded) {
+  if (overloaded) {
+    if (degradedCycles_ == 0)
+      packetizer_.SetFormat(sampleRate_,
+                            NumberOfChannels(),
+                            physicalFormat_,
+                            SampleFormat::Int16);
+    degradedCycles_ = SettingsWatcher::Current().degradeHoldCycles;
+  } else if (degradedCycles_ > 0 && --degradedCycles_ == 0) {
+    UpdatePacketizerFormat();
+  }
+  
+  if (degradedCycles_ > 0)
+    Metrics::Add(metrics_.degradedCycles);
+}
+
+SampleFormat Device::SelectWireFormat(Float64 sampleRate,
+                                      unsigned channels,
+                                      SampleFormat physicalFormat) const {
+  for (auto format : { physicalFormat, SampleFormat::Int24 }) {
+    if (BytesPerSample(format) > BytesPerSample(physicalFormat))
+      continue;
+    auto bitRate = sampleRate * channels * BytesPerSample(format) * 8;
+    if (bitRate <= wireBitRateBudget_)
+      return format;
+  }
+  return SampleFormat::Int16;
+}
+
+void Device::UpdatePacketizerFormat() {
+  packetizer_.SetFormat(sampleRate_,
+                        NumberOfChannels(),
+                        physicalFormat_,
+                        SelectWireFormat(sampleRate_,
+                                         NumberOfChannels(),
+                                         physicalFormat_));
+}
+
+boost::system::error_code Device::SendDrained(const PacketHeader& header) {
+  // The datagrams of the last IO cycles go first.
+  transport_.Flush();
+  boost::system::error_code error;
+  auto result = transport_.Send({{
+    asio::buffer(&header, sizeof(header)),
+    asio::const_buffer(),
+  }}, error);
+  if (result == Transport::SendResult::Dropped)
+    return asio::error::would_block;
+  return error;
+}
+
+void Device::SendFormatPacket() {
+  auto header = packetizer_.MakeHeader(PacketType::Format, 0, 0);
+  auto error = SendDrained(header);
+  if (error) {
+    // Not fatal: every audio packet carries the format too.
+    LOG(Network, Warning,
+        boost::format("### SendFormatPacket: unexpected error (%1%)")
+        % error.message());
   }
 }
@@ -2,10 +2,17 @@
 #define Device_h
 
 #include <atomic>
+#include <mutex>
 
 #include <boost/asio.hpp>
 
 #include "AudioObject.h"
+#include "DeviceConfiguration.h"
+#include "Limiter.h"
+#include "Metrics.h"
+#include "Packetizer.h"
+#include "Settings.h"
+#include "Transport.h"
 
 class Stream;
 class MuteControl;
@@ -13,16 +20,72 @@ class VolumeControl;
 
 class Device : public AudioObject {
 public:
-  static constexpr std::array<Float64, 2> availableSampleRates = {{
-    44100.0, 44800.0
+  static constexpr std::array<Float64, 6> availableSampleRates = {{
+    44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0
   }};
   
-  static constexpr Float32 volumeMinDB { -96.0 };
-  static constexpr Float32 volumeMaxDB { 6.0 };
+  /** Custom property with the levels of the last IO cycle: a dictionary
+   * with "peak" and "rms" arrays of dBFS values, one per channel. It
+   * changes every cycle without notifications, so clients poll it.
+   */
+  static constexpr AudioObjectPropertySelector outputLevelsProperty { 'm2lv' };
+  
+  /** Lowest level reported, for silence. */
+  static constexpr Float32 levelFloorDB { -120.0 };
+  
+  /** Configuration changes the device may request to the host. The value is
+   * passed as the change action to RequestDeviceConfigurationChange() and
+   * handed back in PerformConfigurationChange().
+   */
+  enum ConfigurationChange : UInt64 {
+    /** Switch to the pending sample rate and physical format. */
+    kConfigurationChangeFormat = 1,
+    /** Apply the settings that cannot change while IO is running. */
+    kConfigurationChangeSettings = 2,
+  };
+  
+  /** Sample formats the stream accepts as physical format. The virtual
+   * format is always 32-bit float.
+   */
+  static constexpr std::array<SampleFormat, 4> availablePhysicalFormats = {{
+    SampleFormat::Float32,
+    SampleFormat::Int32,
+    SampleFormat::Int24,
+    SampleFormat::Int16,
+  }};
   
-  Device();
+  /** Returns whether the device supports the given sample rate. */
+  static bool IsSampleRateSupported(Float64 sampleRate);
   
-  virtual ~Device() {}
+  /** Creates the device and registers the objects it owns.
+   *
+   * @param objectID First ID of a block of kObjectIDCount_Device IDs. The
+   *        device takes the first one and its sub-objects the rest.
+   * @param configuration The settings of the device.
+   * @param ioService The IO service shared by all the devices.
+   */
+  Device(AudioObjectID objectID,
+         const DeviceConfiguration& configuration,
+         boost::asio::io_service& ioService);
+  
+  virtual ~Device();
+  
+  /** Removes the objects owned by the device from the object map. */
+  void UnregisterSubObjects();
+  
+  /** Returns the current settings of the device. */
+  const DeviceConfiguration& Configuration() const { return configuration_; }
+  
+  /** Changes where the audio is sent, without interrupting IO. Must not be
+   * called concurrently with Configuration().
+   *
+   * @note An exception is thrown if the destinations are not valid, in
+   *       which case the old ones are kept.
+   */
+  void SetDestinations(const std::vector<Destination>& destinations);
+  
+  /** Returns the UID of the device. */
+  CFStringRef UID() const { return uid_; }
   
   Boolean HasProperty(pid_t clientProcessID,
                       const AudioObjectPropertyAddress& address) const override;
@@ -55,18 +118,67 @@ public:
    */
   void ComputeHostTicksPerFrame();
   
+  /** Asks the host to switch the device to a new sample rate.
+   *
+   * @param sampleRate The new sample rate.
+   * @note An exception is thrown if the sample rate is not supported.
+   */
+  void RequestSampleRateChange(Float64 sampleRate) {
+    RequestFormatChange(sampleRate, PhysicalFormat());
+  }
+  
+  /** Asks the host to switch the device to a new sample rate and physical
+   * format.
+   *
+   * The switch does not happen right away. The host stops IO and then calls
+   * PerformConfigurationChange(), which is where the new format is applied.
+   *
+   * @param sampleRate The new sample rate.
+   * @param physicalFormat The new format of the IO buffers.
+   * @note An exception is thrown if the sample rate is not supported.
+   */
+  void RequestFormatChange(Float64 sampleRate, SampleFormat physicalFormat);
+  
+  /** Asks the host for a configuration change if settings that cannot
+   * change while IO is running differ from those in effect on the device.
+   *
+   * @param settings The new settings.
+   */
+  void ApplySettings(const Settings& settings);
+  
+  /** Applies a configuration change previously requested to the host.
+   *
+   * Any output write still in flight is drained first. Then the clock is
+   * re-anchored to the new sample rate or ring buffer size and the new
+   * format is announced to the receiver before output is resumed.
+   *
+   * @param changeAction The change action passed to the host.
+   */
+  void PerformConfigurationChange(UInt64 changeAction);
+  
+  /** Discards a configuration change previously requested to the host.
+   *
+   * @param changeAction The change action passed to the host.
+   */
+  void AbortConfigurationChange(UInt64 changeAction);
+  
   /** Starts IO on the device.
    *
-   * TODO add a more detailed description.
+   * The first call starts a new stream: the first IO cycle announces it
+   * with a PacketType::Start marker followed by the pre-roll, and its audio
+   * is faded in.
    */
   void StartIO();
 
   /** Stops IO on the device.
    *
-   * TODO add a more detailed description.
+   * The last call ends the stream with a PacketType::End marker.
    */
   void StopIO();
 
+  /** Returns whether IO is running on the device. */
+  bool IsRunning() const { return ioIsRunning_ > 0; }
+
   /**
    * TODO add a description.
    */
@@ -113,18 +225,50 @@ public:
                       const AudioServerPlugInIOCycleInfo& ioCycleInfo);
 
   /** Writes output data to the network connection.
+   *
+   * Float samples are sanitized first, then go through the limiter when it
+   * is enabled, which delays them by Limiter::lookaheadFrames.
+   *
+   * Nothing is sent while the stream is inactive or after
+   * Settings::suspendAfterSilence seconds of silence: the stream is ended
+   * with a PacketType::End marker and the socket is left alone. The first
+   * cycle with audio restarts the stream as StartIO() does, so the receiver
+   * re-synchronizes from its sample time.
    *
    * @param ioBufferFrameSize The number of frames to be written.
-   * @param sampleTime ???
-   * @param buffer The buffer containing the audio frames.
+   * @param ioCycleInfo The times of the IO cycle.
+   * @param buffer The buffer containing the audio frames; the limiter and
+   *        the fade-in are applied in place.
    */
   void WriteOutputData(UInt32 ioBufferFrameSize,
-                       Float64 sampleTime,
-                       const void* buffer);
+                       const AudioServerPlugInIOCycleInfo& ioCycleInfo,
+                       void* buffer);
 
+  /** Returns the number of channels of the device. */
+  unsigned NumberOfChannels() const {
+    return configuration_.channelLayout.channels;
+  }
+  
   /** Returns the sample rate for the device. */
   Float64 SampleRate() const { return sampleRate_; }
   
+  /** Returns the format of the IO buffers of the output stream. */
+  SampleFormat PhysicalFormat() const { return physicalFormat_; }
+  
+  /** Returns whether the output stream goes through the limiter: only
+   * float buffers do, while it is enabled.
+   */
+  bool IsLimiting() const {
+    return limiterEnabled_ && physicalFormat_ == SampleFormat::Float32;
+  }
+  
+  /** Returns the frames the output path delays the stream by: the
+   * lookahead of the limiter, when the stream goes through it.
+   */
+  UInt32 OutputLatency() const {
+    return IsLimiting() ? Limiter::lookaheadFrames : 0;
+  }
+  
   /** Returns the output volume for the device. */
   Float32 OutputVolume() const { return outputVolume_; }
   
@@ -136,8 +280,131 @@ public:
 
   /** Sets whether the device is muted or not. */
   void SetOutputMute(bool mute) { outputMute_ = mute; }
+  
+  /** Returns whether the output stream is active. */
+  bool OutputActive() const { return outputActive_; }
+  
+  /** Sets whether the output stream is active. The output of an inactive
+   * stream is suspended, as after sustained silence.
+   */
+  void SetOutputActive(bool active) { outputActive_ = active; }
 
 private:
+  /** State of the output path with respect to configuration changes. */
+  enum class OutputState {
+    /** Output data is sent to the receiver. */
+    Running,
+    /** A configuration change waits for in-flight writes to finish. */
+    Draining,
+    /** A configuration change is being applied; output data is dropped. */
+    Reconfiguring,
+  };
+  
+  /** Takes the output path over from the IO thread: IO cycles starting
+   * from now on drop their output, and those in progress are waited for.
+   * Requires drainMutex_; setting outputState_ back to Running hands the
+   * output path back.
+   */
+  void DrainOutput();
+  
+  /** Asks the host to stop IO and call PerformConfigurationChange().
+   *
+   * @param change The change to perform.
+   */
+  void RequestConfigurationChange(ConfigurationChange change);
+  
+  /** Chooses the most accurate wire format that fits within the bit rate
+   * budget of the link. The wire format is never wider than the physical
+   * format, so integer streams are sent as they are whenever possible.
+   */
+  SampleFormat SelectWireFormat(Float64 sampleRate,
+                                unsigned channels,
+                                SampleFormat physicalFormat) const;
+  
+  /** Updates the packetizer after a change in the format of the device. */
+  void UpdatePacketizerFormat();
+  
+  /** Announces the current format of the device to the receiver. Requires
+   * the output path to be drained.
+   */
+  void SendFormatPacket();
+  
+  /** Sends a packet without payload from a thread that drained the output
+   * path (see DrainOutput()), behind the datagrams left in the transport
+   * backlog.
+   *
+   * @return The error, or would_block if the send buffer was full.
+   */
+  boost::system::error_code SendDrained(const PacketHeader& header);
+  
+  /** Applies OverloadPolicy::Degrade at the end of an IO cycle: switches to
+   * 16-bit samples when datagrams were dropped, and back to the normal wire
+   * format once Settings::degradeHoldCycles cycles went by without drops.
+   *
+   * @param overloaded Whether datagrams were dropped in this cycle.
+   */
+  void UpdateDegradedFormat(bool overloaded);
+  
+  /** Sends the start marker and the pre-roll from the first IO cycle of a
+   * stream, and arms the fade-in.
+   *
+   * @param sampleTime The sample time of the first IO cycle.
+   */
+  void StartStream(Float64 sampleTime) noexcept;
+  
+  /** Sends the end marker after the last IO cycle of a stream, from the
+   * thread stopping IO. The output path is drained first, so the marker
+   * takes its sequence number and sample time from the packetizer and the
+   * IO cycles it follows, and goes out behind the transport backlog.
+   */
+  void EndStream();
+  
+  /** Ends the stream from the IO thread and stops sending until
+   * ResumeStream().
+   *
+   * @param sampleTime The sample time of the first IO cycle not sent.
+   * @param buffer The frames of that cycle, through the limiter already:
+   *        the first ones are the end of the stream it held back.
+   * @param ioBufferFrameSize The number of frames of the cycle.
+   */
+  void SuspendStream(Float64 sampleTime,
+                     const void* buffer,
+                     UInt32 ioBufferFrameSize) noexcept;
+  
+  /** Sends frames in the input format of the packetizer, from the IO thread
+   * or with the output path drained.
+   *
+   * @param frames The interleaved frames.
+   * @param frameCount The number of frames.
+   * @param wireSampleTime The sample time of the first frame on the wire.
+   */
+  void SendFrames(const void* frames, UInt32 frameCount, Float64 wireSampleTime) noexcept;
+  
+  /** Restarts a suspended stream in the current IO cycle.
+   *
+   * @param sampleTime The sample time of the IO cycle.
+   */
+  void ResumeStream(Float64 sampleTime) noexcept;
+  
+  /** Measures the levels of the frames of an IO cycle, and publishes them
+   * to outputLevelsProperty and the metrics.
+   *
+   * @param buffer The frames, as they are sent.
+   * @param ioBufferFrameSize The number of frames.
+   * @param silent Whether the frames are known to be silence.
+   */
+  void UpdateLevels(const void* buffer, UInt32 ioBufferFrameSize, bool silent) noexcept;
+  
+  /** Sends a latency probe for an IO cycle whose audio was just sent.
+   *
+   * @param ioCycleInfo The times of the IO cycle.
+   * @param ioBufferFrameSize The number of frames of the IO cycle.
+   * @param writeStartHostTime When WriteOutputData() was called.
+   */
+  void SendLatencyProbe(const AudioServerPlugInIOCycleInfo& ioCycleInfo,
+                        UInt32 ioBufferFrameSize,
+                        UInt64 writeStartHostTime) noexcept;
+  
   /** 1 stream (output stream). */
   static constexpr unsigned numberOfStreams { 1 };
   
@@ -148,28 +415,92 @@ private:
   static constexpr unsigned numberOfSubObjects
       { numberOfStreams + numberOfControls };
   
-  /** Number of channels (left + right). */
-  static constexpr unsigned numberOfChannels { 2 };
+  /** Only the destinations change after construction. */
+  DeviceConfiguration configuration_;
+  
+  /** Runtime statistics, published through shared memory. */
+  DeviceMetrics& metrics_;
+  
+  /** Name and UID of the device, as returned to the HAL. */
+  CFStringRef name_;
+  CFStringRef uid_;
   
-  /** Size of the imaginary buffer size. */
-  static constexpr unsigned ringBufferSize { 4096 };
-    
   std::atomic<Float64> sampleRate_ { 44100.0 };
+  std::atomic<Float64> pendingSampleRate_ { 44100.0 };
+  std::atomic<SampleFormat> physicalFormat_ { SampleFormat::Float32 };
+  std::atomic<SampleFormat> pendingPhysicalFormat_ { SampleFormat::Float32 };
   std::atomic<Float32> outputVolume_ { 0 };
   std::atomic<bool> outputMute_ { false };
+  std::atomic<bool> outputActive_ { true };
+  
+  /** Settings::ringBufferSize and Settings::wireBitRateBudget in effect on
+   * the device. Only changed by a configuration change.
+   */
+  std::atomic<UInt32> ringBufferSize_;
+  std::atomic<Float64> wireBitRateBudget_;
   
   std::atomic<UInt64> ioIsRunning_ { 0 };
   std::atomic<Float64> hostTicksPerFrame_ { 0 };
+  Float64 nanosecondsPerHostTick_ { 1 };
   UInt64 numberTimeStamps_ { 0 };
   UInt64 anchorHostTime_ { 0 };
   
+  std::atomic<OutputState> outputState_ { OutputState::Running };
+  std::atomic<UInt32> writesInFlight_ { 0 };
+  
+  /** Serializes the threads taking the output path over (see
+   * DrainOutput()).
+   */
+  std::mutex drainMutex_;
+  
+  /** Sample time expected for the next output write; -1 until the first
+   * write.
+   */
+  Float64 nextWriteSampleTime_ { -1 };
+  
+  /** IO cycles left in the degraded format; 0 when not degraded. */
+  unsigned degradedCycles_ { 0 };
+  
+  /** IO cycles since the last latency probe. */
+  unsigned cyclesSinceProbe_ { 0 };
+  
+  /** Set by StartIO() until the first IO cycle starts the stream. */
+  std::atomic<bool> streamStarting_ { false };
+  
+  /** Added to the sample times of the HAL on the wire, so that the pre-roll
+   * fits before the first IO cycle even when it starts at 0.
+   */
+  Float64 wireSampleTimeOffset_ { 0 };
+  
+  /** Frames of silence in a row written by the last IO cycles. */
+  UInt64 silentFrames_ { 0 };
+  
+  /** Set while the stream is suspended; cleared by StartIO(). */
+  std::atomic<bool> suspended_ { false };
+  
+  /** Peak and RMS of every channel over the last IO cycle, in full scale. */
+  std::array<std::atomic<Float32>, ChannelLayout::maxChannels> peakLevels_ {};
+  std::array<std::atomic<Float32>, ChannelLayout::maxChannels> rmsLevels_ {};
+  
+  /** Length of the fade-in of the stream, and frames of it left to apply. */
+  UInt32 fadeInFrames_ { 0 };
+  UInt32 fadeInFramesLeft_ { 0 };
+  
+  /** Keeps float output under Settings::limiterCeiling. */
+  Limiter limiter_;
+  
+  /** Whether Settings::limiterCeiling is below 0 dBFS. Only changed by a
+   * configuration change, as it changes the latency of the stream.
+   */
+  std::atomic<bool> limiterEnabled_ { false };
+  
+  Packetizer packetizer_;
+  
   std::shared_ptr<Stream> outputStream_;
   std::shared_ptr<VolumeControl> volumeControl_;
   std::shared_ptr<MuteControl> muteControl_;
   
-  boost::asio::io_service ioService_;
-  boost::asio::ip::udp::endpoint endpoint_;
-  boost::asio::ip::udp::socket outputSocket_;
+  Transport transport_;
 };
 
 #endif /* Device_h */
@@ -0,0 +1,92 @@
+#ifndef DeviceConfiguration_h
+#define DeviceConfiguration_h
+
+#include <string>
+#include <vector>
+
+#include "ChannelLayout.h"
+
+/** What to do with audio that does not fit in the socket send buffer. */
+enum class OverloadPolicy {
+  /** Drop the datagrams that do not fit. Latency never grows. */
+  DropNewest,
+  
+  /** Queue the datagrams that do not fit and send them first in the next
+   * cycles, dropping the oldest queued ones when the queue is full.
+   */
+  DropOldest,
+  
+  /** Drop the datagrams that do not fit, and switch to 16-bit samples for
+   * a while to reduce the bit rate.
+   */
+  Degrade,
+};
+
+/** A receiver (or group of receivers) the audio is sent to. */
+struct Destination {
+  /** Address (unicast or multicast). */
+  std::string address;
+  
+  /** UDP port. */
+  unsigned short port;
+};
+
+inline bool operator==(const Destination& lhs, const Destination& rhs) {
+  return lhs.address == rhs.address && lhs.port == rhs.port;
+}
+
+inline bool operator!=(const Destination& lhs, const Destination& rhs) {
+  return !(lhs == rhs);
+}
+
+/** Settings of a device streaming to one or more receivers. */
+struct DeviceConfiguration {
+  /** Persistent identifier of the device. Devices are matched by UID when
+   * the configuration changes.
+   */
+  std::string uid { "mac2rpi-device" };
+  
+  /** Name of the device shown to the user. */
+  std::string name { "mac2rpi-plugin" };
+  
+  /** Where the audio is sent. Every destination gets the same datagrams,
+   * so they must all use the same address family. Destinations can change
+   * without recreating the device.
+   */
+  std::vector<Destination> destinations { { "239.255.0.1", 30001 } };
+  
+  /** Speaker arrangement of the device. */
+  ChannelLayout channelLayout = kChannelLayoutStereo;
+  
+  /** Behaviour when the socket send buffer is full. */
+  OverloadPolicy overloadPolicy { OverloadPolicy::DropNewest };
+  
+  /** Size of the socket send buffer in bytes, or 0 for the system
+   * default.
+   */
+  int sendBufferSize { 0 };
+};
+
+/** Returns whether two configurations differ at most by their
+ * destinations, i.e. whether a device can switch from one to the other.
+ */
+inline bool IsSameDevice(const DeviceConfiguration& lhs,
+                         const DeviceConfiguration& rhs) {
+  return lhs.uid == rhs.uid
+      && lhs.name == rhs.name
+      && lhs.channelLayout.tag == rhs.channelLayout.tag
+      && lhs.overloadPolicy == rhs.overloadPolicy
+      && lhs.sendBufferSize == rhs.sendBufferSize;
+}
+
+inline bool operator==(const DeviceConfiguration& lhs,
+                       const DeviceConfiguration& rhs) {
+  return IsSameDevice(lhs, rhs) && lhs.destinations == rhs.destinations;
+}
+
+inline bool operator!=(const DeviceConfiguration& lhs,
+                       const DeviceConfiguration& rhs) {
+  return !(lhs == rhs);
+}
+
+#endif /* DeviceConfiguration_h */
@@ -0,0 +1,138 @@
+#include "Limiter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+constexpr uint32_t Limiter::lookaheadFrames;
+constexpr double Limiter::releaseSeconds;
+
+namespace {
+  /** Returns the largest magnitude of a block of finite floats.
+   *
+   * The magnitudes are compared as integers, which orders them like floats
+   * and lets the compiler vectorize the loop.
+   */
+  float PeakMagnitude(const float* samples, uint32_t sampleCount) {
+    uint32_t peak = 0;
+    for (uint32_t i = 0; i < sampleCount; i++) {
+      uint32_t bits;
+      std::memcpy(&bits, &samples[i], sizeof(bits));
+      bits &= 0x7fffffff;
+      peak = bits > peak ? bits : peak;
+    }
+    float magnitude;
+    std::memcpy(&magnitude, &peak, sizeof(magnitude));
+    return magnitude;
+  }
+}
+
+Limiter::Limiter(uint32_t channels)
+  : channels_(channels)
+  , delay_(lookaheadFrames * channels)
+{
+  Reset(48000.0);
+}
+
+void Limiter::Reset(double sampleRate) {
+  releaseCoefficient_ = 1.0 - std::exp(-1.0 / (releaseSeconds * sampleRate));
+  std::fill(delay_.begin(), delay_.end(), 0.0f);
+  delayPosition_ = 0;
+  frameIndex_ = 0;
+  minima_[0] = { 0, 1.0f };
+  minimumFront_ = 0;
+  minimumCount_ = 1;
+  smoothedGain_ = 1.0;
+  box_.fill(1.0);
+  boxSum_ = lookaheadFrames;
+}
+
+bool Limiter::Process(float* samples, uint32_t frameCount) noexcept {
+  const float ceiling = ceiling_.load(std::memory_order_relaxed);
+
+  // The common case: nothing to limit, now or in the lookahead window.
+  if (IsIdle() && frameCount >= lookaheadFrames
+      && PeakMagnitude(samples, frameCount * channels_) <= ceiling) {
+    Delay(samples, frameCount);
+    return false;
+  }
+
+  bool limited = false;
+  for (uint32_t frame = 0; frame < frameCount; frame++)
+    limited |= ProcessFrame(samples + frame * channels_, ceiling);
+  return limited;
+}
+
+void Limiter::Delay(float* samples, uint32_t frameCount) noexcept {
+  std::array<float, lookaheadFrames * ChannelLayout::maxChannels> tail;
+  const uint32_t delaySamples = lookaheadFrames * channels_;
+  const uint32_t sampleCount = frameCount * channels_;
+  const uint32_t oldest = delayPosition_ * channels_;
+
+  // The last frames of the block go to the delay, the rest move down, and
+  // the delayed frames come out first, oldest first.
+  std::copy(samples + sampleCount - delaySamples, samples + sampleCount, tail.begin());
+  std::memmove(samples + delaySamples, samples, (sampleCount - delaySamples) * sizeof(float));
+  std::copy(delay_.begin() + oldest, delay_.end(), samples);
+  std::copy(delay_.begin(), delay_.begin() + oldest, samples + delaySamples - oldest);
+  std::copy(tail.begin(), tail.begin() + delaySamples, delay_.begin());
+  delayPosition_ = 0;
+
+  // The window now only holds frames at unity gain.
+  frameIndex_ += frameCount;
+  minima_[minimumFront_] = { frameIndex_ - 1, 1.0f };
+}
+
+bool Limiter::ProcessFrame(float* frame, float ceiling) noexcept {
+  float peak = 0;
+  for (uint32_t channel = 0; channel < channels_; channel++)
+    peak = std::max(peak, std::fabs(frame[channel]));
+  const float needed = peak > ceiling ? ceiling / peak : 1.0f;
+
+  // Minimum over the frame and the lookaheadFrames before it, i.e. over
+  // every frame still in the delay.
+  if (minimumCount_ > 0
+      && frameIndex_ - minima_[minimumFront_].frame > lookaheadFrames) {
+    minimumFront_ = (minimumFront_ + 1) % minima_.size();
+    minimumCount_--;
+  }
+  auto back = [this] {
+    return (minimumFront_ + minimumCount_ - 1) % minima_.size();
+  };
+  while (minimumCount_ > 0 && minima_[back()].gain >= needed)
+    minimumCount_--;
+  minimumCount_++;
+  minima_[back()] = { frameIndex_, needed };
+  const float minimum = minima_[minimumFront_].gain;
+
+  // Drops at once, recovers slowly; never above what the window needs.
+  // The release only approaches 1, so it snaps to it at the end.
+  double released = smoothedGain_ + (1.0 - smoothedGain_) * releaseCoefficient_;
+  if (released > 0.99999)
+    released = 1.0;
+  smoothedGain_ = std::min<double>(minimum, released);
+
+  // Averaging the last lookaheadFrames smoothed gains turns the drop into a
+  // ramp. Each of them covers the frame coming out of the delay, so their
+  // average does too.
+  boxSum_ += smoothedGain_ - box_[delayPosition_];
+  box_[delayPosition_] = smoothedGain_;
+  if (delayPosition_ == lookaheadFrames - 1) {
+    // Keeps rounding errors from piling up.
+    boxSum_ = 0;
+    for (auto gain : box_)
+      boxSum_ += gain;
+  }
+  const auto gain = static_cast<float>(boxSum_ / lookaheadFrames);
+
+  float* delayed = &delay_[delayPosition_ * channels_];
+  for (uint32_t channel = 0; channel < channels_; channel++) {
+    const float out = std::max(-ceiling, std::min(ceiling, delayed[channel] * gain));
+    delayed[channel] = frame[channel];
+    frame[channel] = out;
+  }
+
+  delayPosition_ = (delayPosition_ + 1) % lookaheadFrames;
+  frameIndex_++;
+  return gain < 1.0f;
+}
@@ -0,0 +1,112 @@
+#ifndef Limiter_h
+#define Limiter_h
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "ChannelLayout.h"
+
+/** Lookahead peak limiter for the float samples of the output stream.
+ *
+ * The gain is computed per frame and shared by all the channels, so the
+ * stereo image does not move. Every frame is delayed by lookaheadFrames:
+ * the gain starts going down that many frames before a peak, along a
+ * smooth ramp, and is low enough by the time the peak comes out to keep
+ * it under the ceiling. It then recovers with a release time of
+ * releaseSeconds.
+ *
+ * Process() never allocates and is safe to call from the IO thread. While
+ * no peak is above the ceiling, it only moves the frames through the
+ * delay.
+ */
+class Limiter {
+public:
+  /** How far ahead peaks are seen, which is also the delay added to the
+   * stream (under 1 ms at 48 kHz).
+   */
+  static constexpr uint32_t lookaheadFrames { 32 };
+
+  /** Time for the gain to recover by about 63% after a peak. */
+  static constexpr double releaseSeconds { 0.05 };
+
+  /** Creates a limiter with a ceiling of 0 dBFS.
+   *
+   * @param channels The number of interleaved channels.
+   */
+  explicit Limiter(uint32_t channels);
+
+  /** Sets the highest magnitude of the output samples. May be called from
+   * any thread.
+   *
+   * @param ceiling The ceiling, as a linear gain (1 for 0 dBFS).
+   */
+  void SetCeiling(float ceiling) { ceiling_ = ceiling; }
+
+  /** Empties the delay and resets the gain. Must not be called
+   * concurrently with Process().
+   *
+   * @param sampleRate The sample rate of the stream.
+   */
+  void Reset(double sampleRate);
+
+  /** Limits a block of frames in place.
+   *
+   * @param samples The interleaved frames.
+   * @param frameCount The number of frames.
+   * @return Whether the gain was reduced on some frame.
+   */
+  bool Process(float* samples, uint32_t frameCount) noexcept;
+
+private:
+  /** Returns whether the gain stays at 1 as long as no frame needs less. */
+  bool IsIdle() const {
+    return smoothedGain_ == 1.0
+        && minimumCount_ == 1 && minima_[minimumFront_].gain == 1.0f
+        && boxSum_ == lookaheadFrames;
+  }
+
+  /** Pushes a block through the delay, at unity gain. Requires IsIdle() and
+   * no frame above the ceiling.
+   */
+  void Delay(float* samples, uint32_t frameCount) noexcept;
+
+  /** Limits a single frame; returns whether its gain was below 1. */
+  bool ProcessFrame(float* frame, float ceiling) noexcept;
+
+  const uint32_t channels_;
+  std::atomic<float> ceiling_ { 1.0f };
+  double releaseCoefficient_ { 0 };
+
+  /** The last lookaheadFrames frames, interleaved; delayPosition_ is the
+   * oldest one.
+   */
+  std::vector<float> delay_;
+  uint32_t delayPosition_ { 0 };
+
+  /** Gains the frames in the lookahead window need, as an increasing
+   * sequence whose front is the minimum (sliding-window minimum).
+   */
+  struct Minimum {
+    uint64_t frame;
+    float gain;
+  };
+  std::array<Minimum, lookaheadFrames + 1> minima_;
+  uint32_t minimumFront_ { 0 };
+  uint32_t minimumCount_ { 0 };
+
+  /** The minimum of the window, with the release applied. In double
+   * precision, as the steps of a long release are too small for a float
+   * close to 1.
+   */
+  double smoothedGain_ { 1.0 };
+
+  /** The last lookaheadFrames smoothed gains, averaged into a ramp. */
+  std::array<double, lookaheadFrames> box_;
+  double boxSum_ { 0 };
+
+  uint64_t frameIndex_ { 0 };
+};
+
+#endif /* Limiter_h */
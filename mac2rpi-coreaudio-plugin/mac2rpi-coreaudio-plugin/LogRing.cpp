@@ -0,0 +1,48 @@
+#include "LogRing.h"
+
+constexpr size_t LogRing::capacity;
+
+LogRing::LogRing() {
+  for (size_t i = 0; i < capacity; i++)
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+bool LogRing::Push(const LogRecord& record) noexcept {
+  auto position = head_.load(std::memory_order_relaxed);
+  Slot* slot;
+
+  for (;;) {
+    slot = &slots_[position & (capacity - 1)];
+    auto sequence = slot->sequence.load(std::memory_order_acquire);
+    auto diff = static_cast<ptrdiff_t>(sequence - position);
+
+    if (diff == 0) {
+      // The slot is free: claim it by moving the head past it.
+      if (head_.compare_exchange_weak(position, position + 1,
+                                      std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      // The consumer has not released the slot yet: the ring is full.
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      // Another producer claimed the slot first.
+      position = head_.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->record = record;
+  slot->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+bool LogRing::Pop(LogRecord& record) noexcept {
+  auto& slot = slots_[tail_ & (capacity - 1)];
+  if (slot.sequence.load(std::memory_order_acquire) != tail_ + 1)
+    return false;
+
+  record = slot.record;
+  slot.sequence.store(tail_ + capacity, std::memory_order_release);
+  tail_++;
+  return true;
+}
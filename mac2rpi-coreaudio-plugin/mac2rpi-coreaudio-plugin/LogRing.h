@@ -0,0 +1,77 @@
+#ifndef LogRing_h
+#define LogRing_h
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+#include <MacTypes.h>
+
+/** Messages that can be logged from the real-time IO thread.
+ *
+ * The text of every message lives in a table in log.cpp; only the ID and the
+ * raw arguments go through the ring.
+ */
+enum class LogMessageID : UInt16 {
+  DoIOOperation,
+  WriteOutputData,
+  SendFailed,
+  StreamSuspended,
+  StreamResumed,
+};
+
+/** A log record as stored in the ring. */
+struct LogRecord {
+  LogMessageID id;
+  UInt64 args[2];
+};
+
+/** Fixed-size lock-free queue of log records.
+ *
+ * Any number of threads may push records; a single thread pops them. Pushing
+ * never blocks nor allocates: when the ring is full the record is dropped and
+ * counted, so that a slow consumer cannot stall the IO thread.
+ */
+class LogRing {
+public:
+  /** Number of records the ring can hold (must be a power of two). */
+  static constexpr size_t capacity { 1024 };
+
+  LogRing();
+
+  LogRing(const LogRing&) = delete;
+  LogRing& operator=(const LogRing&) = delete;
+
+  /** Appends a record to the ring.
+   *
+   * @return false if the ring was full and the record was dropped.
+   */
+  bool Push(const LogRecord& record) noexcept;
+
+  /** Removes the oldest record from the ring. Must only be called from the
+   * consumer thread.
+   *
+   * @return false if the ring was empty.
+   */
+  bool Pop(LogRecord& record) noexcept;
+
+  /** Returns and resets the number of records dropped since the last call. */
+  UInt64 TakeDroppedCount() noexcept { return dropped_.exchange(0); }
+
+private:
+  static_assert((capacity & (capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+  struct Slot {
+    /** Tells producers and consumer whose turn it is to use the slot. */
+    std::atomic<size_t> sequence;
+    LogRecord record;
+  };
+
+  std::array<Slot, capacity> slots_;
+  std::atomic<size_t> head_ { 0 };
+  size_t tail_ { 0 };
+  std::atomic<UInt64> dropped_ { 0 };
+};
+
+#endif /* LogRing_h */
@@ -0,0 +1,86 @@
+#include "Metrics.h"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <mach/mach_time.h>
+
+#include "log.h"
+
+Metrics& Metrics::GetInstance() {
+  // Never destroyed: devices release their slot when the plug-in instance
+  // goes away, which is after function-local statics are destroyed.
+  static auto metrics = new Metrics;
+  return *metrics;
+}
+
+Metrics::Metrics() {
+  auto fd = shm_open(kMetricsSegmentName, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    LOG(Control, Warning,
+        boost::format("Cannot open shared memory %1%, metrics disabled")
+        % kMetricsSegmentName);
+    return;
+  }
+
+  void* mapping = MAP_FAILED;
+  if (ftruncate(fd, sizeof(MetricsSegment)) == 0)
+    mapping = mmap(nullptr, sizeof(MetricsSegment), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    LOG(Control, Warning,
+        boost::format("Cannot map shared memory %1%, metrics disabled")
+        % kMetricsSegmentName);
+    return;
+  }
+
+  mach_timebase_info_data_t timebase;
+  mach_timebase_info(&timebase);
+
+  segment_ = static_cast<MetricsSegment*>(mapping);
+  std::memset(segment_, 0, sizeof(MetricsSegment));
+  segment_->timebaseNumer = timebase.numer;
+  segment_->timebaseDenom = timebase.denom;
+  segment_->version = kMetricsVersion;
+  __atomic_store_n(&segment_->magic, kMetricsMagic, __ATOMIC_RELEASE);
+}
+
+DeviceMetrics& Metrics::Acquire(UInt32 deviceID) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (segment_ != nullptr) {
+    for (auto& metrics : segment_->devices) {
+      if (__atomic_load_n(&metrics.inUse, __ATOMIC_RELAXED) != 0)
+        continue;
+
+      std::memset(&metrics, 0, sizeof(metrics));
+      metrics.deviceID = deviceID;
+      __atomic_store_n(&metrics.inUse, 1, __ATOMIC_RELEASE);
+      return metrics;
+    }
+  }
+
+  LOG(Control, Warning,
+      boost::format("No metrics slot left for device %1%") % deviceID);
+  return spare_;
+}
+
+void Metrics::Release(DeviceMetrics& metrics) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  __atomic_store_n(&metrics.inUse, 0, __ATOMIC_RELEASE);
+}
+
+void Metrics::Record(MetricsHistogram& histogram, uint64_t value) noexcept {
+  Add(histogram.count);
+  Add(histogram.sum, value);
+  Add(histogram.buckets[HistogramBucket(value)]);
+
+  // Only the IO thread of the device records into a histogram.
+  if (value > __atomic_load_n(&histogram.max, __ATOMIC_RELAXED))
+    __atomic_store_n(&histogram.max, value, __ATOMIC_RELAXED);
+}
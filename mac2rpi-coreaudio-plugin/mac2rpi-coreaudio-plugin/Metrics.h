@@ -0,0 +1,56 @@
+#ifndef Metrics_h
+#define Metrics_h
+
+#include <mutex>
+
+#include <MacTypes.h>
+
+#include "MetricsFormat.h"
+
+/** Publishes the runtime metrics of the devices into shared memory.
+ *
+ * Every device owns one DeviceMetrics slot of the segment and updates it
+ * with relaxed atomic operations, so that tools/metrics-reader can watch it
+ * without any locking nor any call into coreaudiod.
+ */
+class Metrics {
+public:
+  /** Returns the only instance of this class. */
+  static Metrics& GetInstance();
+
+  Metrics(const Metrics&) = delete;
+  Metrics& operator=(const Metrics&) = delete;
+
+  /** Takes a slot for a device and clears it. If the segment could not be
+   * created or is full, a private slot is returned instead, so that callers
+   * never have to check.
+   */
+  DeviceMetrics& Acquire(UInt32 deviceID);
+
+  /** Gives back a slot taken with Acquire(). */
+  void Release(DeviceMetrics& metrics);
+
+  /** Adds to a counter. */
+  static void Add(uint64_t& counter, uint64_t value = 1) noexcept {
+    __atomic_fetch_add(&counter, value, __ATOMIC_RELAXED);
+  }
+
+  /** Sets a value that is overwritten rather than accumulated. */
+  static void Set(float& gauge, float value) noexcept {
+    __atomic_store(&gauge, &value, __ATOMIC_RELAXED);
+  }
+
+  /** Adds a duration, in host ticks, to a histogram. */
+  static void Record(MetricsHistogram& histogram, uint64_t value) noexcept;
+
+private:
+  Metrics();
+
+  MetricsSegment* segment_ { nullptr };
+  std::mutex mutex_;
+
+  /** Handed out when no shared slot is available. */
+  DeviceMetrics spare_ {};
+};
+
+#endif /* Metrics_h */
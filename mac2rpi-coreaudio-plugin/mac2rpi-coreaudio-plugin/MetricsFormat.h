@@ -0,0 +1,168 @@
+#ifndef MetricsFormat_h
+#define MetricsFormat_h
+
+#include <cstdint>
+
+/* Layout of the shared-memory segment the plug-in publishes its metrics
+ * into. Shared with tools/metrics-reader, which is also built on Linux, so
+ * only standard types are used here.
+ */
+
+/** Name of the shared-memory segment. */
+constexpr const char* kMetricsSegmentName { "/mac2rpi.metrics" };
+
+/** Identifies the metrics segment ("m2rm"). */
+constexpr uint32_t kMetricsMagic { 0x6d32726d };
+
+/** Version of the segment layout. */
+constexpr uint32_t kMetricsVersion { 6 };
+
+/** Maximum number of devices with metrics. */
+constexpr uint32_t kMetricsMaxDevices { 16 };
+
+/** Maximum number of channels with levels. */
+constexpr uint32_t kMetricsMaxChannels { 8 };
+
+/** Values below this go to a bucket of their own. */
+constexpr uint32_t kHistogramLinearBuckets { 16 };
+
+/** Number of buckets every power of two above kHistogramLinearBuckets is
+ * split into (relative error of 1 / kHistogramSubBuckets).
+ */
+constexpr uint32_t kHistogramSubBucketBits { 3 };
+constexpr uint32_t kHistogramSubBuckets { 1 << kHistogramSubBucketBits };
+
+/** Highest power of two covered; larger values go to the last bucket. */
+constexpr uint32_t kHistogramMaxExponent { 40 };
+
+constexpr uint32_t kHistogramBuckets {
+  kHistogramLinearBuckets + (kHistogramMaxExponent - 4) * kHistogramSubBuckets
+};
+
+/** Returns the bucket a value is counted in. */
+inline uint32_t HistogramBucket(uint64_t value) {
+  if (value < kHistogramLinearBuckets)
+    return static_cast<uint32_t>(value);
+
+  uint32_t exponent = 63 - __builtin_clzll(value);
+  if (exponent >= kHistogramMaxExponent)
+    return kHistogramBuckets - 1;
+
+  auto subBucket = static_cast<uint32_t>(
+      (value >> (exponent - kHistogramSubBucketBits)) & (kHistogramSubBuckets - 1));
+  return kHistogramLinearBuckets + (exponent - 4) * kHistogramSubBuckets + subBucket;
+}
+
+/** Returns the smallest value counted in a bucket. */
+inline uint64_t HistogramBucketLowerBound(uint32_t bucket) {
+  if (bucket < kHistogramLinearBuckets)
+    return bucket;
+
+  auto exponent = (bucket - kHistogramLinearBuckets) / kHistogramSubBuckets + 4;
+  auto subBucket = (bucket - kHistogramLinearBuckets) % kHistogramSubBuckets;
+  return (uint64_t{1} << exponent)
+      + (uint64_t{subBucket} << (exponent - kHistogramSubBucketBits));
+}
+
+/** Distribution of durations, in host ticks, with a bounded relative error
+ * (HDR-style log-linear buckets).
+ */
+struct MetricsHistogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[kHistogramBuckets];
+};
+
+/** Counters and histograms of a device. */
+struct DeviceMetrics {
+  /** Object ID of the device. */
+  uint32_t deviceID;
+
+  /** Non-zero while the slot belongs to a device. */
+  uint32_t inUse;
+
+  /** Output IO cycles. */
+  uint64_t ioCycles;
+
+  /** Datagrams and bytes (headers included) sent to the receiver. */
+  uint64_t packetsSent;
+  uint64_t bytesSent;
+
+  /** Datagrams that could not be sent because of an error (other than a
+   * full socket buffer).
+   */
+  uint64_t sendErrors;
+
+  /** Datagrams that could not be sent because the socket buffer was full. */
+  uint64_t sendWouldBlock;
+
+  /** Datagrams dropped by the overload policy. */
+  uint64_t packetsDropped;
+
+  /** IO cycles sent in a degraded format by the overload policy. */
+  uint64_t degradedCycles;
+
+  /** IO cycles whose sample time did not follow the previous one, i.e. the
+   * host skipped over part of the ring buffer.
+   */
+  uint64_t ringOverruns;
+
+  /** Output IO cycles containing only silence. */
+  uint64_t silenceCycles;
+
+  /** Times the clock was re-anchored (IO start and format changes). */
+  uint64_t timeStampReanchors;
+
+  /** Times the socket was rebuilt after failures or network changes. */
+  uint64_t socketRebuilds;
+
+  /** Times the output was suspended for silence or an inactive stream, and
+   * IO cycles during which nothing was sent because of it.
+   */
+  uint64_t suspensions;
+  uint64_t suspendedCycles;
+
+  /** Output samples that were not finite or far out of range, and were
+   * replaced (see SanitizeSamples()).
+   */
+  uint64_t sanitizedSamples;
+
+  /** IO cycles during which the limiter reduced the gain. */
+  uint64_t limitedCycles;
+
+  /** Number of channels of the device, i.e. of levels below. */
+  uint32_t channels;
+  uint32_t reserved;
+
+  /** Peak and RMS of every channel over the last IO cycle, in full scale
+   * (1 for 0 dBFS).
+   */
+  float peakLevels[kMetricsMaxChannels];
+  float rmsLevels[kMetricsMaxChannels];
+
+  /** Time spent in DoIOOperation. */
+  MetricsHistogram ioOperationDuration;
+
+  /** Time spent sending a datagram. */
+  MetricsHistogram sendDuration;
+
+  /** Time from the start of the first IO cycle with audio after a
+   * suspension to the end of its send, pre-roll included.
+   */
+  MetricsHistogram resumeDuration;
+};
+
+/** The whole shared-memory segment. */
+struct MetricsSegment {
+  uint32_t magic;
+  uint32_t version;
+
+  /** Converts host ticks to nanoseconds: ns = ticks * numer / denom. */
+  uint32_t timebaseNumer;
+  uint32_t timebaseDenom;
+
+  DeviceMetrics devices[kMetricsMaxDevices];
+};
+
+#endif /* MetricsFormat_h */
@@ -0,0 +1,115 @@
+#ifndef Packet_h
+#define Packet_h
+
+#include <cstdint>
+
+/* Wire protocol. Shared with the receiver in tools/, which is built on
+ * Linux, so only standard types are used here.
+ */
+
+/** Identifies a datagram as belonging to the mac2rpi protocol ("m2rp"). */
+constexpr uint32_t kPacketMagic { 0x6d327270 };
+
+/** Version of the wire protocol. Receivers drop datagrams of any other
+ * version.
+ *
+ * 2: integer sample formats, probe, start and end packets, and sample
+ *    times offset by the pre-roll.
+ */
+constexpr uint8_t kPacketVersion { 2 };
+
+/** Kind of datagram sent to the receiver. */
+enum class PacketType : uint8_t {
+  /** Audio frames follow the header. */
+  Audio = 0,
+
+  /** No payload. Announces the format that subsequent audio packets will
+   * use, so that the receiver can reconfigure itself before they arrive.
+   */
+  Format = 1,
+
+  /** A ProbePayload follows the header. Sent after the audio packets of an
+   * IO cycle when latency probes are enabled; the frame count and sample
+   * time are those of the cycle.
+   */
+  Probe = 2,
+
+  /** No payload. Sent when the device starts, before any audio: a new
+   * stream begins at the sample time of the header with frameCount frames
+   * of silence (the pre-roll), so the receiver can fill its buffer at once
+   * instead of waiting for it to refill.
+   */
+  Start = 3,
+
+  /** No payload. Sent when the device stops: the stream ends at the sample
+   * time of the header. The receiver plays out what it has, fading out the
+   * last frameCount frames, instead of waiting for more. The sender does not
+   * fade them: they were sent before it knew the stream would end, so the
+   * receiver must apply the fade itself.
+   */
+  End = 4,
+};
+
+/** Encoding of the samples carried in an audio packet. */
+enum class SampleFormat : uint8_t {
+  Float32 = 0,
+  /** Packed 24-bit signed integers (3 bytes per sample). */
+  Int24 = 1,
+  Int16 = 2,
+  Int32 = 3,
+};
+
+/** Returns the number of bytes used by a sample in the given format. */
+constexpr unsigned BytesPerSample(SampleFormat format) {
+  return format == SampleFormat::Int24 ? 3
+      : format == SampleFormat::Int16 ? 2
+      : 4;
+}
+
+/** Header preceding every datagram sent to the receiver.
+ *
+ * All the fields are little-endian (both the Mac and the Raspberry Pi are
+ * little-endian machines, so the header is sent as is).
+ */
+struct PacketHeader {
+  uint32_t magic;
+  uint8_t version;
+  PacketType type;
+  SampleFormat format;
+  uint8_t channels;
+  uint32_t sampleRate;
+
+  /** Incremented for every datagram; lets the receiver detect losses. */
+  uint32_t sequenceNumber;
+
+  /** Number of frames in the payload. */
+  uint32_t frameCount;
+  uint32_t reserved;
+
+  /** Sample time of the first frame in the payload. */
+  uint64_t sampleTime;
+};
+
+static_assert(sizeof(PacketHeader) == 32, "Unexpected packet header size");
+
+/** When an IO cycle went through the stages of the plug-in, in nanoseconds
+ * of the wall clock of the sender (CLOCK_REALTIME), so that a receiver with
+ * a synchronized clock can measure the latency up to its own output.
+ */
+struct ProbePayload {
+  /** When the HAL started the IO cycle. */
+  uint64_t cycleStartTime;
+
+  /** When the mixed output reached the plug-in. */
+  uint64_t writeStartTime;
+
+  /** When the last audio packet of the cycle was handed to the socket. */
+  uint64_t sendEndTime;
+
+  /** When the HAL expects the first frame of the cycle to be played. */
+  uint64_t outputTime;
+};
+
+static_assert(sizeof(ProbePayload) == 32, "Unexpected probe payload size");
+
+#endif /* Packet_h */
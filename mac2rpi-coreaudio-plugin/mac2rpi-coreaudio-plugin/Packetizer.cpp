@@ -0,0 +1,32 @@
+#include "Packetizer.h"
+
+constexpr unsigned Packetizer::maxDatagramSize;
+constexpr unsigned Packetizer::maxPayloadSize;
+
+void Packetizer::SetFormat(Float64 sampleRate,
+                           UInt8 channels,
+                           SampleFormat inputFormat,
+                           SampleFormat wireFormat) {
+  sampleRate_ = static_cast<UInt32>(sampleRate);
+  channels_ = channels;
+  inputFormat_ = inputFormat;
+  format_ = wireFormat;
+  convert_ = GetSampleConverter(inputFormat, wireFormat);
+}
+
+PacketHeader Packetizer::MakeHeader(PacketType type,
+                                    UInt32 frameCount,
+                                    Float64 sampleTime) {
+  PacketHeader header;
+  header.magic = kPacketMagic;
+  header.version = kPacketVersion;
+  header.type = type;
+  header.format = format_;
+  header.channels = channels_;
+  header.sampleRate = sampleRate_;
+  header.sequenceNumber = sequenceNumber_++;
+  header.frameCount = frameCount;
+  header.reserved = 0;
+  header.sampleTime = static_cast<UInt64>(sampleTime);
+  return header;
+}
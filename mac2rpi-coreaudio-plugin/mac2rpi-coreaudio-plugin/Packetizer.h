@@ -0,0 +1,128 @@
+#ifndef Packetizer_h
+#define Packetizer_h
+
+#include <algorithm>
+#include <array>
+
+#include <boost/asio/buffer.hpp>
+#include <MacTypes.h>
+
+#include "Packet.h"
+#include "SampleConversion.h"
+
+/** Splits the audio frames of an IO cycle into datagrams.
+ *
+ * Every datagram is kept below the size of an Ethernet frame, so that high
+ * sample rates or large IO buffers do not end up in fragmented IP packets.
+ * Samples are converted to the wire format on the fly when it differs from
+ * the format of the IO buffer; otherwise they are sent straight from it.
+ *
+ * Packetize() never allocates: the header lives on the stack and converted
+ * samples go to a scratch buffer sized for the largest datagram, whatever
+ * the size of the IO buffer.
+ */
+class Packetizer {
+public:
+  /** Maximum size of a datagram (Ethernet MTU - IPv6 header - UDP header).
+   * A link may be IPv4 or IPv6; the IPv6 header is the larger one, so the
+   * same size fits in a frame of either.
+   */
+  static constexpr unsigned maxDatagramSize { 1452 };
+
+  /** Maximum size of the payload of a datagram. */
+  static constexpr unsigned maxPayloadSize
+      { maxDatagramSize - sizeof(PacketHeader) };
+
+  /** Sets the format of the packets that will be produced.
+   *
+   * @param sampleRate The sample rate of the stream.
+   * @param channels The number of interleaved channels.
+   * @param inputFormat The encoding of the samples in the IO buffer.
+   * @param wireFormat The encoding of the samples on the wire.
+   */
+  void SetFormat(Float64 sampleRate,
+                 UInt8 channels,
+                 SampleFormat inputFormat,
+                 SampleFormat wireFormat);
+
+  /** Returns the encoding of the samples on the wire. */
+  SampleFormat Format() const { return format_; }
+
+  /** Returns the number of frames that fit in a single datagram. */
+  UInt32 FramesPerPacket() const {
+    return maxPayloadSize / (channels_ * BytesPerSample(format_));
+  }
+
+  /** Builds the header for the next packet.
+   *
+   * @param type The kind of packet.
+   * @param frameCount The number of frames in the payload.
+   * @param sampleTime The sample time of the first frame in the payload.
+   */
+  PacketHeader MakeHeader(PacketType type,
+                          UInt32 frameCount,
+                          Float64 sampleTime);
+
+  /** Splits a buffer of frames into audio packets.
+   *
+   * @param frames The interleaved frames, in the input format.
+   * @param frameCount The number of frames in \p frames.
+   * @param sampleTime The sample time of the first frame.
+   * @param send Callable invoked with the buffer sequence (header + payload)
+   *        of every packet.
+   */
+  template<typename SendFunction>
+  void Packetize(const void* frames,
+                 UInt32 frameCount,
+                 Float64 sampleTime,
+                 SendFunction send);
+
+private:
+  UInt32 sampleRate_ { 44100 };
+  UInt8 channels_ { 2 };
+  SampleFormat inputFormat_ { SampleFormat::Float32 };
+  SampleFormat format_ { SampleFormat::Float32 };
+
+  /** Converts from the input format to the wire format; nullptr when both
+   * formats are the same.
+   */
+  SampleConverter convert_ { nullptr };
+  UInt32 sequenceNumber_ { 0 };
+
+  /** Holds the payload of a packet when samples need to be converted. */
+  std::array<UInt8, maxPayloadSize> scratch_;
+};
+
+template<typename SendFunction>
+void Packetizer::Packetize(const void* frames,
+                           UInt32 frameCount,
+                           Float64 sampleTime,
+                           SendFunction send) {
+  const auto framesPerPacket = FramesPerPacket();
+  const auto bytesPerFrame = channels_ * BytesPerSample(format_);
+  const auto bytesPerInputFrame = channels_ * BytesPerSample(inputFormat_);
+  auto input = static_cast<const UInt8*>(frames);
+
+  while (frameCount > 0) {
+    auto count = std::min(frameCount, framesPerPacket);
+    auto header = MakeHeader(PacketType::Audio, count, sampleTime);
+
+    const void* payload = input;
+    if (convert_ != nullptr) {
+      convert_(input, scratch_.data(), count * channels_);
+      payload = scratch_.data();
+    }
+
+    std::array<boost::asio::const_buffer, 2> buffers = {{
+      boost::asio::buffer(&header, sizeof(header)),
+      boost::asio::buffer(payload, count * bytesPerFrame)
+    }};
+    send(buffers);
+
+    input += count * bytesPerInputFrame;
+    frameCount -= count;
+    sampleTime += count;
+  }
+}
+
+#endif /* Packetizer_h */
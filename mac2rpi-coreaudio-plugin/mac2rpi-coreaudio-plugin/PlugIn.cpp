@@ -1,10 +1,31 @@
 #include "PlugIn.h"
 
+#include <algorithm>
+
+#include "CaptureWriter.h"
 #include "Device.h"
 #include "log.h"
 #include "OSException.h"
+#include "SettingsWatcher.h"
 #include "types.h"
 
+namespace {
+
+/** Formats a list of destinations for the log. */
+std::string DestinationsToString(const std::vector<Destination>& destinations) {
+  std::string result;
+  for (const auto& destination : destinations) {
+    if (!result.empty())
+      result += ",";
+    result += (boost::format("%1%:%2%")
+               % destination.address
+               % destination.port).str();
+  }
+  return result;
+}
+
+}
+
 std::shared_ptr<PlugIn> PlugIn::instance_;
 
 PlugIn& PlugIn::GetInstance() {
@@ -16,6 +37,9 @@ PlugIn& PlugIn::GetInstance() {
 void PlugIn::CreateInstance() {
   instance_ = std::make_shared<PlugIn>(PreventDirectConstruction{0});
   AudioObjectMap::AddObject(kObjectID_PlugIn, instance_);
+  SettingsWatcher::GetInstance().Start([](const Settings&, const Settings& current) {
+    instance_->ApplySettings(current);
+  });
     // TODO activate ???
 }
 
@@ -24,15 +48,158 @@ PlugIn::PlugIn(const PreventDirectConstruction&)
                 kAudioPlugInClassID,
                 kAudioObjectClassID,
                 0)
-  , device_(std::make_shared<Device>())
 {
-  AudioObjectMap::AddObject(kObjectID_Device, device_);
+  const auto& settings = SettingsWatcher::GetInstance().Current();
+  CaptureWriter::GetInstance().SetFile(settings.captureFile);
+  for (const auto& configuration : settings.devices) {
+    try {
+      AddDeviceLocked(configuration);
+    } catch (const std::exception& e) {
+      // The other devices are still usable.
+      LOG(Control, Error,
+          boost::format("Cannot add device %1%: %2%") % configuration.uid % e.what());
+    }
+  }
+}
+
+AudioObjectID PlugIn::AddDevice(const DeviceConfiguration& configuration) {
+  AudioObjectID deviceObjectID;
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex_);
+    deviceObjectID = AddDeviceLocked(configuration);
+  }
+  NotifyDeviceListChanged();
+  return deviceObjectID;
+}
+
+void PlugIn::RemoveDevice(AudioObjectID deviceObjectID) {
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex_);
+    RemoveDeviceLocked(deviceObjectID);
+  }
+  NotifyDeviceListChanged();
+}
+
+void PlugIn::SetDeviceConfigurations(const std::vector<DeviceConfiguration>& configurations) {
+  bool changed = false;
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex_);
+    
+    // Remove the devices that are gone or whose settings changed, except
+    // for the destinations, which are changed in place.
+    std::vector<AudioObjectID> staleDevices;
+    for (const auto& device : devices_) {
+      auto it = std::find_if(begin(configurations),
+                             end(configurations),
+                             [&device](const DeviceConfiguration& configuration) {
+        return IsSameDevice(device->Configuration(), configuration);
+      });
+      if (it == end(configurations)) {
+        staleDevices.push_back(device->ObjectID());
+      } else if (it->destinations != device->Configuration().destinations) {
+        LOG(Control, Info,
+            boost::format("Changing destinations: uid=%1% destinations=%2%")
+            % it->uid
+            % DestinationsToString(it->destinations));
+        try {
+          device->SetDestinations(it->destinations);
+        } catch (const std::exception& e) {
+          // Keep the device running with its old destinations.
+          LOG(Control, Error,
+              boost::format("Cannot change destinations: %1%") % e.what());
+        }
+      }
+    }
+    for (auto deviceObjectID : staleDevices)
+      RemoveDeviceLocked(deviceObjectID);
+    
+    // Add the devices that are new or whose settings changed.
+    for (const auto& configuration : configurations) {
+      auto it = std::find_if(begin(devices_),
+                             end(devices_),
+                             [&configuration](const std::shared_ptr<Device>& device) {
+        return IsSameDevice(device->Configuration(), configuration);
+      });
+      if (it == end(devices_)) {
+        try {
+          AddDeviceLocked(configuration);
+          changed = true;
+        } catch (const std::exception& e) {
+          LOG(Control, Error,
+              boost::format("Cannot add device %1%: %2%") % configuration.uid % e.what());
+        }
+      }
+    }
+    
+    changed = changed || !staleDevices.empty();
+  }
+  
+  if (changed)
+    NotifyDeviceListChanged();
+}
+
+void PlugIn::ApplySettings(const Settings& settings) {
+  CaptureWriter::GetInstance().SetFile(settings.captureFile);
+  SetDeviceConfigurations(settings.devices);
+  
+  std::lock_guard<std::mutex> lock(devicesMutex_);
+  for (const auto& device : devices_)
+    device->ApplySettings(settings);
+}
+
+AudioObjectID PlugIn::AddDeviceLocked(const DeviceConfiguration& configuration) {
+  LOG(Control, Info, boost::format("Adding device: uid=%1% destinations=%2%")
+      % configuration.uid
+      % DestinationsToString(configuration.destinations));
+  
+  auto objectID = AudioObjectMap::AllocateObjectIDs(kObjectIDCount_Device);
+  auto device = std::make_shared<Device>(objectID, configuration, ioService_);
+  AudioObjectMap::AddObject(device->ObjectID(), device);
+  devices_.push_back(device);
+  return device->ObjectID();
+}
+
+void PlugIn::RemoveDeviceLocked(AudioObjectID deviceObjectID) {
+  auto it = std::find_if(begin(devices_),
+                         end(devices_),
+                         [deviceObjectID](const std::shared_ptr<Device>& device) {
+    return device->ObjectID() == deviceObjectID;
+  });
+  if (it == end(devices_))
+    throw OSException("invalid device ID", kAudioHardwareBadDeviceError);
+  
+  LOG(Control, Info,
+      boost::format("Removing device: uid=%1%") % (*it)->Configuration().uid);
+  
+  // Calls already in progress keep the device alive until they finish, and
+  // so does running IO, until StopIO() (see RunningDevices).
+  (*it)->UnregisterSubObjects();
+  AudioObjectMap::RemoveObject(deviceObjectID);
+  devices_.erase(it);
+}
+
+void PlugIn::NotifyDeviceListChanged() {
+  if (host_ == nullptr)
+    return;
+  
+  std::array<AudioObjectPropertyAddress, 2> changedProperties = {{
+    { kAudioPlugInPropertyDeviceList,
+      kAudioObjectPropertyScopeGlobal,
+      kAudioObjectPropertyElementMaster },
+    { kAudioObjectPropertyOwnedObjects,
+      kAudioObjectPropertyScopeGlobal,
+      kAudioObjectPropertyElementMaster },
+  }};
+  host_->PropertiesChanged(host_,
+                           kObjectID_PlugIn,
+                           changedProperties.size(),
+                           changedProperties.data());
 }
 
 Boolean PlugIn::HasProperty(pid_t clientProcessID,
                             const AudioObjectPropertyAddress& address) const {
   
-  LOG(boost::format("PluginHasProperty: selector=%1%")
+  LOG(Property, Trace, boost::format("PluginHasProperty: selector=%1%")
       % PluginPropertyToString(address.mSelector));
   
   switch (address.mSelector) {
@@ -67,8 +234,12 @@ UInt32 PlugIn::GetPropertyDataSize(pid_t clientProcessID,
     case kAudioObjectPropertyManufacturer:
       return sizeof(CFStringRef);
       
+    case kAudioObjectPropertyOwnedObjects:
     case kAudioPlugInPropertyDeviceList:
-      return sizeof(AudioObjectID);
+    {
+      std::lock_guard<std::mutex> lock(devicesMutex_);
+      return devices_.size() * sizeof(AudioObjectID);
+    }
       
     case kAudioPlugInPropertyTranslateUIDToDevice:
       return sizeof(AudioObjectID);
@@ -90,7 +261,7 @@ UInt32 PlugIn::GetPropertyData(pid_t clientProcessID,
                                UInt32 dataSize,
                                void* data) const {
   
-  LOG(boost::format("PluginGetPropertyData: selector=%1%")
+  LOG(Property, Trace, boost::format("PluginGetPropertyData: selector=%1%")
       % PluginPropertyToString(address.mSelector));
 
   switch (address.mSelector) {
@@ -98,23 +269,37 @@ UInt32 PlugIn::GetPropertyData(pid_t clientProcessID,
       return GetPropertyDataImpl<CFStringRef>
           (dataSize, CFSTR("mac2rpi"), data);
       
+    case kAudioObjectPropertyOwnedObjects:
     case kAudioPlugInPropertyDeviceList:
-      return GetPropertyDataImpl<AudioObjectID>
-          (dataSize, device_->ObjectID(), data);
+    {
+      std::lock_guard<std::mutex> lock(devicesMutex_);
+      UInt32 itemCount = dataSize / sizeof(AudioObjectID);
+      itemCount = std::min<UInt32>(itemCount, devices_.size());
+      auto objData = static_cast<AudioObjectID*>(data);
+      for (unsigned i = 0; i < itemCount; i++)
+        objData[i] = devices_[i]->ObjectID();
+      return itemCount * sizeof(AudioObjectID);
+    }
       
     case kAudioPlugInPropertyTranslateUIDToDevice:
+    {
       CheckOutDataSize(dataSize, sizeof(AudioObjectID));
       CheckInDataSize(qualifierDataSize, sizeof(CFStringRef));
       if (qualifierData == nullptr)
         throw OSException("no qualifier data",
                           kAudioHardwareBadPropertySizeError);
+      auto uid = *(static_cast<const CFStringRef*>(qualifierData));
+      
+      std::lock_guard<std::mutex> lock(devicesMutex_);
+      auto it = std::find_if(begin(devices_),
+                             end(devices_),
+                             [uid](const std::shared_ptr<Device>& device) {
+        return CFStringCompare(uid, device->UID(), 0) == kCFCompareEqualTo;
+      });
       *(static_cast<AudioObjectID*>(data)) =
-          CFStringCompare(*(static_cast<const CFStringRef*>(qualifierData)),
-                          CFSTR("mac2rpi-device"),
-                          0)
-              ? kObjectID_Device
-              : kAudioObjectUnknown;
+          (it != end(devices_)) ? (*it)->ObjectID() : kAudioObjectUnknown;
       return sizeof(AudioObjectID);
+    }
       
     case kAudioPlugInPropertyResourceBundle:
       return GetPropertyDataImpl<CFStringRef>
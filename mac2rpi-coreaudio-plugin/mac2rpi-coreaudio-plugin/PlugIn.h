@@ -3,8 +3,13 @@
 
 #include <memory>
 #include <mutex>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
 
 #include "AudioObject.h"
+#include "DeviceConfiguration.h"
+#include "Settings.h"
 
 class Device;
 
@@ -52,16 +57,68 @@ public:
    * @param host The host reference.
    */
   void SetHost(AudioServerPlugInHostRef host) { host_ = host; }
+  
+  /** Returns the audio server plug-in host reference. */
+  AudioServerPlugInHostRef Host() const { return host_; }
+  
+  /** Creates a new device.
+   *
+   * @param configuration The settings of the device.
+   * @return The object ID of the new device.
+   */
+  AudioObjectID AddDevice(const DeviceConfiguration& configuration);
+  
+  /** Destroys a device.
+   *
+   * @param deviceObjectID The object ID of the device.
+   * @note An exception is thrown if the device does not exist.
+   */
+  void RemoveDevice(AudioObjectID deviceObjectID);
+  
+  /** Makes the list of devices match the given configuration.
+   *
+   * Devices are matched by UID. Devices whose settings did not change are
+   * kept as they are, and so are devices whose destinations alone changed
+   * (they switch to the new ones without interrupting IO); the rest are
+   * destroyed and created again.
+   *
+   * @param configurations The settings of every device.
+   */
+  void SetDeviceConfigurations(const std::vector<DeviceConfiguration>& configurations);
+  
+  /** Applies new settings: updates the capture file and the list of
+   * devices, and asks the host for a configuration change on the devices
+   * whose settings cannot change while IO is running.
+   *
+   * @param settings The new settings.
+   */
+  void ApplySettings(const Settings& settings);
 
 private:
+  /** Tells the host that the list of devices has changed. */
+  void NotifyDeviceListChanged();
+  
+  /** Creates a device without notifying the host. Requires devicesMutex_. */
+  AudioObjectID AddDeviceLocked(const DeviceConfiguration& configuration);
+  
+  /** Destroys a device without notifying the host. Requires devicesMutex_. */
+  void RemoveDeviceLocked(AudioObjectID deviceObjectID);
+  
+
   /** The plug-in instance. */
   static std::shared_ptr<PlugIn> instance_;
   
-  /** The device instance. */
-  std::shared_ptr<Device> device_;
+  /** IO service shared by the sockets of all the devices. */
+  boost::asio::io_service ioService_;
+  
+  /** The device instances. */
+  std::vector<std::shared_ptr<Device>> devices_;
+  
+  /** Protects devices_. */
+  mutable std::mutex devicesMutex_;
   
   /** The reference to the audio server plug-in host. */
-  AudioServerPlugInHostRef host_;
+  AudioServerPlugInHostRef host_ { nullptr };
 };
 
 #endif /* Plugin_h */
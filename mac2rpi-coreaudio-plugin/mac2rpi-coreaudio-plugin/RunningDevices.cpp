@@ -0,0 +1,56 @@
+#include "RunningDevices.h"
+
+#include "Device.h"
+#include "OSException.h"
+
+constexpr unsigned RunningDevices::capacity;
+
+std::array<RunningDevices::Slot, RunningDevices::capacity> RunningDevices::slots_;
+
+std::array<std::shared_ptr<Device>, RunningDevices::capacity>
+    RunningDevices::references_;
+
+std::mutex RunningDevices::mutex_;
+
+void RunningDevices::Add(const std::shared_ptr<Device>& device) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Slot* freeSlot = nullptr;
+  for (auto& slot : slots_) {
+    if (slot.objectID == device->ObjectID())
+      return;
+    if (freeSlot == nullptr && slot.objectID == kAudioObjectUnknown)
+      freeSlot = &slot;
+  }
+  if (freeSlot == nullptr)
+    throw OSException("too many running devices",
+                      kAudioHardwareIllegalOperationError);
+  
+  references_[freeSlot - slots_.data()] = device;
+  freeSlot->device.store(device.get(), std::memory_order_relaxed);
+  freeSlot->objectID.store(device->ObjectID(), std::memory_order_release);
+}
+
+void RunningDevices::Remove(AudioObjectID deviceObjectID) {
+  std::shared_ptr<Device> reference;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& slot : slots_) {
+      if (slot.objectID != deviceObjectID)
+        continue;
+      slot.objectID.store(kAudioObjectUnknown, std::memory_order_relaxed);
+      slot.device.store(nullptr, std::memory_order_relaxed);
+      reference.swap(references_[&slot - slots_.data()]);
+      break;
+    }
+  }
+  // The device is destroyed here, out of the lock, if it was removed from
+  // the plug-in while running.
+}
+
+Device* RunningDevices::Find(AudioObjectID deviceObjectID) noexcept {
+  for (auto& slot : slots_) {
+    if (slot.objectID.load(std::memory_order_acquire) == deviceObjectID)
+      return slot.device.load(std::memory_order_relaxed);
+  }
+  return nullptr;
+}
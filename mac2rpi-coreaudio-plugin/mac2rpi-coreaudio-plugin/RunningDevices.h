@@ -0,0 +1,69 @@
+#ifndef RunningDevices_h
+#define RunningDevices_h
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include <CoreAudio/AudioServerPlugIn.h>
+
+class Device;
+
+/** The devices whose IO is running, for the IO callbacks of the host.
+ *
+ * Finding a device in AudioObjectMap takes a mutex and copies a shared_ptr,
+ * which the IO thread cannot afford. StartIO() resolves the device once and
+ * publishes it here, and the IO callbacks find it with atomic loads alone.
+ *
+ * The table holds a reference to every device it publishes until its IO
+ * stops, so a device removed while running is destroyed by StopIO() rather
+ * than on the IO thread.
+ */
+class RunningDevices {
+public:
+  /** Maximum number of devices running at once. */
+  static constexpr unsigned capacity { 64 };
+  
+  /** Publishes a device whose IO starts. Does nothing if it is published
+   * already.
+   *
+   * @param device The device.
+   * @note An exception is thrown if capacity devices are running already.
+   */
+  static void Add(const std::shared_ptr<Device>& device);
+  
+  /** Unpublishes a device whose IO stopped, and drops the reference to it,
+   * which may destroy it. Must not be called from the IO thread.
+   *
+   * @param deviceObjectID Object identifier of the device.
+   */
+  static void Remove(AudioObjectID deviceObjectID);
+  
+  /** Finds a running device, without locking or allocating.
+   *
+   * The host makes no IO call on a device outside of StartIO() and
+   * StopIO(), so the slot of the device cannot change during the call; the
+   * slots of other devices may, but their IDs never match.
+   *
+   * @param deviceObjectID Object identifier of the device.
+   * @return The device, or nullptr if its IO is not running.
+   */
+  static Device* Find(AudioObjectID deviceObjectID) noexcept;
+  
+private:
+  struct Slot {
+    std::atomic<AudioObjectID> objectID { kAudioObjectUnknown };
+    std::atomic<Device*> device { nullptr };
+  };
+  
+  static std::array<Slot, capacity> slots_;
+  
+  /** Keeps the published devices alive; protected by mutex_. */
+  static std::array<std::shared_ptr<Device>, capacity> references_;
+  
+  /** Serializes Add() and Remove(). */
+  static std::mutex mutex_;
+};
+
+#endif /* RunningDevices_h */
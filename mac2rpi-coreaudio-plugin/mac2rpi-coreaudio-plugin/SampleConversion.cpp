@@ -0,0 +1,211 @@
+#include "SampleConversion.h"
+
+#include <algorithm>
+
+namespace {
+
+/** Number of accumulators MeasureLevels() spreads float samples over. */
+constexpr uint32_t levelLanes { 8 };
+
+template<SampleFormat In>
+SampleConverter GetSampleConverterFrom(SampleFormat out) {
+  switch (out) {
+    case SampleFormat::Float32:
+      return ConvertSamples<In, SampleFormat::Float32>;
+    case SampleFormat::Int32:
+      return ConvertSamples<In, SampleFormat::Int32>;
+    case SampleFormat::Int24:
+      return ConvertSamples<In, SampleFormat::Int24>;
+    case SampleFormat::Int16:
+      return ConvertSamples<In, SampleFormat::Int16>;
+  }
+  return nullptr;
+}
+
+template<SampleFormat Format>
+void ApplyGainRampTo(void* samples,
+                     uint32_t channels,
+                     uint32_t frameCount,
+                     float gain,
+                     float step) {
+  auto p = static_cast<uint8_t*>(samples);
+  for (uint32_t frame = 0; frame < frameCount; frame++) {
+    const double frameGain = gain + step * frame;
+    for (uint32_t channel = 0; channel < channels; channel++) {
+      SampleTraits<Format>::Write(p, static_cast<int32_t>(
+          SampleTraits<Format>::Read(p) * frameGain));
+      p += BytesPerSample(Format);
+    }
+  }
+}
+
+/** Float samples are scaled directly, in a loop the compiler vectorizes. */
+template<>
+void ApplyGainRampTo<SampleFormat::Float32>(void* samples,
+                                            uint32_t channels,
+                                            uint32_t frameCount,
+                                            float gain,
+                                            float step) {
+  auto p = static_cast<float*>(samples);
+  for (uint32_t frame = 0; frame < frameCount; frame++) {
+    const float frameGain = gain + step * frame;
+    for (uint32_t channel = 0; channel < channels; channel++)
+      p[channel] *= frameGain;
+    p += channels;
+  }
+}
+
+template<SampleFormat Format>
+void MeasureLevelsOf(const void* samples,
+                     uint32_t channels,
+                     uint32_t frameCount,
+                     float* peaks,
+                     float* sumSquares) {
+  auto p = static_cast<const uint8_t*>(samples);
+  for (uint32_t frame = 0; frame < frameCount; frame++) {
+    for (uint32_t channel = 0; channel < channels; channel++) {
+      const float sample = SampleTraits<Format>::Read(p) / 2147483648.0f;
+      peaks[channel] = std::max(peaks[channel], std::fabs(sample));
+      sumSquares[channel] += sample * sample;
+      p += BytesPerSample(Format);
+    }
+  }
+}
+
+/** Float samples are spread over levelLanes independent accumulators, in a
+ * loop the compiler vectorizes. Every lane belongs to a single channel as
+ * long as the number of channels divides levelLanes; other layouts take a
+ * plain loop. Peaks are compared as integers, which orders finite
+ * magnitudes like floats.
+ */
+template<>
+void MeasureLevelsOf<SampleFormat::Float32>(const void* samples,
+                                            uint32_t channels,
+                                            uint32_t frameCount,
+                                            float* peaks,
+                                            float* sumSquares) {
+  auto p = static_cast<const float*>(samples);
+  const uint32_t sampleCount = frameCount * channels;
+  if (levelLanes % channels != 0) {
+    for (uint32_t i = 0; i < sampleCount; i++) {
+      peaks[i % channels] = std::max(peaks[i % channels], std::fabs(p[i]));
+      sumSquares[i % channels] += p[i] * p[i];
+    }
+    return;
+  }
+  
+  uint32_t lanePeaks[levelLanes] = {};
+  float laneSums[levelLanes] = {};
+  uint32_t i = 0;
+  for (; i + levelLanes <= sampleCount; i += levelLanes) {
+    for (uint32_t lane = 0; lane < levelLanes; lane++) {
+      uint32_t bits;
+      std::memcpy(&bits, &p[i + lane], sizeof(bits));
+      bits &= 0x7fffffff;
+      lanePeaks[lane] = bits > lanePeaks[lane] ? bits : lanePeaks[lane];
+      laneSums[lane] += p[i + lane] * p[i + lane];
+    }
+  }
+  for (uint32_t lane = 0; lane < levelLanes; lane++) {
+    float peak;
+    std::memcpy(&peak, &lanePeaks[lane], sizeof(peak));
+    peaks[lane % channels] = std::max(peaks[lane % channels], peak);
+    sumSquares[lane % channels] += laneSums[lane];
+  }
+  for (; i < sampleCount; i++) {
+    peaks[i % channels] = std::max(peaks[i % channels], std::fabs(p[i]));
+    sumSquares[i % channels] += p[i] * p[i];
+  }
+}
+
+}
+
+SampleConverter GetSampleConverter(SampleFormat in, SampleFormat out) {
+  if (in == out)
+    return nullptr;
+  
+  switch (in) {
+    case SampleFormat::Float32:
+      return GetSampleConverterFrom<SampleFormat::Float32>(out);
+    case SampleFormat::Int32:
+      return GetSampleConverterFrom<SampleFormat::Int32>(out);
+    case SampleFormat::Int24:
+      return GetSampleConverterFrom<SampleFormat::Int24>(out);
+    case SampleFormat::Int16:
+      return GetSampleConverterFrom<SampleFormat::Int16>(out);
+  }
+  return nullptr;
+}
+
+void ApplyGainRamp(void* samples,
+                   SampleFormat format,
+                   uint32_t channels,
+                   uint32_t frameCount,
+                   float gain,
+                   float step) {
+  switch (format) {
+    case SampleFormat::Float32:
+      return ApplyGainRampTo<SampleFormat::Float32>(samples, channels, frameCount, gain, step);
+    case SampleFormat::Int32:
+      return ApplyGainRampTo<SampleFormat::Int32>(samples, channels, frameCount, gain, step);
+    case SampleFormat::Int24:
+      return ApplyGainRampTo<SampleFormat::Int24>(samples, channels, frameCount, gain, step);
+    case SampleFormat::Int16:
+      return ApplyGainRampTo<SampleFormat::Int16>(samples, channels, frameCount, gain, step);
+  }
+}
+
+uint32_t SanitizeSamples(float* samples, uint32_t sampleCount) {
+  constexpr uint32_t signMask { 0x80000000 };
+  constexpr uint32_t exponentMask { 0x7f800000 };
+  uint32_t maxMagnitude;
+  std::memcpy(&maxMagnitude, &kMaxSampleMagnitude, sizeof(maxMagnitude));
+  
+  // Works on the bits, without branches, so the compiler vectorizes the
+  // loop and floating-point exceptions or slow denormal paths never come
+  // into play.
+  uint32_t replaced = 0;
+  for (uint32_t i = 0; i < sampleCount; i++) {
+    uint32_t bits;
+    std::memcpy(&bits, &samples[i], sizeof(bits));
+    const uint32_t exponent = bits & exponentMask;
+    const uint32_t magnitude = bits & ~signMask;
+    const bool nonFinite = exponent == exponentMask;
+    const bool clamped = !nonFinite && magnitude > maxMagnitude;
+    replaced += nonFinite | clamped;
+    
+    const uint32_t clampedMagnitude = magnitude > maxMagnitude ? maxMagnitude : magnitude;
+    bits = (nonFinite || exponent == 0) ? 0 : (bits & signMask) | clampedMagnitude;
+    std::memcpy(&samples[i], &bits, sizeof(bits));
+  }
+  return replaced;
+}
+
+void MeasureLevels(const void* samples,
+                   SampleFormat format,
+                   uint32_t channels,
+                   uint32_t frameCount,
+                   float* peaks,
+                   float* rms) {
+  // The squares are summed in place of the RMS.
+  std::fill(peaks, peaks + channels, 0.0f);
+  std::fill(rms, rms + channels, 0.0f);
+  switch (format) {
+    case SampleFormat::Float32:
+      MeasureLevelsOf<SampleFormat::Float32>(samples, channels, frameCount, peaks, rms);
+      break;
+    case SampleFormat::Int32:
+      MeasureLevelsOf<SampleFormat::Int32>(samples, channels, frameCount, peaks, rms);
+      break;
+    case SampleFormat::Int24:
+      MeasureLevelsOf<SampleFormat::Int24>(samples, channels, frameCount, peaks, rms);
+      break;
+    case SampleFormat::Int16:
+      MeasureLevelsOf<SampleFormat::Int16>(samples, channels, frameCount, peaks, rms);
+      break;
+  }
+  if (frameCount == 0)
+    return;
+  for (uint32_t channel = 0; channel < channels; channel++)
+    rms[channel] = std::sqrt(rms[channel] / frameCount);
+}
@@ -0,0 +1,163 @@
+#ifndef SampleConversion_h
+#define SampleConversion_h
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "Packet.h"
+
+/* Also used by the receiver in tools/ to decode the stream, so only
+ * standard types are used here.
+ */
+
+/** Reads and writes samples of a given format.
+ *
+ * Samples are exchanged as left-justified 32-bit signed integers, which can
+ * represent every supported format without losing precision.
+ */
+template<SampleFormat Format>
+struct SampleTraits;
+
+/** Drops the low \p Shift bits of a left-justified sample, rounding to
+ * nearest rather than down, and saturating at the top of the range.
+ */
+template<unsigned Shift>
+inline int32_t RoundSample(int32_t value) {
+  constexpr int32_t half = 1 << (Shift - 1);
+  return value > INT32_MAX - half ? INT32_MAX >> Shift : (value + half) >> Shift;
+}
+
+template<>
+struct SampleTraits<SampleFormat::Float32> {
+  static int32_t Read(const uint8_t* p) {
+    float sample;
+    std::memcpy(&sample, p, sizeof(sample));
+    if (!(sample > -1.0f)) return INT32_MIN;
+    if (sample >= 1.0f) return INT32_MAX;
+    return static_cast<int32_t>(std::lrint(sample * 2147483648.0));
+  }
+
+  static void Write(uint8_t* p, int32_t value) {
+    float sample = static_cast<float>(value / 2147483648.0);
+    std::memcpy(p, &sample, sizeof(sample));
+  }
+};
+
+template<>
+struct SampleTraits<SampleFormat::Int32> {
+  static int32_t Read(const uint8_t* p) {
+    int32_t sample;
+    std::memcpy(&sample, p, sizeof(sample));
+    return sample;
+  }
+
+  static void Write(uint8_t* p, int32_t value) {
+    std::memcpy(p, &value, sizeof(value));
+  }
+};
+
+template<>
+struct SampleTraits<SampleFormat::Int24> {
+  static int32_t Read(const uint8_t* p) {
+    return static_cast<int32_t>(static_cast<uint32_t>(p[0]) << 8
+                               | static_cast<uint32_t>(p[1]) << 16
+                               | static_cast<uint32_t>(p[2]) << 24);
+  }
+
+  static void Write(uint8_t* p, int32_t value) {
+    auto sample = RoundSample<8>(value);
+    p[0] = static_cast<uint8_t>(sample);
+    p[1] = static_cast<uint8_t>(sample >> 8);
+    p[2] = static_cast<uint8_t>(sample >> 16);
+  }
+};
+
+template<>
+struct SampleTraits<SampleFormat::Int16> {
+  static int32_t Read(const uint8_t* p) {
+    int16_t sample;
+    std::memcpy(&sample, p, sizeof(sample));
+    return static_cast<int32_t>(static_cast<uint32_t>(sample) << 16);
+  }
+
+  static void Write(uint8_t* p, int32_t value) {
+    auto sample = static_cast<int16_t>(RoundSample<16>(value));
+    std::memcpy(p, &sample, sizeof(sample));
+  }
+};
+
+/** Converts samples from one format to another.
+ *
+ * @param in The samples to convert.
+ * @param out Storage for the converted samples.
+ * @param sampleCount The number of samples (not frames) to convert.
+ */
+template<SampleFormat In, SampleFormat Out>
+void ConvertSamples(const void* in, void* out, uint32_t sampleCount) {
+  auto src = static_cast<const uint8_t*>(in);
+  auto dst = static_cast<uint8_t*>(out);
+  for (uint32_t i = 0; i < sampleCount; i++) {
+    SampleTraits<Out>::Write(dst, SampleTraits<In>::Read(src));
+    src += BytesPerSample(In);
+    dst += BytesPerSample(Out);
+  }
+}
+
+/** Signature shared by all the instances of ConvertSamples(). */
+typedef void (*SampleConverter)(const void* in, void* out, uint32_t sampleCount);
+
+/** Returns the converter between two formats, or nullptr if both formats
+ * are the same and no conversion is needed.
+ */
+SampleConverter GetSampleConverter(SampleFormat in, SampleFormat out);
+
+/** Multiplies frames by a gain that changes linearly from frame to frame,
+ * e.g. to fade a stream in or out.
+ *
+ * @param samples The interleaved frames, modified in place.
+ * @param format The encoding of the samples.
+ * @param channels The number of interleaved channels.
+ * @param frameCount The number of frames.
+ * @param gain The gain applied to the first frame.
+ * @param step The change of the gain from one frame to the next.
+ */
+void ApplyGainRamp(void* samples,
+                   SampleFormat format,
+                   uint32_t channels,
+                   uint32_t frameCount,
+                   float gain,
+                   float step);
+
+/** Measures the level of every channel of a block of frames.
+ *
+ * @param samples The interleaved frames.
+ * @param format The encoding of the samples.
+ * @param channels The number of interleaved channels.
+ * @param frameCount The number of frames.
+ * @param peaks Where to store the largest magnitude of every channel, in
+ *        full scale (1 for 0 dBFS).
+ * @param rms Where to store the RMS of every channel, in full scale.
+ */
+void MeasureLevels(const void* samples,
+                   SampleFormat format,
+                   uint32_t channels,
+                   uint32_t frameCount,
+                   float* peaks,
+                   float* rms);
+
+/** Largest magnitude SanitizeSamples() lets through (+12 dBFS). */
+constexpr float kMaxSampleMagnitude { 4.0f };
+
+/** Makes float samples safe to send: NaNs and infinities become silence,
+ * denormals are flushed to zero and magnitudes beyond kMaxSampleMagnitude
+ * are clamped to it.
+ *
+ * @param samples The samples, modified in place.
+ * @param sampleCount The number of samples (not frames).
+ * @return The number of samples that were not finite or were clamped;
+ *         flushed denormals are not counted.
+ */
+uint32_t SanitizeSamples(float* samples, uint32_t sampleCount);
+
+#endif /* SampleConversion_h */
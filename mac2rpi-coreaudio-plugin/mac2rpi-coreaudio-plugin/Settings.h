@@ -0,0 +1,84 @@
+#ifndef Settings_h
+#define Settings_h
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include <MacTypes.h>
+
+#include "DeviceConfiguration.h"
+#include "log.h"
+
+/** Run-time settings of the plug-in, read from the settings file (see
+ * SettingsWatcher). The defaults apply when the file does not exist or does
+ * not set a value.
+ *
+ * A published snapshot is never modified: a change in the file produces a
+ * new one.
+ */
+struct Settings {
+  /** The devices, matched by UID when the settings change. */
+  std::vector<DeviceConfiguration> devices { DeviceConfiguration{} };
+  
+  /** Minimum level logged at run time, indexed by category. */
+  std::array<LogLevel, static_cast<unsigned>(LogCategory::Count)> logLevels {{
+    LogLevel::Info,
+    LogLevel::Info,
+    LogLevel::Info,
+    LogLevel::Info,
+    LogLevel::Info,
+  }};
+  
+  /** File the log is appended to, or empty for the system log. */
+  std::string logFile;
+  
+  /** Bit rate (bits per second) the link to the receivers is assumed to
+   * sustain. High sample rates are sent with a narrower sample format when
+   * 32-bit float would exceed it. Applied through a configuration change.
+   */
+  Float64 wireBitRateBudget { 10000000.0 };
+  
+  /** Number of frames between two zero time stamps. Applied through a
+   * configuration change.
+   */
+  unsigned ringBufferSize { 4096 };
+  
+  /** Number of IO cycles without drops before leaving the degraded format
+   * (about two seconds at 512 frames and 48 kHz).
+   */
+  unsigned degradeHoldCycles { 200 };
+  
+  /** Number of IO cycles between two latency probes (see ProbePayload), or
+   * 0 to send none.
+   */
+  unsigned latencyProbeInterval { 0 };
+  
+  /** Frames of silence sent ahead of the audio when a device starts (see
+   * PacketType::Start).
+   */
+  unsigned preRollFrames { 512 };
+  
+  /** Length, in frames, of the fade-in applied when a device starts and of
+   * the fade-out the receiver applies when it stops.
+   */
+  unsigned fadeFrames { 128 };
+  
+  /** Highest level, in dBFS, of the float samples sent (see Limiter), or 0
+   * to send them as they are: the limiter only runs below 0 dBFS, as it
+   * delays the stream.
+   */
+  Float64 limiterCeiling { 0 };
+  
+  /** Seconds of silence after which a device stops sending until the
+   * audio comes back, or 0 to send silence forever.
+   */
+  Float64 suspendAfterSilence { 10.0 };
+  
+  /** File the sent datagrams are captured to (see CaptureWriter), or empty
+   * to capture nothing.
+   */
+  std::string captureFile;
+};
+
+#endif /* Settings_h */
@@ -0,0 +1,243 @@
+#include "SettingsWatcher.h"
+
+#include <fstream>
+#include <map>
+#include <thread>
+
+#include <sys/stat.h>
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "OSException.h"
+
+namespace pt = boost::property_tree;
+
+constexpr const char* SettingsWatcher::path;
+constexpr std::chrono::seconds SettingsWatcher::checkInterval;
+
+namespace {
+
+/** Used until the settings file is read, and when it does not exist. */
+const Settings defaultSettings;
+
+/** Returns the value a name maps to.
+ *
+ * @note An exception is thrown if the name is unknown.
+ */
+template<typename T>
+T Lookup(const std::map<std::string, T>& values,
+         const std::string& name,
+         const char* what) {
+  auto it = values.find(name);
+  if (it == values.end())
+    throw OSException((boost::format("invalid %1%: %2%") % what % name).str(),
+                      kAudioHardwareIllegalOperationError);
+  return it->second;
+}
+
+LogLevel ParseLogLevel(const std::string& name) {
+  static const std::map<std::string, LogLevel> levels {
+    { "trace", LogLevel::Trace },
+    { "debug", LogLevel::Debug },
+    { "info", LogLevel::Info },
+    { "warning", LogLevel::Warning },
+    { "error", LogLevel::Error },
+    { "off", LogLevel::Off },
+  };
+  return Lookup(levels, name, "log level");
+}
+
+LogCategory ParseLogCategory(const std::string& name) {
+  static const std::map<std::string, LogCategory> categories {
+    { "property", LogCategory::Property },
+    { "io", LogCategory::IO },
+    { "timing", LogCategory::Timing },
+    { "network", LogCategory::Network },
+    { "control", LogCategory::Control },
+  };
+  return Lookup(categories, name, "log category");
+}
+
+DeviceConfiguration ParseDevice(const pt::ptree& tree) {
+  static const std::map<std::string, ChannelLayout> channelLayouts {
+    { "stereo", kChannelLayoutStereo },
+    { "5.1", kChannelLayout5_1 },
+    { "7.1", kChannelLayout7_1 },
+  };
+  static const std::map<std::string, OverloadPolicy> overloadPolicies {
+    { "dropNewest", OverloadPolicy::DropNewest },
+    { "dropOldest", OverloadPolicy::DropOldest },
+    { "degrade", OverloadPolicy::Degrade },
+  };
+  
+  DeviceConfiguration configuration;
+  configuration.uid = tree.get("uid", configuration.uid);
+  configuration.name = tree.get("name", configuration.name);
+  
+  if (auto destinations = tree.get_child_optional("destinations")) {
+    configuration.destinations.clear();
+    for (const auto& entry : *destinations)
+      configuration.destinations.push_back({
+        entry.second.get<std::string>("address"),
+        entry.second.get<unsigned short>("port")
+      });
+  }
+  
+  if (auto name = tree.get_optional<std::string>("channelLayout"))
+    configuration.channelLayout = Lookup(channelLayouts, *name, "channel layout");
+  if (auto name = tree.get_optional<std::string>("overloadPolicy"))
+    configuration.overloadPolicy = Lookup(overloadPolicies, *name, "overload policy");
+  configuration.sendBufferSize = tree.get("sendBufferSize",
+                                          configuration.sendBufferSize);
+  return configuration;
+}
+
+}
+
+std::atomic<const Settings*> SettingsWatcher::current_ { &defaultSettings };
+
+SettingsWatcher& SettingsWatcher::GetInstance() {
+  // Never destroyed, as the IO thread may read the snapshots it owns until
+  // the very end.
+  static auto watcher = new SettingsWatcher;
+  return *watcher;
+}
+
+SettingsWatcher::SettingsWatcher() {
+  try {
+    Check();
+  } catch (const std::exception& e) {
+    LOG(Control, Error, boost::format("Cannot read %1%: %2%") % path % e.what());
+  }
+}
+
+void SettingsWatcher::Start(Listener listener) {
+  ApplyLogSettings(Current());
+  listener_ = std::move(listener);
+  std::thread(&SettingsWatcher::Run, this).detach();
+}
+
+void SettingsWatcher::Run() {
+  for (;;) {
+    std::this_thread::sleep_for(checkInterval);
+    try {
+      auto previous = Check();
+      if (previous != nullptr) {
+        ApplyLogSettings(Current());
+        listener_(*previous, Current());
+      }
+    } catch (const std::exception& e) {
+      // The settings in effect are kept until the file is fixed.
+      LOG(Control, Error, boost::format("Cannot read %1%: %2%") % path % e.what());
+    }
+  }
+}
+
+SettingsWatcher::FileStatus SettingsWatcher::StatFile() {
+  FileStatus file;
+  struct stat status;
+  if (stat(path, &status) != 0)
+    return file;
+  
+  file.exists = true;
+#ifdef __APPLE__
+  file.modificationTime = status.st_mtimespec;
+#else
+  file.modificationTime = status.st_mtim;
+#endif
+  file.size = status.st_size;
+  file.inode = status.st_ino;
+  return file;
+}
+
+const Settings* SettingsWatcher::Check() {
+  // The modification time alone misses a rewrite within its resolution,
+  // and a file replaced by rename() may have an older one.
+  auto file = StatFile();
+  if (file == loadedFile_)
+    return nullptr;
+  
+  std::unique_ptr<const Settings> settings;
+  if (!file.exists) {
+    settings = std::make_unique<Settings>(defaultSettings);
+  } else {
+    try {
+      std::ifstream stream(path);
+      settings = Parse(stream);
+    } catch (const std::exception&) {
+      if (file == rejectedFile_)
+        return nullptr;
+      rejectedFile_ = file;
+      throw;
+    }
+  }
+  loadedFile_ = file;
+  
+  LOG(Control, Info, boost::format("Loaded settings from %1%") % path);
+  auto previous = current_.exchange(settings.get(), std::memory_order_acq_rel);
+  snapshots_.push_back(std::move(settings));
+  return previous;
+}
+
+std::unique_ptr<const Settings> SettingsWatcher::Parse(std::istream& stream) {
+  pt::ptree tree;
+  pt::read_json(stream, tree);
+  
+  auto settings = std::make_unique<Settings>();
+  if (auto devices = tree.get_child_optional("devices")) {
+    settings->devices.clear();
+    for (const auto& entry : *devices)
+      settings->devices.push_back(ParseDevice(entry.second));
+  }
+  
+  if (auto level = tree.get_optional<std::string>("log.level"))
+    settings->logLevels.fill(ParseLogLevel(*level));
+  if (auto levels = tree.get_child_optional("log.levels")) {
+    for (const auto& entry : *levels)
+      settings->logLevels[static_cast<unsigned>(ParseLogCategory(entry.first))]
+          = ParseLogLevel(entry.second.data());
+  }
+  settings->logFile = tree.get("log.file", settings->logFile);
+  
+  settings->wireBitRateBudget = tree.get("wireBitRateBudget",
+                                         settings->wireBitRateBudget);
+  settings->ringBufferSize = tree.get("ringBufferSize",
+                                      settings->ringBufferSize);
+  settings->degradeHoldCycles = tree.get("degradeHoldCycles",
+                                         settings->degradeHoldCycles);
+  settings->latencyProbeInterval = tree.get("latencyProbeInterval",
+                                            settings->latencyProbeInterval);
+  settings->preRollFrames = tree.get("preRollFrames", settings->preRollFrames);
+  settings->fadeFrames = tree.get("fadeFrames", settings->fadeFrames);
+  settings->limiterCeiling = tree.get("limiterCeiling", settings->limiterCeiling);
+  settings->suspendAfterSilence = tree.get("suspendAfterSilence",
+                                           settings->suspendAfterSilence);
+  settings->captureFile = tree.get("captureFile", settings->captureFile);
+  
+  if (settings->wireBitRateBudget <= 0)
+    throw OSException("invalid wireBitRateBudget",
+                      kAudioHardwareIllegalOperationError);
+  if (settings->ringBufferSize < 256 || settings->ringBufferSize > 65536)
+    throw OSException("ringBufferSize out of range [256, 65536]",
+                      kAudioHardwareIllegalOperationError);
+  if (settings->limiterCeiling < -24 || settings->limiterCeiling > 0)
+    throw OSException("limiterCeiling out of range [-24, 0]",
+                      kAudioHardwareIllegalOperationError);
+  if (settings->suspendAfterSilence < 0)
+    throw OSException("invalid suspendAfterSilence",
+                      kAudioHardwareIllegalOperationError);
+  if (settings->preRollFrames > 65536)
+    throw OSException("preRollFrames out of range [0, 65536]",
+                      kAudioHardwareIllegalOperationError);
+  if (settings->fadeFrames > 65536)
+    throw OSException("fadeFrames out of range [0, 65536]",
+                      kAudioHardwareIllegalOperationError);
+  return std::move(settings);
+}
+
+void SettingsWatcher::ApplyLogSettings(const Settings& settings) {
+  for (unsigned category = 0; category < settings.logLevels.size(); category++)
+    setLogLevel(static_cast<LogCategory>(category), settings.logLevels[category]);
+  setLogFile(settings.logFile.empty() ? nullptr : settings.logFile.c_str());
+}
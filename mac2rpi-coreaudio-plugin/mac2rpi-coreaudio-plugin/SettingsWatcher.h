@@ -0,0 +1,144 @@
+#ifndef SettingsWatcher_h
+#define SettingsWatcher_h
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "Settings.h"
+
+/** Reloads the settings when the settings file changes.
+ *
+ * A background thread polls the modification time of the file and parses
+ * it when it changes. The new settings are published as an immutable
+ * snapshot by swapping an atomic pointer, so the IO thread reads them with
+ * a single load and never waits for a reload. Snapshots are never freed,
+ * since the IO thread may still be reading an old one; there is one per
+ * edit of the file.
+ *
+ * The file is JSON, e.g.:
+ *
+ *     {
+ *       "devices": [ {
+ *         "uid": "living-room",
+ *         "name": "Living Room",
+ *         "destinations": [ { "address": "239.255.0.1", "port": 30001 } ],
+ *         "channelLayout": "stereo",
+ *         "overloadPolicy": "dropOldest",
+ *         "sendBufferSize": 0
+ *       } ],
+ *       "log": { "level": "info", "levels": { "io": "debug" } },
+ *       "wireBitRateBudget": 10000000,
+ *       "ringBufferSize": 4096,
+ *       "degradeHoldCycles": 200,
+ *       "latencyProbeInterval": 0,
+ *       "preRollFrames": 512,
+ *       "fadeFrames": 128,
+ *       "limiterCeiling": 0,
+ *       "suspendAfterSilence": 10,
+ *       "captureFile": ""
+ *     }
+ *
+ * Every key is optional. A file that cannot be parsed is ignored, and the
+ * settings in effect are kept.
+ */
+class SettingsWatcher {
+public:
+  /** Where the settings are read from. */
+  static constexpr const char* path { "/Library/Preferences/Audio/mac2rpi.json" };
+  
+  /** How often the file is checked for changes. */
+  static constexpr std::chrono::seconds checkInterval { 1 };
+  
+  /** Called from the watcher thread after new settings are published. */
+  typedef std::function<void(const Settings& previous,
+                             const Settings& current)> Listener;
+  
+  /** Returns the settings in effect. Safe to call from the IO thread; the
+   * returned snapshot stays valid forever.
+   */
+  static const Settings& Current() noexcept {
+    return *current_.load(std::memory_order_acquire);
+  }
+  
+  /** Returns the only instance of this class. The settings file is read
+   * when it is first called.
+   */
+  static SettingsWatcher& GetInstance();
+  
+  SettingsWatcher(const SettingsWatcher&) = delete;
+  SettingsWatcher& operator=(const SettingsWatcher&) = delete;
+  
+  /** Applies the log settings and starts watching the file.
+   *
+   * @param listener Applies the rest of the settings when they change.
+   */
+  void Start(Listener listener);
+  
+  /** Parses the content of a settings file.
+   *
+   * @note An exception is thrown if the content is not valid.
+   */
+  static std::unique_ptr<const Settings> Parse(std::istream& stream);
+
+private:
+  /** What tells versions of the settings file apart. */
+  struct FileStatus {
+    bool exists { false };
+    timespec modificationTime {};
+    off_t size { 0 };
+    ino_t inode { 0 };
+    
+    bool operator==(const FileStatus& other) const {
+      return exists == other.exists
+          && modificationTime.tv_sec == other.modificationTime.tv_sec
+          && modificationTime.tv_nsec == other.modificationTime.tv_nsec
+          && size == other.size
+          && inode == other.inode;
+    }
+  };
+  
+  SettingsWatcher();
+  
+  /** Returns the status of the settings file. */
+  static FileStatus StatFile();
+  
+  void Run();
+  
+  /** Reloads the settings if the file changed.
+   *
+   * @return The previous settings if new ones were published, nullptr
+   *         otherwise.
+   */
+  const Settings* Check();
+  
+  /** Applies the log levels and the log file. */
+  static void ApplyLogSettings(const Settings& settings);
+  
+  /** The settings in effect. */
+  static std::atomic<const Settings*> current_;
+  
+  /** Owns every snapshot ever published. */
+  std::vector<std::unique_ptr<const Settings>> snapshots_;
+  
+  Listener listener_;
+  
+  /** The file the settings in effect were read from. Only set once it has
+   * been parsed, so that a file caught in the middle of a write is read
+   * again at the next check.
+   */
+  FileStatus loadedFile_;
+  
+  /** The last file that could not be parsed, so that its error is only
+   * logged once.
+   */
+  FileStatus rejectedFile_;
+};
+
+#endif /* SettingsWatcher_h */
@@ -4,6 +4,61 @@
 #include "log.h"
 #include "OSException.h"
 
+namespace {
+
+/** Builds the description of a packed, native-endian linear PCM format. */
+AudioStreamBasicDescription MakeStreamDescription(Float64 sampleRate,
+                                                  SampleFormat format,
+                                                  unsigned channels) {
+  AudioStreamBasicDescription desc;
+  desc.mSampleRate = sampleRate;
+  desc.mFormatID = kAudioFormatLinearPCM;
+  desc.mFormatFlags =
+      (format == SampleFormat::Float32
+          ? kAudioFormatFlagIsFloat
+          : kAudioFormatFlagIsSignedInteger)
+      | kAudioFormatFlagsNativeEndian
+      | kAudioFormatFlagIsPacked;
+  desc.mBytesPerPacket = channels * BytesPerSample(format);
+  desc.mFramesPerPacket = 1;
+  desc.mBytesPerFrame = channels * BytesPerSample(format);
+  desc.mChannelsPerFrame = channels;
+  desc.mBitsPerChannel = BytesPerSample(format) * 8;
+  desc.mReserved = 0;
+  return desc;
+}
+
+/** Finds the sample format matching a stream description.
+ *
+ * @param desc The stream description.
+ * @param channels The number of channels of the device.
+ * @param format Where to store the matching sample format.
+ * @return True if the description matches one of the physical formats of the
+ *         device; false otherwise.
+ */
+bool ParseStreamDescription(const AudioStreamBasicDescription& desc,
+                            unsigned channels,
+                            SampleFormat& format) {
+  for (auto candidate : Device::availablePhysicalFormats) {
+    auto expected = MakeStreamDescription(desc.mSampleRate,
+                                          candidate,
+                                          channels);
+    if (desc.mFormatID == expected.mFormatID
+        && desc.mFormatFlags == expected.mFormatFlags
+        && desc.mBytesPerPacket == expected.mBytesPerPacket
+        && desc.mFramesPerPacket == expected.mFramesPerPacket
+        && desc.mBytesPerFrame == expected.mBytesPerFrame
+        && desc.mChannelsPerFrame == expected.mChannelsPerFrame
+        && desc.mBitsPerChannel == expected.mBitsPerChannel) {
+      format = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+}
+
 Stream::Stream(AudioObjectID objectID, Device& device)
   : AudioObject(objectID,
                 kAudioStreamClassID,
@@ -15,7 +70,7 @@ Stream::Stream(AudioObjectID objectID, Device& device)
 Boolean Stream::HasProperty(pid_t clientProcessID,
                             const AudioObjectPropertyAddress& address) const {
 
-  LOG(boost::format("StreamHasProperty: selector=%1%")
+  LOG(Property, Trace, boost::format("StreamHasProperty: selector=%1%")
       % StreamPropertyToString(address.mSelector));
 
   switch (address.mSelector) {
@@ -71,9 +126,13 @@ UInt32 Stream::GetPropertyDataSize(pid_t clientProcessID,
       return sizeof(AudioStreamBasicDescription);
 
     case kAudioStreamPropertyAvailableVirtualFormats:
+      return Device::availableSampleRates.size()
+          * sizeof(AudioStreamRangedDescription);
+      
     case kAudioStreamPropertyAvailablePhysicalFormats:
       return Device::availableSampleRates.size()
-          * sizeof(AudioStreamBasicDescription);
+          * Device::availablePhysicalFormats.size()
+          * sizeof(AudioStreamRangedDescription);
   };
   
   return AudioObject::GetPropertyDataSize(clientProcessID,
@@ -89,20 +148,13 @@ UInt32 Stream::GetPropertyData(pid_t clientProcessID,
                                UInt32 dataSize,
                                void* data) const {
   
-  LOG(boost::format("StreamGetPropertyData: selector=%1%")
+  LOG(Property, Trace, boost::format("StreamGetPropertyData: selector=%1%")
       % StreamPropertyToString(address.mSelector));
 
   switch (address.mSelector) {
     case kAudioStreamPropertyIsActive:
-    {
-      LOG("########## Get IsActive: UNSUPPORTED");
-
-      // TODO
-      return 0;
-//      std::lock_guard<std::mutex> lock(g_pluginStateMutex);
-//      return GetPropertyDataImpl<UInt32>
-//          (dataSize, gStream_Output_IsActive, data);
-    }
+      return GetPropertyDataImpl<UInt32>
+          (dataSize, device_.OutputActive(), data);
       
     case kAudioStreamPropertyDirection:
       // 0: output stream; 1: input stream
@@ -119,48 +171,45 @@ UInt32 Stream::GetPropertyData(pid_t clientProcessID,
 
     case kAudioStreamPropertyLatency:
       return GetPropertyDataImpl<UInt32>
-          (dataSize, 0, data);
+          (dataSize, device_.OutputLatency(), data);
       
     case kAudioStreamPropertyVirtualFormat:
-    case kAudioStreamPropertyPhysicalFormat:
-    {
-      CheckOutDataSize(dataSize, sizeof(AudioStreamBasicDescription));
-      auto& desc = *static_cast<AudioStreamBasicDescription*>(data);
-      desc.mSampleRate = device_.SampleRate();
-      desc.mFormatID = kAudioFormatLinearPCM;
-      desc.mFormatFlags =
-          kAudioFormatFlagIsFloat
-          | kAudioFormatFlagsNativeEndian
-          | kAudioFormatFlagIsPacked;
-      desc.mBytesPerPacket = 8;
-      desc.mFramesPerPacket = 1;
-      desc.mBytesPerFrame = 8;
-      desc.mChannelsPerFrame = 2;
-      desc.mBitsPerChannel = 32;
+      // The HAL mixes in 32-bit float and converts the mix to the physical
+      // format before handing it to WriteMix.
+      return GetPropertyDataImpl<AudioStreamBasicDescription>
+          (dataSize,
+           MakeStreamDescription(device_.SampleRate(),
+                                 SampleFormat::Float32,
+                                 device_.NumberOfChannels()),
+           data);
       
-      return sizeof(AudioStreamBasicDescription);
-    }
+    case kAudioStreamPropertyPhysicalFormat:
+      return GetPropertyDataImpl<AudioStreamBasicDescription>
+          (dataSize,
+           MakeStreamDescription(device_.SampleRate(),
+                                 device_.PhysicalFormat(),
+                                 device_.NumberOfChannels()),
+           data);
       
     case kAudioStreamPropertyAvailableVirtualFormats:
     case kAudioStreamPropertyAvailablePhysicalFormats:
     {
+      // Virtual formats are always 32-bit float (the first physical format).
+      UInt32 formatCount =
+          (address.mSelector == kAudioStreamPropertyAvailableVirtualFormats)
+              ? 1
+              : Device::availablePhysicalFormats.size();
       UInt32 itemCount = dataSize / sizeof(AudioStreamRangedDescription);
-      itemCount = std::min<UInt32>(itemCount, Device::availableSampleRates.size());
+      itemCount = std::min<UInt32>(itemCount,
+                                   formatCount * Device::availableSampleRates.size());
       
       for (unsigned i = 0; i < itemCount; i++) {
         auto& desc = static_cast<AudioStreamRangedDescription*>(data)[i];
-        auto sample_rate = Device::availableSampleRates[i];
-        desc.mFormat.mSampleRate = sample_rate;
-        desc.mFormat.mFormatID = kAudioFormatLinearPCM;
-        desc.mFormat.mFormatFlags =
-            kAudioFormatFlagIsFloat
-            | kAudioFormatFlagsNativeEndian
-            | kAudioFormatFlagIsPacked;
-        desc.mFormat.mBytesPerPacket = 8;
-        desc.mFormat.mFramesPerPacket = 1;
-        desc.mFormat.mBytesPerFrame = 8;
-        desc.mFormat.mChannelsPerFrame = 2;
-        desc.mFormat.mBitsPerChannel = 32;
+        auto sample_rate = Device::availableSampleRates[i % Device::availableSampleRates.size()];
+        auto format = Device::availablePhysicalFormats[i / Device::availableSampleRates.size()];
+        desc.mFormat = MakeStreamDescription(sample_rate,
+                                             format,
+                                             device_.NumberOfChannels());
         desc.mSampleRateRange.mMinimum = sample_rate;
         desc.mSampleRateRange.mMaximum = sample_rate;
       }
@@ -186,70 +235,49 @@ Stream::SetPropertyData(pid_t clientProcessID,
                         const void* data) {
   switch (address.mSelector) {
     case kAudioStreamPropertyIsActive:
-      LOG("########## Set IsActive: UNSUPPORTED");
-      // TODO
-      break;
-#if 0
     {
-      check_in_data_size(dataSize, sizeof(UInt32));
-      std::lock_guard<std::mutex> lock(gPlugInStateMutex);
-      bool isActive = *(static_cast<UInt32*>(data)) != 0;
-      if (gStream_Output_IsActive != isActive) {
-        gStream_Output_IsActive = isActive;
-        ChangedAddressList changedAddresses;
-        changedAddresses[0].mSelector = kAudioStreamPropertyIsActive;
-        changedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
-        changedAddresses[0].mElement = kAudioObjectPropertyElementMaster;
-        return std::make_pair(1, changedAddresses);
+      // An inactive stream suspends the output of the device (see
+      // Device::WriteOutputData()).
+      CheckInDataSize(dataSize, sizeof(UInt32));
+      bool isActive = *(static_cast<const UInt32*>(data)) != 0;
+      LOG(Property, Debug,
+          boost::format("Stream set IsActive (%1%)") % isActive);
+      
+      if (isActive != device_.OutputActive()) {
+        device_.SetOutputActive(isActive);
+        ChangedPropertyList changedProperties;
+        changedProperties[0].mSelector = kAudioStreamPropertyIsActive;
+        changedProperties[0].mScope = kAudioObjectPropertyScopeGlobal;
+        changedProperties[0].mElement = kAudioObjectPropertyElementMaster;
+        return std::make_pair(1, changedProperties);
       }
+      
+      return std::make_pair(0, ChangedPropertyList{});
     }
-#endif
       
     case kAudioStreamPropertyVirtualFormat:
     case kAudioStreamPropertyPhysicalFormat:
       // Changing the stream format needs to be handled via the
       // RequestConfigChange/PerformConfigChange machinery.
-      // Note that because this device only supports 2 channel 32 bit float
-      // data, the only thing that can change is the sample rate.
-      LOG("########## Set Stream format: UNSUPPORTED");
-
-      // TODO
+      // Note that the number of channels is fixed by the layout of the
+      // device, and that the virtual format is always 32-bit float.
     {
       CheckInDataSize(dataSize, sizeof(AudioStreamBasicDescription));
-      auto desc = static_cast<const AudioStreamBasicDescription*>(data);
+      auto& desc = *static_cast<const AudioStreamBasicDescription*>(data);
       
-      if (desc->mFormatID != kAudioFormatLinearPCM
-          || desc->mFormatFlags != (kAudioFormatFlagIsFloat
-                                    | kAudioFormatFlagsNativeEndian
-                                    | kAudioFormatFlagIsPacked)
-          || desc->mBytesPerPacket != 8
-          || desc->mFramesPerPacket != 1
-          || desc->mBytesPerFrame != 8
-          || desc->mChannelsPerFrame != 2
-          || desc->mBitsPerChannel != 32
-          || ((desc->mSampleRate != 44100.0) && (desc->mSampleRate != 48000.0)))
+      SampleFormat format;
+      if (!ParseStreamDescription(desc, device_.NumberOfChannels(), format)
+          || !Device::IsSampleRateSupported(desc.mSampleRate)
+          || (address.mSelector == kAudioStreamPropertyVirtualFormat
+              && format != SampleFormat::Float32))
         throw OSException("unsupported stream format",
                           kAudioDeviceUnsupportedFormatError);
       
-//      // XXX can't we just use atomics?
-//      Float64 oldSampleRate;
-//      {
-//        std::lock_guard<std::mutex> lock(gPlugInStateMutex);
-//        oldSampleRate = gDeviceSampleRate;
-//      }
-//      
-//      if (desc->sampleRate != oldSampleRate) {
-//        LOG(boost::format("Changing sample rate: %1%") % desc->sampleRate);
-//        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
-//          ^{ gPlugInHost->RequestDeviceConfigurationChange(gPluginHost,
-//                                                           kObjectID_Device,
-//                                                           static_cast<UInt64>(sampleRate),
-//                                                           nullptr);
-//          });
-//      }
-      
-//      return std::make_pair(0, ChangedAddressList{});
-      break;
+      if (address.mSelector == kAudioStreamPropertyVirtualFormat)
+        device_.RequestSampleRateChange(desc.mSampleRate);
+      else
+        device_.RequestFormatChange(desc.mSampleRate, format);
+      return std::make_pair(0, ChangedPropertyList{});
     }
   };
   
@@ -0,0 +1,77 @@
+#ifndef TraceFormat_h
+#define TraceFormat_h
+
+#include <cstdint>
+
+/* Layout of the IO-cycle trace file. Shared with the trace analyzer in
+ * tools/, which is built on Linux, so only standard types are used here.
+ */
+
+/** Identifies a trace file ("m2rt"). */
+constexpr uint32_t kTraceMagic { 0x6d327274 };
+
+/** Version of the trace file layout. */
+constexpr uint32_t kTraceVersion { 1 };
+
+/** Plug-in call a trace record describes. */
+enum class TraceEvent : uint8_t {
+  GetZeroTimeStamp = 0,
+  BeginIOOperation = 1,
+  DoIOOperation = 2,
+  WriteOutputData = 3,
+};
+
+/** Placed at the start of the trace file, followed by \p capacity records
+ * used as a circular buffer.
+ */
+struct TraceFileHeader {
+  uint32_t magic;
+  uint32_t version;
+
+  /** Number of records in the file. */
+  uint32_t capacity;
+
+  /** Size of a record, for forward compatibility. */
+  uint32_t recordSize;
+
+  /** Converts host ticks to nanoseconds: ns = ticks * numer / denom. */
+  uint32_t timebaseNumer;
+  uint32_t timebaseDenom;
+
+  /** Total number of records ever written. The next record goes to slot
+   * writeCount % capacity.
+   */
+  uint64_t writeCount;
+};
+
+static_assert(sizeof(TraceFileHeader) == 32, "Unexpected trace header size");
+
+/** One plug-in call. Times are in host ticks. */
+struct TraceRecord {
+  /** Host time when the call started. */
+  uint64_t hostTime;
+
+  /** Sample time of the call: the output time of the IO cycle, or the
+   * sample time of the returned time stamp for GetZeroTimeStamp.
+   */
+  double sampleTime;
+
+  /** Host time of the returned time stamp (GetZeroTimeStamp only). */
+  uint64_t timeStampHostTime;
+
+  /** Time spent in the call. */
+  uint32_t duration;
+
+  /** Number of frames of the IO cycle (0 for GetZeroTimeStamp). */
+  uint32_t frameCount;
+
+  /** Device the call was made on. */
+  uint32_t deviceID;
+
+  TraceEvent event;
+  uint8_t reserved[3];
+};
+
+static_assert(sizeof(TraceRecord) == 40, "Unexpected trace record size");
+
+#endif /* TraceFormat_h */
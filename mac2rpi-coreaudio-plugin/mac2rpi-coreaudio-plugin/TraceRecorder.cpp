@@ -0,0 +1,126 @@
+#include "TraceRecorder.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mach/mach_time.h>
+
+#include "log.h"
+
+constexpr const char* TraceRecorder::fileName;
+constexpr uint32_t TraceRecorder::capacity;
+
+namespace {
+  constexpr size_t fileSize
+      { sizeof(TraceFileHeader) + TraceRecorder::capacity * sizeof(TraceRecord) };
+
+  /** Maps the file when the plug-in is loaded, rather than on the first
+   * call from the IO thread.
+   */
+  TraceRecorder& recorderAtLoad = TraceRecorder::GetInstance();
+}
+
+TraceRecorder& TraceRecorder::GetInstance() {
+  static TraceRecorder recorder;
+  return recorder;
+}
+
+std::string TraceRecorder::Path() {
+  char directory[PATH_MAX];
+  auto length = confstr(_CS_DARWIN_USER_TEMP_DIR, directory, sizeof(directory));
+  if (length == 0 || length > sizeof(directory))
+    return std::string();
+
+  std::string path(directory);
+  if (path.back() != '/')
+    path += '/';
+  return path + fileName;
+}
+
+TraceRecorder::TraceRecorder() {
+  const auto path = Path();
+  if (path.empty()) {
+    LOG(Timing, Warning,
+        boost::format("No temporary directory, tracing disabled"));
+    return;
+  }
+
+  // The trace is created under a new name and renamed over the previous
+  // one, so that the plug-in never truncates nor maps a file it did not
+  // create itself.
+  auto temporaryPath = path + ".XXXXXX";
+  auto fd = mkstemp(&temporaryPath[0]);
+  if (fd < 0) {
+    LOG(Timing, Warning,
+        boost::format("Cannot create trace file %1%, tracing disabled") % path);
+    return;
+  }
+
+  void* mapping = MAP_FAILED;
+  if (fchmod(fd, 0644) == 0
+      && ftruncate(fd, fileSize) == 0
+      && std::rename(temporaryPath.c_str(), path.c_str()) == 0)
+    mapping = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  else
+    unlink(temporaryPath.c_str());
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    LOG(Timing, Warning,
+        boost::format("Cannot map trace file %1%, tracing disabled") % path);
+    return;
+  }
+  LOG(Timing, Info, boost::format("Tracing to %1%") % path);
+
+  mach_timebase_info_data_t timebase;
+  mach_timebase_info(&timebase);
+
+  auto header = static_cast<TraceFileHeader*>(mapping);
+  header->magic = kTraceMagic;
+  header->version = kTraceVersion;
+  header->capacity = capacity;
+  header->recordSize = sizeof(TraceRecord);
+  header->timebaseNumer = timebase.numer;
+  header->timebaseDenom = timebase.denom;
+  header->writeCount = 0;
+
+  header_ = header;
+  records_ = reinterpret_cast<TraceRecord*>(header + 1);
+}
+
+TraceRecorder::~TraceRecorder() {
+  if (header_ != nullptr)
+    munmap(header_, fileSize);
+}
+
+void TraceRecorder::Record(const TraceRecord& record) noexcept {
+  if (header_ == nullptr)
+    return;
+
+  auto index = __atomic_fetch_add(&header_->writeCount, 1, __ATOMIC_RELAXED);
+  records_[index % capacity] = record;
+}
+
+TraceScope::TraceScope(TraceEvent event,
+                       UInt32 deviceID,
+                       Float64 sampleTime,
+                       UInt32 frameCount) noexcept {
+  record_.hostTime = mach_absolute_time();
+  record_.sampleTime = sampleTime;
+  record_.timeStampHostTime = 0;
+  record_.duration = 0;
+  record_.frameCount = frameCount;
+  record_.deviceID = deviceID;
+  record_.event = event;
+  record_.reserved[0] = record_.reserved[1] = record_.reserved[2] = 0;
+}
+
+TraceScope::~TraceScope() {
+  record_.duration = static_cast<uint32_t>(mach_absolute_time() - record_.hostTime);
+  TraceRecorder::GetInstance().Record(record_);
+}
@@ -0,0 +1,80 @@
+#ifndef TraceRecorder_h
+#define TraceRecorder_h
+
+#include <string>
+
+#include <MacTypes.h>
+
+#include "TraceFormat.h"
+
+/** Records the IO cycle calls into a memory-mapped circular file.
+ *
+ * The file survives the plug-in, so that it can be copied and run through
+ * tools/trace-analyzer after a dropout. Recording is a handful of stores
+ * into the mapping and is always on; if the file cannot be mapped, nothing
+ * is recorded.
+ */
+class TraceRecorder {
+public:
+  /** Name of the trace file. */
+  static constexpr const char* fileName { "mac2rpi.trace" };
+
+  /** Returns where the trace is written: in the temporary directory of the
+   * user coreaudiod runs as, which no other user can write to. Empty if
+   * that directory is unknown.
+   */
+  static std::string Path();
+
+  /** Number of records kept: about three minutes of IO cycles at 512 frames
+   * and 48 kHz, for a 2.5 MB file.
+   */
+  static constexpr uint32_t capacity { 65536 };
+
+  /** Returns the only instance of this class. */
+  static TraceRecorder& GetInstance();
+
+  TraceRecorder(const TraceRecorder&) = delete;
+  TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+  /** Appends a record to the trace. Safe to call from the IO thread. */
+  void Record(const TraceRecord& record) noexcept;
+
+private:
+  TraceRecorder();
+  ~TraceRecorder();
+
+  TraceFileHeader* header_ { nullptr };
+  TraceRecord* records_ { nullptr };
+};
+
+/** Records a plug-in call in the trace when leaving the scope. */
+class TraceScope {
+public:
+  /** Starts timing a call.
+   *
+   * @param event The call being traced.
+   * @param deviceID The device the call was made on.
+   * @param sampleTime The sample time of the IO cycle, if any.
+   * @param frameCount The number of frames of the IO cycle, if any.
+   */
+  TraceScope(TraceEvent event,
+             UInt32 deviceID,
+             Float64 sampleTime = 0,
+             UInt32 frameCount = 0) noexcept;
+
+  ~TraceScope();
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+  /** Sets the time stamp returned by GetZeroTimeStamp. */
+  void SetTimeStamp(Float64 sampleTime, UInt64 hostTime) noexcept {
+    record_.sampleTime = sampleTime;
+    record_.timeStampHostTime = hostTime;
+  }
+
+private:
+  TraceRecord record_;
+};
+
+#endif /* TraceRecorder_h */
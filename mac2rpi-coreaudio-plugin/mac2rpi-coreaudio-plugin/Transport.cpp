@@ -0,0 +1,238 @@
+#include "Transport.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <mach/mach_time.h>
+
+#include "CaptureWriter.h"
+#include "Metrics.h"
+#include "OSException.h"
+#include "TransportSupervisor.h"
+
+namespace asio = boost::asio;
+
+constexpr unsigned Transport::backlogCapacity;
+constexpr unsigned Transport::maxDestinations;
+constexpr unsigned Transport::persistentFailureCount;
+
+namespace {
+
+/** Keeps track of the number of sends in progress, so that the socket is
+ * not closed under them.
+ */
+class SendInFlight {
+public:
+  explicit SendInFlight(std::atomic<unsigned>& counter)
+    : counter_(counter)
+  { ++counter_; }
+  
+  ~SendInFlight() { --counter_; }
+  
+private:
+  std::atomic<unsigned>& counter_;
+  
+  SendInFlight(const SendInFlight&) = delete;
+  SendInFlight& operator=(const SendInFlight&) = delete;
+};
+
+/** Returns the mask with a bit for each of the first \p count
+ * destinations.
+ */
+UInt32 DestinationMask(size_t count) {
+  return count >= 32 ? ~UInt32{0} : (UInt32{1} << count) - 1;
+}
+
+}
+
+Transport::Transport(asio::io_service& ioService,
+                     UInt32 deviceID,
+                     const DeviceConfiguration& configuration,
+                     DeviceMetrics& metrics)
+  : ioService_(ioService)
+  , deviceID_(deviceID)
+  , policy_(configuration.overloadPolicy)
+  , sendBufferSize_(configuration.sendBufferSize)
+  , metrics_(metrics)
+  , linkOwner_(OpenLink(MakeEndpoints(configuration.destinations)))
+{
+  link_ = linkOwner_.get();
+  TransportSupervisor::GetInstance().Register(*this);
+}
+
+Transport::~Transport() {
+  TransportSupervisor::GetInstance().Unregister(*this);
+}
+
+Transport::EndpointList
+Transport::MakeEndpoints(const std::vector<Destination>& destinations) {
+  if (destinations.empty() || destinations.size() > maxDestinations)
+    throw OSException("invalid number of destinations",
+                      kAudioHardwareIllegalOperationError);
+  
+  EndpointList endpoints;
+  for (const auto& destination : destinations) {
+    endpoints.emplace_back(asio::ip::make_address(destination.address),
+                           destination.port);
+    if (endpoints.back().protocol() != endpoints.front().protocol())
+      throw OSException("destinations of different address families",
+                        kAudioHardwareIllegalOperationError);
+  }
+  return endpoints;
+}
+
+std::unique_ptr<Transport::Link> Transport::OpenLink(EndpointList endpoints) {
+  auto link = std::make_unique<Link>();
+  const auto protocol = endpoints.front().protocol();
+  link->socket = std::make_shared<asio::ip::udp::socket>(ioService_, protocol);
+  link->socket->non_blocking(true);
+  if (sendBufferSize_ > 0)
+    link->socket->set_option(asio::socket_base::send_buffer_size(sendBufferSize_));
+  if (std::any_of(begin(endpoints), end(endpoints),
+                  [](const asio::ip::udp::endpoint& endpoint) {
+                    return endpoint.address().is_multicast();
+                  }))
+    link->socket->set_option(asio::ip::multicast::hops(1));
+  link->endpoints = std::move(endpoints);
+  return link;
+}
+
+void Transport::SwapLink(std::unique_ptr<Link> link) {
+  // Sends starting from now on use the new link; wait for those that were
+  // already using the old one.
+  link_.exchange(link.get());
+  while (sendsInFlight_ > 0)
+    std::this_thread::yield();
+  
+  linkOwner_.swap(link);
+}
+
+void Transport::Rebuild() {
+  std::lock_guard<std::mutex> lock(linkMutex_);
+  SwapLink(OpenLink(linkOwner_->endpoints));
+  consecutiveFailures_.store(0, std::memory_order_relaxed);
+  Metrics::Add(metrics_.socketRebuilds);
+}
+
+void Transport::SetDestinations(const std::vector<Destination>& destinations) {
+  auto endpoints = MakeEndpoints(destinations);
+  
+  std::lock_guard<std::mutex> lock(linkMutex_);
+  // Keep the socket unless the address family changes. Datagrams queued for
+  // the old destinations go to the new ones with the same index.
+  if (endpoints.front().protocol() != linkOwner_->endpoints.front().protocol()) {
+    SwapLink(OpenLink(std::move(endpoints)));
+    return;
+  }
+  
+  
+  // The old link is not modified, since sends may be using it: the new one
+  // shares its socket.
+  auto link = std::make_unique<Link>();
+  link->socket = linkOwner_->socket;
+  link->endpoints = std::move(endpoints);
+  SwapLink(std::move(link));
+}
+
+void Transport::Flush() noexcept {
+  while (backlogCount_ > 0) {
+    auto& packet = backlog_[backlogHead_];
+    boost::system::error_code error;
+    packet.pendingDestinations = SendNow(asio::buffer(packet.data.data(),
+                                                      packet.size),
+                                         packet.pendingDestinations,
+                                         error,
+                                         packet.captured);
+    if (packet.pendingDestinations != 0)
+      return;
+    
+    // Sent, or failed for good: either way it leaves the queue.
+    backlogHead_ = (backlogHead_ + 1) % backlogCapacity;
+    backlogCount_--;
+  }
+}
+
+Transport::SendResult
+Transport::Send(const std::array<asio::const_buffer, 2>& buffers,
+                boost::system::error_code& error) noexcept {
+  error.clear();
+  
+  // Keep the order: nothing new goes out before the backlog is empty.
+  if (backlogCount_ > 0) {
+    Enqueue(buffers, ~UInt32{0}, false);
+    return SendResult::Queued;
+  }
+  
+  bool captured = false;
+  auto blocked = SendNow(buffers, ~UInt32{0}, error, captured);
+  const bool failed = static_cast<bool>(error);
+  auto result = failed ? SendResult::Failed : SendResult::Sent;
+  if (blocked == 0)
+    return result;
+  
+  // Only the destinations that could not take it get it later.
+  if (policy_ == OverloadPolicy::DropOldest) {
+    Enqueue(buffers, blocked, captured);
+    return failed ? result : SendResult::Queued;
+  }
+  
+  Metrics::Add(metrics_.packetsDropped);
+  return failed ? result : SendResult::Dropped;
+}
+
+template<typename ConstBufferSequence>
+UInt32 Transport::SendNow(const ConstBufferSequence& buffers,
+                          UInt32 destinations,
+                          boost::system::error_code& error,
+                          bool& captured) noexcept {
+  SendInFlight sendInFlight(sendsInFlight_);
+  const auto& link = *link_.load();
+  destinations &= DestinationMask(link.endpoints.size());
+  
+  // The same buffers go to every destination: the cycle is encoded once.
+  UInt32 blocked = 0;
+  for (size_t i = 0; i < link.endpoints.size(); i++) {
+    if ((destinations & (UInt32{1} << i)) == 0)
+      continue;
+    
+    boost::system::error_code sendError;
+    auto start = mach_absolute_time();
+    auto bytes = link.socket->send_to(buffers, link.endpoints[i], 0, sendError);
+    Metrics::Record(metrics_.sendDuration, mach_absolute_time() - start);
+    
+    if (!sendError) {
+      Metrics::Add(metrics_.packetsSent);
+      Metrics::Add(metrics_.bytesSent, bytes);
+      consecutiveFailures_.store(0, std::memory_order_relaxed);
+      if (!captured) {
+        CaptureWriter::GetInstance().Capture(deviceID_, buffers);
+        captured = true;
+      }
+    } else if (sendError == asio::error::would_block) {
+      Metrics::Add(metrics_.sendWouldBlock);
+      blocked |= UInt32{1} << i;
+    } else {
+      Metrics::Add(metrics_.sendErrors);
+      consecutiveFailures_.fetch_add(1, std::memory_order_relaxed);
+      if (!error)
+        error = sendError;
+    }
+  }
+  return blocked;
+}
+
+void Transport::Enqueue(const std::array<asio::const_buffer, 2>& buffers,
+                        UInt32 destinations,
+                        bool captured) noexcept {
+  if (backlogCount_ == backlogCapacity) {
+    backlogHead_ = (backlogHead_ + 1) % backlogCapacity;
+    backlogCount_--;
+    Metrics::Add(metrics_.packetsDropped);
+  }
+  
+  auto& packet = backlog_[(backlogHead_ + backlogCount_) % backlogCapacity];
+  packet.pendingDestinations = destinations;
+  packet.captured = captured;
+  packet.size = asio::buffer_copy(asio::buffer(packet.data), buffers);
+  backlogCount_++;
+}
@@ -0,0 +1,207 @@
+#ifndef Transport_h
+#define Transport_h
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "DeviceConfiguration.h"
+#include "MetricsFormat.h"
+#include "Packetizer.h"
+
+/** Sends the datagrams of a device to its receivers.
+ *
+ * Every datagram is sent to all the destinations of the device from the
+ * same buffers (the IO cycle is packetized only once), through a single
+ * non-blocking socket, so a full send buffer never stalls the IO thread.
+ * Datagrams that do not fit are handled according to the overload policy
+ * of the device; every drop is counted in the metrics rather than reported
+ * to the HAL.
+ *
+ * The socket and the destinations can be replaced from another thread
+ * (see TransportSupervisor and SetDestinations()) while the IO thread keeps
+ * sending: the new ones are swapped in atomically and the old socket is
+ * closed once no send uses it anymore.
+ *
+ * Every datagram is also handed to the CaptureWriter the first time it
+ * reaches a destination.
+ */
+class Transport {
+public:
+  /** Outcome of sending a datagram. */
+  enum class SendResult {
+    /** Sent to every destination. */
+    Sent,
+    /** The send buffer was full; the datagram will be sent later. */
+    Queued,
+    /** The send buffer was full; the datagram was dropped. */
+    Dropped,
+    /** The datagram could not be sent to some destination because of an
+     * error.
+     */
+    Failed,
+  };
+  
+  /** Number of datagrams kept for later by OverloadPolicy::DropOldest. */
+  static constexpr unsigned backlogCapacity { 64 };
+  
+  /** Maximum number of destinations of a device. */
+  static constexpr unsigned maxDestinations { 16 };
+  
+  /** Number of consecutive failed sends after which the socket is
+   * considered broken.
+   */
+  static constexpr unsigned persistentFailureCount { 50 };
+  
+  /** Creates the socket.
+   *
+   * @param ioService The IO service the socket is attached to.
+   * @param deviceID The device the datagrams come from, in captures.
+   * @param configuration The settings of the device.
+   * @param metrics Where sends and drops are counted.
+   * @note An exception is thrown if the destinations are not valid.
+   */
+  Transport(boost::asio::io_service& ioService,
+            UInt32 deviceID,
+            const DeviceConfiguration& configuration,
+            DeviceMetrics& metrics);
+  
+  ~Transport();
+  
+  Transport(const Transport&) = delete;
+  Transport& operator=(const Transport&) = delete;
+  
+  /** Sends the datagrams queued in previous cycles. Called at the start of
+   * every IO cycle.
+   *
+   * Flush() and Send() share the backlog: they must be called from the IO
+   * thread, or from a thread that keeps it out of the output path (see
+   * Device::DrainOutput()).
+   */
+  void Flush() noexcept;
+  
+  /** Sends an audio datagram from the IO thread.
+   *
+   * @param buffers The header and the payload of the datagram.
+   * @param error Set to the error of a failed send, if the result is
+   *        SendResult::Failed.
+   */
+  SendResult Send(const std::array<boost::asio::const_buffer, 2>& buffers,
+                  boost::system::error_code& error) noexcept;
+  
+  /** Sends an audio datagram from the IO thread, ignoring the error of a
+   * failed send.
+   */
+  SendResult Send(const std::array<boost::asio::const_buffer, 2>& buffers) noexcept {
+    boost::system::error_code error;
+    return Send(buffers, error);
+  }
+  
+  /** Returns whether sends have been failing for a while. */
+  bool IsFailing() const {
+    return consecutiveFailures_.load(std::memory_order_relaxed)
+        >= persistentFailureCount;
+  }
+  
+  /** Replaces the socket with a new one. Must not be called from the IO
+   * thread; waits for the sends in progress on the old socket to finish.
+   *
+   * @note An exception is thrown if the new socket cannot be created, in
+   *       which case the old one is kept.
+   */
+  void Rebuild();
+  
+  /** Replaces the destinations. Must not be called from the IO thread.
+   *
+   * @note An exception is thrown if the destinations are not valid, in
+   *       which case the old ones are kept.
+   */
+  void SetDestinations(const std::vector<Destination>& destinations);
+  
+private:
+  typedef std::vector<boost::asio::ip::udp::endpoint> EndpointList;
+  
+  /** A socket and the destinations it sends to, replaced as a whole. */
+  struct Link {
+    /** Shared with the next link when only the destinations change. */
+    std::shared_ptr<boost::asio::ip::udp::socket> socket;
+    EndpointList endpoints;
+  };
+  
+  /** A datagram waiting in the backlog. */
+  struct QueuedPacket {
+    /** Destinations (by index) it has not been sent to yet. */
+    UInt32 pendingDestinations;
+    /** Whether it reached some destination, and so was captured. */
+    bool captured;
+    size_t size;
+    std::array<UInt8, Packetizer::maxDatagramSize> data;
+  };
+  
+  /** Resolves and checks a list of destinations. */
+  static EndpointList MakeEndpoints(const std::vector<Destination>& destinations);
+  
+  /** Creates a socket with the options of the device for the given
+   * destinations.
+   */
+  std::unique_ptr<Link> OpenLink(EndpointList endpoints);
+  
+  /** Makes a new link the one sends go through and closes the old one.
+   * Requires linkMutex_.
+   */
+  void SwapLink(std::unique_ptr<Link> link);
+  
+  /** Sends a datagram to some destinations and updates the metrics.
+   *
+   * @param destinations The destinations to send to, by index.
+   * @param error Set to the error of the first destination the send failed
+   *        to, if any. Returned rather than stored, since sends happen on
+   *        the IO thread and on the threads sending control datagrams.
+   * @param captured Whether the datagram is in the capture already; set
+   *        when it is sent to some destination for the first time.
+   * @return The destinations whose send buffer was full.
+   */
+  template<typename ConstBufferSequence>
+  UInt32 SendNow(const ConstBufferSequence& buffers,
+                 UInt32 destinations,
+                 boost::system::error_code& error,
+                 bool& captured) noexcept;
+  
+  /** Copies a datagram to the backlog, dropping the oldest one if full. */
+  void Enqueue(const std::array<boost::asio::const_buffer, 2>& buffers,
+               UInt32 destinations,
+               bool captured) noexcept;
+  
+  boost::asio::io_service& ioService_;
+  const UInt32 deviceID_;
+  const OverloadPolicy policy_;
+  const int sendBufferSize_;
+  DeviceMetrics& metrics_;
+  
+  /** The link sends go through. Only SwapLink() changes it. */
+  std::atomic<Link*> link_ { nullptr };
+  
+  /** Owns link_. */
+  std::unique_ptr<Link> linkOwner_;
+  
+  /** Serializes the changes of link_. */
+  std::mutex linkMutex_;
+  
+  /** Number of sends in progress; SwapLink() waits for them to finish
+   * before closing the old socket.
+   */
+  std::atomic<unsigned> sendsInFlight_ { 0 };
+  
+  std::atomic<unsigned> consecutiveFailures_ { 0 };
+  
+  /** Circular queue of datagrams (only used by OverloadPolicy::DropOldest). */
+  std::array<QueuedPacket, backlogCapacity> backlog_;
+  unsigned backlogHead_ { 0 };
+  unsigned backlogCount_ { 0 };
+};
+
+#endif /* Transport_h */
@@ -0,0 +1,99 @@
+#include "TransportSupervisor.h"
+
+#include <thread>
+
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netdb.h>
+
+#include "log.h"
+#include "Transport.h"
+
+constexpr std::chrono::seconds TransportSupervisor::checkInterval;
+
+TransportSupervisor& TransportSupervisor::GetInstance() {
+  // Never destroyed: the devices, and so the transports, are owned by the
+  // plug-in instance, which outlives function-local statics.
+  static auto supervisor = new TransportSupervisor;
+  return *supervisor;
+}
+
+TransportSupervisor::TransportSupervisor()
+  : interfaceAddresses_(InterfaceAddresses())
+{
+  std::thread(&TransportSupervisor::Run, this).detach();
+}
+
+void TransportSupervisor::Register(Transport& transport) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  transports_.insert(&transport);
+}
+
+void TransportSupervisor::Unregister(Transport& transport) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  transports_.erase(&transport);
+}
+
+void TransportSupervisor::Run() {
+  for (;;) {
+    std::this_thread::sleep_for(checkInterval);
+    try {
+      Check();
+    } catch (const std::exception& e) {
+      LOG(Network, Error,
+          boost::format("TransportSupervisor: %1%") % e.what());
+    }
+  }
+}
+
+void TransportSupervisor::Check() {
+  auto addresses = InterfaceAddresses();
+  bool networkChanged = addresses != interfaceAddresses_;
+  if (networkChanged) {
+    LOG(Network, Info, "Network interfaces changed, rebuilding the sockets");
+    interfaceAddresses_ = std::move(addresses);
+  }
+  
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto transport : transports_) {
+    if (!networkChanged && !transport->IsFailing())
+      continue;
+    
+    if (!networkChanged)
+      LOG(Network, Warning, "Sends keep failing, rebuilding the socket");
+    
+    try {
+      transport->Rebuild();
+    } catch (const std::exception& e) {
+      // The old socket is kept; try again at the next check.
+      LOG(Network, Error,
+          boost::format("Cannot rebuild the socket: %1%") % e.what());
+    }
+  }
+}
+
+std::set<std::string> TransportSupervisor::InterfaceAddresses() {
+  std::set<std::string> addresses;
+  
+  ifaddrs* interfaces;
+  if (getifaddrs(&interfaces) != 0)
+    return addresses;
+  
+  for (auto i = interfaces; i != nullptr; i = i->ifa_next) {
+    if (i->ifa_addr == nullptr || (i->ifa_flags & IFF_UP) == 0)
+      continue;
+    
+    auto family = i->ifa_addr->sa_family;
+    if (family != AF_INET && family != AF_INET6)
+      continue;
+    
+    char host[NI_MAXHOST];
+    auto length = family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+    if (getnameinfo(i->ifa_addr, static_cast<socklen_t>(length),
+                    host, sizeof(host), nullptr, 0, NI_NUMERICHOST) == 0)
+      addresses.insert(std::string(i->ifa_name) + "/" + host);
+  }
+  
+  freeifaddrs(interfaces);
+  return addresses;
+}
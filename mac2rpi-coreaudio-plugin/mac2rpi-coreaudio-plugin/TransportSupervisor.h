@@ -0,0 +1,56 @@
+#ifndef TransportSupervisor_h
+#define TransportSupervisor_h
+
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+
+class Transport;
+
+/** Rebuilds the sockets of the devices when the network changes.
+ *
+ * After Wi-Fi roaming, sleep/wake or an interface change, a socket may keep
+ * failing until it is recreated. A background thread periodically looks
+ * for changes in the addresses of the network interfaces and for transports
+ * whose sends have been failing, and rebuilds their sockets. All of it
+ * happens off the IO thread, which never waits for it.
+ */
+class TransportSupervisor {
+public:
+  /** How often the interfaces and the transports are checked. */
+  static constexpr std::chrono::seconds checkInterval { 1 };
+  
+  /** Returns the only instance of this class. */
+  static TransportSupervisor& GetInstance();
+  
+  TransportSupervisor(const TransportSupervisor&) = delete;
+  TransportSupervisor& operator=(const TransportSupervisor&) = delete;
+  
+  /** Starts watching a transport. */
+  void Register(Transport& transport);
+  
+  /** Stops watching a transport. When this returns, the transport is not
+   * being rebuilt and will not be anymore.
+   */
+  void Unregister(Transport& transport);
+  
+private:
+  TransportSupervisor();
+  
+  void Run();
+  
+  /** Checks the network and the transports once. */
+  void Check();
+  
+  /** Returns the addresses of the network interfaces that are up, as
+   * "interface/address" strings.
+   */
+  static std::set<std::string> InterfaceAddresses();
+  
+  std::mutex mutex_;
+  std::set<Transport*> transports_;
+  std::set<std::string> interfaceAddresses_;
+};
+
+#endif /* TransportSupervisor_h */
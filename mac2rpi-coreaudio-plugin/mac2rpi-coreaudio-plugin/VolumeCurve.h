@@ -0,0 +1,33 @@
+#ifndef VolumeCurve_h
+#define VolumeCurve_h
+
+#include <algorithm>
+#include <cmath>
+
+/* Also built into the benchmarks in tools/, so only standard types are
+ * used here.
+ */
+
+/** Range of the volume control, in decibels. */
+constexpr float kVolumeMinDB { -96.0f };
+constexpr float kVolumeMaxDB { 6.0f };
+
+/** Converts a scalar volume (0 to 1) to decibels. The volume curve is
+ * quadratic, and out of range values are clamped.
+ */
+inline float ScalarToDecibels(float scalar) {
+  scalar = std::max(scalar, 0.0f);
+  scalar = std::min(scalar, 1.0f);
+  return kVolumeMinDB + scalar * scalar * (kVolumeMaxDB - kVolumeMinDB);
+}
+
+/** Converts decibels to a scalar volume (0 to 1). Inverse of
+ * ScalarToDecibels().
+ */
+inline float DecibelsToScalar(float decibels) {
+  decibels = std::max(decibels, kVolumeMinDB);
+  decibels = std::min(decibels, kVolumeMaxDB);
+  return std::sqrt((decibels - kVolumeMinDB) / (kVolumeMaxDB - kVolumeMinDB));
+}
+
+#endif /* VolumeCurve_h */
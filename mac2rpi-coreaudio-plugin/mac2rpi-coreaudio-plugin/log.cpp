@@ -1,12 +1,123 @@
 #include "log.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "types.h"
 
+namespace {
+  /** Text and number of arguments of a real-time message. */
+  struct LogMessageFormat {
+    const char* format;
+    unsigned argCount;
+  };
+
+  /** Indexed by LogMessageID. */
+  const LogMessageFormat logMessageFormats[] = {
+    { "DoIOOperation: deviceObjectID=%1% operationID=%2%", 2 },
+    { "WriteOutputData: ioBufferFrameSize=%1% sampleTime=%2%", 2 },
+    { "### WriteOutputData: %1% packets not sent (error %2%)", 2 },
+    { "Output suspended after %1% silent frames, at sample time %2%", 2 },
+    { "Output resumed at sample time %1%", 1 },
+  };
+
+  /** Drains the real-time log ring from a background thread. */
+  class LogWriter {
+  public:
+    LogWriter()
+    : thread_{&LogWriter::Run, this}
+    {}
+
+    ~LogWriter() {
+      running_ = false;
+      thread_.join();
+    }
+
+    LogRing& Ring() { return ring_; }
+
+    void SetFile(const char* path) {
+      std::lock_guard<std::mutex> lock(fileMutex_);
+      if (file_ != nullptr)
+        std::fclose(file_);
+      file_ = nullptr;
+      if (path == nullptr)
+        return;
+      // Never follows a symbolic link planted at the path of the file.
+      auto fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_NOFOLLOW, 0644);
+      if (fd >= 0 && (file_ = fdopen(fd, "a")) == nullptr)
+        close(fd);
+    }
+
+    void Write(const std::string& s) {
+      std::lock_guard<std::mutex> lock(fileMutex_);
+      if (file_ != nullptr) {
+        std::fprintf(file_, "%s\n", s.c_str());
+        std::fflush(file_);
+      } else {
+        syslog(LOG_NOTICE, "%s", s.c_str());
+      }
+    }
+
+  private:
+    /** How long the thread sleeps when the ring is empty. */
+    static constexpr std::chrono::milliseconds pollInterval { 20 };
+
+    void Run() {
+      while (running_) {
+        Drain();
+        std::this_thread::sleep_for(pollInterval);
+      }
+      Drain();
+    }
+
+    void Drain() {
+      LogRecord record;
+      while (ring_.Pop(record)) {
+        try {
+          const auto& message
+              = logMessageFormats[static_cast<size_t>(record.id)];
+          boost::format fmt(message.format);
+          for (unsigned i = 0; i < message.argCount; i++)
+            fmt % record.args[i];
+          Write(boost::str(fmt));
+        } catch (...) {}
+      }
+
+      if (auto dropped = ring_.TakeDroppedCount())
+        Write(boost::str(boost::format("### log ring full, %1% messages dropped")
+                         % dropped));
+    }
+
+    LogRing ring_;
+    std::mutex fileMutex_;
+    FILE* file_ { nullptr };
+    std::atomic<bool> running_ { true };
+    std::thread thread_;
+  };
+
+  constexpr std::chrono::milliseconds LogWriter::pollInterval;
+
+  LogWriter& Writer() {
+    static LogWriter writer;
+    return writer;
+  }
+
+  /** Starts the writer thread when the plug-in is loaded, rather than on the
+   * first call to logRealTime() from the IO thread.
+   */
+  LogWriter& writerAtLoad = Writer();
+}
+
 void log(const std::string& s) noexcept {
   try {
-    syslog(LOG_NOTICE, "%s", s.c_str());
+    Writer().Write(s);
   } catch (...) {}
 }
 
@@ -16,18 +127,33 @@ void log(const boost::format& fmt) noexcept {
   } catch (...) {}
 }
 
+std::atomic<LogLevel> logThresholds[static_cast<unsigned>(LogCategory::Count)] {
+  { LogLevel::Info },
+  { LogLevel::Info },
+  { LogLevel::Info },
+  { LogLevel::Info },
+  { LogLevel::Info },
+};
+
+void setLogLevel(LogCategory category, LogLevel level) noexcept {
+  logThresholds[static_cast<unsigned>(category)]
+      .store(level, std::memory_order_relaxed);
+}
+
+void logRealTime(LogMessageID id, UInt64 arg0, UInt64 arg1) noexcept {
+  writerAtLoad.Ring().Push(LogRecord{ id, { arg0, arg1 } });
+}
+
+void setLogFile(const char* path) noexcept {
+  try {
+    Writer().SetFile(path);
+  } catch (...) {}
+}
+
 std::string ObjectIDToString(AudioObjectID objectID) {
   switch (objectID) {
     case kObjectID_PlugIn:
       return "plugin";
-    case kObjectID_Device:
-      return "device";
-    case kObjectID_Stream_Output:
-      return "stream_output";
-    case kObjectID_Volume_Output_Master:
-      return "volume_output_master";
-    case kObjectID_Mute_Output_Master:
-      return "mute_output_master";
     case kAudioObjectPropertyBaseClass:
       return "base_class";
     case kAudioObjectPropertyClass:
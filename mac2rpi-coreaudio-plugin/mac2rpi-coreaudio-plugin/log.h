@@ -1,35 +1,146 @@
 #ifndef log_h
 #define log_h
 
-// TODO remove
-#define DEBUG 1
-
-#ifdef DEBUG
-  #include <string>
-  #include <boost/format.hpp>
-  #include <CoreAudio/AudioDriverPlugIn.h>
-
-  /** Logs a message in the system log.
-   *
-   * @param s The string containing the message.
-   */
-  void log(const std::string& s) noexcept;
-
-  /** Logs a message in the system log.
-   *
-   * @param fmt The formatting object containing the message.
-   */
-  void log(const boost::format& fmt) noexcept;
-
-  std::string ObjectIDToString(AudioObjectID objectID);
-  std::string PluginPropertyToString(AudioObjectID objectID);
-  std::string DevicePropertyToString(AudioObjectID objectID);
-  std::string StreamPropertyToString(AudioObjectID objectID);
-  std::string ControlPropertyToString(AudioObjectID objectID);
-
-  #define LOG(x) log(x)
-#else
-  #define LOG(x) do {} while (false)
+#include <atomic>
+#include <string>
+
+#include <boost/format.hpp>
+#include <CoreAudio/AudioDriverPlugIn.h>
+
+#include "LogRing.h"
+
+/** Subsystem a message belongs to. */
+enum class LogCategory : unsigned {
+  /** Property queries and changes from the host. */
+  Property,
+  /** IO cycles. */
+  IO,
+  /** Clock and time stamps. */
+  Timing,
+  /** Sockets and packets. */
+  Network,
+  /** Plug-in life cycle, devices, configuration changes and controls. */
+  Control,
+  Count
+};
+
+enum class LogLevel : unsigned {
+  Trace,
+  Debug,
+  Info,
+  Warning,
+  Error,
+  Off
+};
+
+/* Minimum level compiled in, per category. Messages below it generate no
+ * code at all. Override them from the build settings, e.g.
+ * LOG_MIN_LEVEL_PROPERTY=4 to keep only the property errors.
+ */
+#ifndef LOG_MIN_LEVEL
+  #ifdef DEBUG
+    #define LOG_MIN_LEVEL 0
+  #else
+    #define LOG_MIN_LEVEL 3
+  #endif
+#endif
+#ifndef LOG_MIN_LEVEL_PROPERTY
+  #define LOG_MIN_LEVEL_PROPERTY LOG_MIN_LEVEL
 #endif
+#ifndef LOG_MIN_LEVEL_IO
+  #define LOG_MIN_LEVEL_IO LOG_MIN_LEVEL
+#endif
+#ifndef LOG_MIN_LEVEL_TIMING
+  #define LOG_MIN_LEVEL_TIMING LOG_MIN_LEVEL
+#endif
+#ifndef LOG_MIN_LEVEL_NETWORK
+  #define LOG_MIN_LEVEL_NETWORK LOG_MIN_LEVEL
+#endif
+#ifndef LOG_MIN_LEVEL_CONTROL
+  #define LOG_MIN_LEVEL_CONTROL LOG_MIN_LEVEL
+#endif
+
+/** Returns whether messages of a category and level are compiled in. */
+constexpr bool logCompiledIn(LogCategory category, LogLevel level) {
+  return static_cast<unsigned>(level) >=
+      (category == LogCategory::Property ? LOG_MIN_LEVEL_PROPERTY
+       : category == LogCategory::IO ? LOG_MIN_LEVEL_IO
+       : category == LogCategory::Timing ? LOG_MIN_LEVEL_TIMING
+       : category == LogCategory::Network ? LOG_MIN_LEVEL_NETWORK
+       : LOG_MIN_LEVEL_CONTROL);
+}
+
+/** Minimum level logged at run time, indexed by category. */
+extern std::atomic<LogLevel>
+    logThresholds[static_cast<unsigned>(LogCategory::Count)];
+
+/** Returns whether messages of a category and level are currently logged. */
+inline bool logEnabled(LogCategory category, LogLevel level) noexcept {
+  return level >= logThresholds[static_cast<unsigned>(category)]
+      .load(std::memory_order_relaxed);
+}
+
+/** Sets the minimum level logged at run time for a category. Levels below
+ * the compile-time minimum stay disabled.
+ */
+void setLogLevel(LogCategory category, LogLevel level) noexcept;
+
+/** Logs a message in the system log.
+ *
+ * @param s The string containing the message.
+ */
+void log(const std::string& s) noexcept;
+
+/** Logs a message in the system log.
+ *
+ * @param fmt The formatting object containing the message.
+ */
+void log(const boost::format& fmt) noexcept;
+
+/** Logs a message from the real-time IO thread.
+ *
+ * Only the message ID and the arguments are queued; a background thread
+ * formats the message and writes it out. Never blocks nor allocates, so
+ * it is safe to call on every IO cycle.
+ *
+ * @param id The message to log.
+ * @param arg0 First argument of the message, if any.
+ * @param arg1 Second argument of the message, if any.
+ */
+void logRealTime(LogMessageID id, UInt64 arg0 = 0, UInt64 arg1 = 0) noexcept;
+
+/** Sends the log to a file instead of the system log.
+ *
+ * @param path The file the messages are appended to, or nullptr to go back
+ *        to the system log.
+ */
+void setLogFile(const char* path) noexcept;
+
+std::string ObjectIDToString(AudioObjectID objectID);
+std::string PluginPropertyToString(AudioObjectID objectID);
+std::string DevicePropertyToString(AudioObjectID objectID);
+std::string StreamPropertyToString(AudioObjectID objectID);
+std::string ControlPropertyToString(AudioObjectID objectID);
+
+/** Logs a message of the given category and level, e.g.
+ * LOG(Property, Trace, boost::format("...") % x). The message is only built
+ * when it is actually logged.
+ */
+#define LOG(category, level, x) \
+  do { \
+    if (logCompiledIn(LogCategory::category, LogLevel::level) \
+        && logEnabled(LogCategory::category, LogLevel::level)) \
+      log(x); \
+  } while (false)
+
+/** Real-time safe counterpart of LOG(), taking a LogMessageID and up to two
+ * integer arguments.
+ */
+#define LOG_RT(category, level, ...) \
+  do { \
+    if (logCompiledIn(LogCategory::category, LogLevel::level) \
+        && logEnabled(LogCategory::category, LogLevel::level)) \
+      logRealTime(__VA_ARGS__); \
+  } while (false)
 
 #endif /* log_h */
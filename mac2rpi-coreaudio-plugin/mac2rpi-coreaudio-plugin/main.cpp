@@ -3,6 +3,7 @@
 #include "log.h"
 #include "OSException.h"
 #include "PlugIn.h"
+#include "RunningDevices.h"
 #include "types.h"
 
 static AudioServerPlugInDriverInterface	gDriverInterface =
@@ -40,6 +41,33 @@ static AudioServerPlugInDriverRef
 
 static std::atomic<UInt32> gDriverRefCount{1};
 
+/** Finds a device based on the given ID.
+ *
+ * @param deviceObjectID Object identifier of the device.
+ * @return The device instance associated with the given identifier.
+ * @note An exception is thrown if the object ID does not belong to a device.
+ */
+static std::shared_ptr<Device> FindDevice(AudioObjectID deviceObjectID) {
+  auto device = std::dynamic_pointer_cast<Device>
+      (AudioObjectMap::FindObject(deviceObjectID));
+  if (!device)
+    throw OSException("invalid device ID", kAudioHardwareBadDeviceError);
+  return device;
+}
+
+/** Finds a device from an IO callback, without locking or allocating.
+ *
+ * @param deviceObjectID Object identifier of the device.
+ * @return The device instance, which stays alive until IO stops.
+ * @note An exception is thrown if IO is not running on the device.
+ */
+static Device& FindRunningDevice(AudioObjectID deviceObjectID) {
+  auto device = RunningDevices::Find(deviceObjectID);
+  if (device == nullptr)
+    throw OSException("IO is not running", kAudioHardwareNotRunningError);
+  return *device;
+}
+
 void* CreatePlugIn(CFAllocatorRef allocator,
                    CFUUIDRef requestedTypeUUID) {
 #pragma unused(allocator)
@@ -47,11 +75,11 @@ void* CreatePlugIn(CFAllocatorRef allocator,
   try {
     if (CFEqual(requestedTypeUUID, kAudioServerPlugInTypeUUID)) {
       PlugIn::GetInstance();
-      LOG("Plug-in was successfully created");
+      LOG(Control, Info, "Plug-in was successfully created");
       return gDriverInterfaceRef;
     }
   } catch (...) {
-    LOG("error creating the plug-in");
+    LOG(Control, Error, "error creating the plug-in");
   }
   
   return nullptr;
@@ -83,10 +111,10 @@ static HRESULT QueryInterface(void* driver,
     
     ++gDriverRefCount;
     *interface = gDriverInterfaceRef;
-    LOG("Returning driver interface");
+    LOG(Control, Debug, "Returning driver interface");
     return S_OK;
   } catch (const OSException& e) {
-    LOG(boost::format("QueryInterface: %1%") % e.what());
+    LOG(Control, Error, boost::format("QueryInterface: %1%") % e.what());
     return e.status();
   } catch (...) {
     return kAudioHardwareUnspecifiedError;
@@ -102,10 +130,11 @@ static ULONG AddRef(void* driver) {
       throw OSException("out of references");
   
     ++gDriverRefCount;
-    LOG(boost::format("AddRef: #references=%1%") % gDriverRefCount);
+    LOG(Control, Debug,
+        boost::format("AddRef: #references=%1%") % gDriverRefCount);
     return gDriverRefCount;
   } catch (const OSException& e) {
-    LOG(boost::format("AddRef: %1%") % e.what());
+    LOG(Control, Error, boost::format("AddRef: %1%") % e.what());
   } catch (...) {}
 
   return 0;
@@ -120,10 +149,11 @@ static ULONG Release(void* driver) {
       throw OSException("too many releases");
     
     --gDriverRefCount;
-    LOG(boost::format("Release: #references=%1%") % gDriverRefCount);
+    LOG(Control, Debug,
+        boost::format("Release: #references=%1%") % gDriverRefCount);
     return gDriverRefCount;
   } catch (const OSException& e) {
-    LOG(boost::format("Release: %1%") % e.what());
+    LOG(Control, Error, boost::format("Release: %1%") % e.what());
   } catch (...) {}
   
   return 0;
@@ -132,17 +162,15 @@ static ULONG Release(void* driver) {
 static OSStatus Initialize(AudioServerPlugInDriverRef driver,
                            AudioServerPlugInHostRef host) {
   try {
-    LOG("Initializing mac2rpi");
+    LOG(Control, Info, "Initializing mac2rpi");
     
     if (driver != gDriverInterfaceRef)
       throw OSException("bad driver reference");
 
     PlugIn::GetInstance().SetHost(host);
-    auto& device = static_cast<Device&>(AudioObjectMap::FindObject(kObjectID_Device));
-    device.ComputeHostTicksPerFrame();
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("Release: %1%") % e.what());
+    LOG(Control, Error, boost::format("Release: %1%") % e.what());
     return e.status();
   } catch (...) {
     return kAudioHardwareUnspecifiedError;
@@ -186,9 +214,27 @@ PerformDeviceConfigurationChange(AudioServerPlugInDriverRef driver,
                                  AudioObjectID deviceObjectID,
                                  UInt64 changeAction,
                                  void* change_info) {
-  LOG("####### PerformDeviceConfigurationChange");
-  // TODO
-  return 0;
+#pragma unused(change_info)
+  
+  try {
+    if (driver != gDriverInterfaceRef)
+      throw OSException("bad driver reference",
+                        kAudioHardwareBadObjectError);
+    
+    LOG(Control, Info,
+        boost::format("PerformDeviceConfigurationChange: changeAction=%1%")
+        % changeAction);
+    
+    auto device = FindDevice(deviceObjectID);
+    device->PerformConfigurationChange(changeAction);
+    return 0;
+  } catch (const OSException& e) {
+    LOG(Control, Error,
+        boost::format("PerformDeviceConfigurationChange: %s") % e.what());
+    return e.status();
+  } catch (...) {
+    return kAudioHardwareUnspecifiedError;
+  }
 }
 
 static OSStatus
@@ -196,9 +242,27 @@ AbortDeviceConfigurationChange(AudioServerPlugInDriverRef driver,
                                AudioObjectID deviceObjectID,
                                UInt64 changeAction,
                                void* change_info) {
-  LOG("####### AbortDeviceConfigurationChange");
-  // TODO
-  return 0;
+#pragma unused(change_info)
+  
+  try {
+    if (driver != gDriverInterfaceRef)
+      throw OSException("bad driver reference",
+                        kAudioHardwareBadObjectError);
+    
+    LOG(Control, Info,
+        boost::format("AbortDeviceConfigurationChange: changeAction=%1%")
+        % changeAction);
+    
+    auto device = FindDevice(deviceObjectID);
+    device->AbortConfigurationChange(changeAction);
+    return 0;
+  } catch (const OSException& e) {
+    LOG(Control, Error,
+        boost::format("AbortDeviceConfigurationChange: %s") % e.what());
+    return e.status();
+  } catch (...) {
+    return kAudioHardwareUnspecifiedError;
+  }
 }
 
 #pragma mark Property Operations
@@ -213,10 +277,10 @@ static Boolean HasProperty(AudioServerPlugInDriverRef driver,
     if (address == nullptr)
       throw OSException("no address");
         
-    auto& object = AudioObjectMap::FindObject(objectID);
-    return object.HasProperty(clientProcessID, *address);
+    auto object = AudioObjectMap::FindObject(objectID);
+    return object->HasProperty(clientProcessID, *address);
   } catch (const OSException& e) {
-    LOG(boost::format("HasProperty: %s") % e.what());
+    LOG(Property, Error, boost::format("HasProperty: %s") % e.what());
   } catch (...) {}
   
   return false;
@@ -238,12 +302,12 @@ static OSStatus	IsPropertySettable(AudioServerPlugInDriverRef driver,
       throw OSException("no place to put the return value",
                         kAudioHardwareIllegalOperationError);
     
-    auto& object = AudioObjectMap::FindObject(objectID);
-    *isSettable = object.IsPropertySettable(clientProcessID, *address);
+    auto object = AudioObjectMap::FindObject(objectID);
+    *isSettable = object->IsPropertySettable(clientProcessID, *address);
     
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("IsPropertySettable: %s") % e.what());
+    LOG(Property, Error, boost::format("IsPropertySettable: %s") % e.what());
     return e.status();
   } catch (...) {
     return kAudioHardwareUnspecifiedError;
@@ -268,14 +332,14 @@ static OSStatus	GetPropertyDataSize(AudioServerPlugInDriverRef driver,
       throw OSException("no place to put the return value",
                         kAudioHardwareIllegalOperationError);
     
-    auto& object = AudioObjectMap::FindObject(objectID);
-    *dataSize = object.GetPropertyDataSize(clientProcessID,
+    auto object = AudioObjectMap::FindObject(objectID);
+    *dataSize = object->GetPropertyDataSize(clientProcessID,
                                            *address,
                                            qualifierDataSize,
                                            qualifierData);
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("GetPropertyDataSize: %s") % e.what());
+    LOG(Property, Error, boost::format("GetPropertyDataSize: %s") % e.what());
     return e.status();
   } catch (...) {
     return kAudioHardwareUnspecifiedError;
@@ -302,12 +366,13 @@ static OSStatus	GetPropertyData(AudioServerPlugInDriverRef driver,
       throw OSException("no place to put the return value",
                         kAudioHardwareIllegalOperationError);
     
-//    LOG(boost::format("GetPropertyData: objectID=%1%, selector=%2%")
+//    LOG(Property, Trace,
+//        boost::format("GetPropertyData: objectID=%1%, selector=%2%")
 //        % objectID
 //        % address->mSelector);
     
-    auto& object = AudioObjectMap::FindObject(objectID);
-    *outDataSize = object.GetPropertyData(clientProcessID,
+    auto object = AudioObjectMap::FindObject(objectID);
+    *outDataSize = object->GetPropertyData(clientProcessID,
                                           *address,
                                           qualifierDataSize,
                                           qualifierData,
@@ -315,7 +380,7 @@ static OSStatus	GetPropertyData(AudioServerPlugInDriverRef driver,
                                           outData);
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("GetPropertyData: %s") % e.what());
+    LOG(Property, Error, boost::format("GetPropertyData: %s") % e.what());
     return e.status();
   } catch (...) {
     return kAudioHardwareUnspecifiedError;
@@ -338,12 +403,13 @@ static OSStatus	SetPropertyData(AudioServerPlugInDriverRef driver,
       throw OSException("no address",
                         kAudioHardwareIllegalOperationError);
     
-    LOG(boost::format(">>>> SetPropertyData: objectID=%1%, selector=%2%")
+    LOG(Property, Debug,
+        boost::format(">>>> SetPropertyData: objectID=%1%, selector=%2%")
         % objectID
         % address->mSelector);
     
-    auto& object = AudioObjectMap::FindObject(objectID);
-    auto result = object.SetPropertyData(clientProcessID,
+    auto object = AudioObjectMap::FindObject(objectID);
+    auto result = object->SetPropertyData(clientProcessID,
                                          *address,
                                          qualifierDataSize,
                                          qualifierData,
@@ -362,7 +428,7 @@ static OSStatus	SetPropertyData(AudioServerPlugInDriverRef driver,
     
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("SetPropertyData: %s") % e.what());
+    LOG(Property, Error, boost::format("SetPropertyData: %s") % e.what());
     return e.status();
   } catch (...) {
     return kAudioHardwareUnspecifiedError;
@@ -379,16 +445,17 @@ static OSStatus	StartIO(AudioServerPlugInDriverRef driver,
       throw OSException("bad driver reference",
                         kAudioHardwareBadObjectError);
     
-    LOG("*** StartIO ***");
+    LOG(IO, Info, "*** StartIO ***");
   
-    auto& device = static_cast<Device&>(AudioObjectMap::FindObject(deviceObjectID));
-    device.StartIO();
+    auto device = FindDevice(deviceObjectID);
+    RunningDevices::Add(device);
+    device->StartIO();
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("StartIO: %s") % e.what());
+    LOG(IO, Error, boost::format("StartIO: %s") % e.what());
     return e.status();
   } catch (...) {
-    LOG(boost::format("StartIO: unspecified error"));
+    LOG(IO, Error, boost::format("StartIO: unspecified error"));
     return kAudioHardwareUnspecifiedError;
   }
 }
@@ -403,16 +470,20 @@ static OSStatus	StopIO(AudioServerPlugInDriverRef driver,
       throw OSException("bad driver reference",
                         kAudioHardwareBadObjectError);
     
-    LOG("*** StopIO ***");
+    LOG(IO, Info, "*** StopIO ***");
     
-    auto& device = static_cast<Device&>(AudioObjectMap::FindObject(deviceObjectID));
+    // A device removed while running is only held by the running devices,
+    // and destroyed here once its IO stops.
+    auto& device = FindRunningDevice(deviceObjectID);
     device.StopIO();
+    if (!device.IsRunning())
+      RunningDevices::Remove(deviceObjectID);
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("StopIO: %s") % e.what());
+    LOG(IO, Error, boost::format("StopIO: %s") % e.what());
     return e.status();
   } catch (...) {
-    LOG(boost::format("StopIO: unspecified error"));
+    LOG(IO, Error, boost::format("StopIO: unspecified error"));
     return kAudioHardwareUnspecifiedError;
   }
 }
@@ -428,11 +499,11 @@ static OSStatus	GetZeroTimeStamp(AudioServerPlugInDriverRef driver,
       throw OSException("bad driver reference",
                         kAudioHardwareBadObjectError);
     
-    auto& device = static_cast<Device&>(AudioObjectMap::FindObject(deviceObjectID));
+    auto& device = FindRunningDevice(deviceObjectID);
     device.GetZeroTimeStamp(*sampleTime, *hostTime, *seed);
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("GetZeroTimeStamp: %s") % e.what());
+    LOG(Timing, Error, boost::format("GetZeroTimeStamp: %s") % e.what());
     return e.status();
   } catch (...) {
     return kAudioHardwareUnspecifiedError;
@@ -460,15 +531,16 @@ static OSStatus	WillDoIOOperation(AudioServerPlugInDriverRef driver,
       throw OSException("no place to put the will-do in-place value",
                         kAudioHardwareIllegalOperationError);
 
-//    LOG(boost::format("WillDoIOOperation: deviceObjectID=%1% operationID=%2%")
+//    LOG(IO, Trace,
+//        boost::format("WillDoIOOperation: deviceObjectID=%1% operationID=%2%")
 //        % deviceObjectID
 //        % operationID);
 
-    auto& device = static_cast<Device&>(AudioObjectMap::FindObject(deviceObjectID));
+    auto& device = FindRunningDevice(deviceObjectID);
     std::tie(*willDo, *willDoInPlace) = device.WillDoIOOperation(operationID);
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("WillDoIOOperation: %s") % e.what());
+    LOG(IO, Error, boost::format("WillDoIOOperation: %s") % e.what());
     return e.status();
   } catch (...) {
     return kAudioHardwareUnspecifiedError;
@@ -492,17 +564,18 @@ static OSStatus	BeginIOOperation(AudioServerPlugInDriverRef driver,
       throw OSException("no cycle info",
                         kAudioHardwareIllegalOperationError);
     
-//    LOG(boost::format("BeginIOOperation: deviceObjectID=%1% operationID=%2%")
+//    LOG(IO, Trace,
+//        boost::format("BeginIOOperation: deviceObjectID=%1% operationID=%2%")
 //        % deviceObjectID
 //        % operationID);
     
-    auto& device = static_cast<Device&>(AudioObjectMap::FindObject(deviceObjectID));
+    auto& device = FindRunningDevice(deviceObjectID);
     device.BeginIOOperation(operationID,
                             ioBufferFrameSize,
                             *ioCycleInfo);
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("BeginIOOperation: %s") % e.what());
+    LOG(IO, Error, boost::format("BeginIOOperation: %s") % e.what());
     return e.status();
   } catch (...) {
     return kAudioHardwareUnspecifiedError;
@@ -529,11 +602,9 @@ static OSStatus	DoIOOperation(AudioServerPlugInDriverRef driver,
       throw OSException("no cycle info",
                         kAudioHardwareIllegalOperationError);
     
-    LOG(boost::format("DoIOOperation: deviceObjectID=%1% operationID=%2%")
-        % deviceObjectID
-        % operationID);
+    LOG_RT(IO, Trace, LogMessageID::DoIOOperation, deviceObjectID, operationID);
 
-    auto& device = static_cast<Device&>(AudioObjectMap::FindObject(deviceObjectID));
+    auto& device = FindRunningDevice(deviceObjectID);
     device.DoIOOperation(streamObjectID,
                          operationID,
                          ioBufferFrameSize,
@@ -542,7 +613,7 @@ static OSStatus	DoIOOperation(AudioServerPlugInDriverRef driver,
                          ioSecondaryBuffer);
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("DoIOOperation: %s") % e.what());
+    LOG(IO, Error, boost::format("DoIOOperation: %s") % e.what());
     return e.status();
   } catch (...) {
     return kAudioHardwareUnspecifiedError;
@@ -566,17 +637,18 @@ static OSStatus	EndIOOperation(AudioServerPlugInDriverRef driver,
       throw OSException("no cycle info",
                         kAudioHardwareIllegalOperationError);
     
-//    LOG(boost::format("EndIOOperation: deviceObjectID=%1% operationID=%2%")
+//    LOG(IO, Trace,
+//        boost::format("EndIOOperation: deviceObjectID=%1% operationID=%2%")
 //        % deviceObjectID
 //        % operationID);
 
-    auto& device = static_cast<Device&>(AudioObjectMap::FindObject(deviceObjectID));
+    auto& device = FindRunningDevice(deviceObjectID);
     device.EndIOOperation(operationID,
                           ioBufferFrameSize,
                           *ioCycleInfo);
     return 0;
   } catch (const OSException& e) {
-    LOG(boost::format("EndIOOperation: %s") % e.what());
+    LOG(IO, Error, boost::format("EndIOOperation: %s") % e.what());
     return e.status();
   } catch (...) {
     return kAudioHardwareUnspecifiedError;
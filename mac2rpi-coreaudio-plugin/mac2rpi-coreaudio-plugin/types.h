@@ -4,15 +4,26 @@
 #include <CoreAudio/AudioServerPlugIn.h>
 
 enum {
+  kObjectID_PlugIn = kAudioObjectPlugInObject,
+  
+  /** First ID handed out by AudioObjectMap::AllocateObjectIDs(). */
+  kObjectID_FirstDynamic,
+};
+
+enum {
+  // The IDs of a device and the objects it owns are allocated as a block;
+  // these are the offsets of every object within the block.
   // Changing this enumeration might affect Device::GetPropertyData().
   // For instance, see how kAudioDevicePropertyStreams or
   // kAudioObjectPropertyControlList are handled in that function.
   
-  kObjectID_PlugIn = kAudioObjectPlugInObject,
-  kObjectID_Device,
-  kObjectID_Stream_Output,
-  kObjectID_Volume_Output_Master,
-  kObjectID_Mute_Output_Master,
+  kObjectIDOffset_Device = 0,
+  kObjectIDOffset_Stream_Output,
+  kObjectIDOffset_Volume_Output_Master,
+  kObjectIDOffset_Mute_Output_Master,
+  
+  /** Number of IDs used by a device. */
+  kObjectIDCount_Device,
 };
 
 #endif /* types_h */
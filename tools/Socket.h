@@ -0,0 +1,148 @@
+#ifndef Socket_h
+#define Socket_h
+
+/* UDP socket helpers shared by the tools. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/** Parses a numeric address into a socket address.
+ *
+ * @return Whether the address is valid.
+ */
+inline bool ParseAddress(const char* address,
+                         unsigned short port,
+                         sockaddr_storage& result,
+                         socklen_t& length) {
+  addrinfo hints {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  addrinfo* info;
+  auto service = std::to_string(port);
+  auto status = getaddrinfo(address, service.c_str(), &hints, &info);
+  if (status != 0) {
+    std::fprintf(stderr, "%s: %s\n", address, gai_strerror(status));
+    return false;
+  }
+  std::memcpy(&result, info->ai_addr, info->ai_addrlen);
+  length = info->ai_addrlen;
+  freeaddrinfo(info);
+  return true;
+}
+
+/** Splits "address:port" (or "[address]:port" for IPv6).
+ *
+ * @return Whether the text has this form.
+ */
+inline bool SplitEndpoint(const char* text,
+                          std::string& address,
+                          unsigned short& port) {
+  std::string endpoint(text);
+  auto colon = endpoint.rfind(':');
+  if (colon == std::string::npos || colon + 1 == endpoint.size())
+    return false;
+  address = endpoint.substr(0, colon);
+  if (address.size() >= 2 && address.front() == '[' && address.back() == ']')
+    address = address.substr(1, address.size() - 2);
+  port = static_cast<unsigned short>(std::atoi(endpoint.c_str() + colon + 1));
+  return true;
+}
+
+/** Opens a socket receiving datagrams on a port, joining the group if the
+ * address is a multicast one.
+ *
+ * @return The socket, or -1 on error.
+ */
+inline int OpenReceiveSocket(const char* address, unsigned short port) {
+  sockaddr_storage group;
+  socklen_t length;
+  if (!ParseAddress(address, port, group, length))
+    return -1;
+  const auto family = group.ss_family;
+
+  auto fd = socket(family, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    std::perror("socket");
+    return -1;
+  }
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  int bufferSize = 4 << 20;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+  int result;
+  if (family == AF_INET) {
+    auto& group4 = reinterpret_cast<sockaddr_in&>(group);
+    sockaddr_in local {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = IN_MULTICAST(ntohl(group4.sin_addr.s_addr))
+        ? group4.sin_addr.s_addr : htonl(INADDR_ANY);
+    result = bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local));
+    if (result == 0 && IN_MULTICAST(ntohl(group4.sin_addr.s_addr))) {
+      ip_mreq request {};
+      request.imr_multiaddr = group4.sin_addr;
+      request.imr_interface.s_addr = htonl(INADDR_ANY);
+      result = setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                          &request, sizeof(request));
+    }
+  } else {
+    auto& group6 = reinterpret_cast<sockaddr_in6&>(group);
+    sockaddr_in6 local {};
+    local.sin6_family = AF_INET6;
+    local.sin6_port = htons(port);
+    local.sin6_addr = in6addr_any;
+    result = bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local));
+    if (result == 0 && IN6_IS_ADDR_MULTICAST(&group6.sin6_addr)) {
+      ipv6_mreq request {};
+      request.ipv6mr_multiaddr = group6.sin6_addr;
+      request.ipv6mr_interface = 0;
+      result = setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP,
+                          &request, sizeof(request));
+    }
+  }
+  if (result != 0) {
+    std::perror(address);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/** Opens a socket sending datagrams to an address. Multicast datagrams do
+ * not leave the local network.
+ *
+ * @return The socket, or -1 on error.
+ */
+inline int OpenSendSocket(const char* address,
+                          unsigned short port,
+                          sockaddr_storage& destination,
+                          socklen_t& length) {
+  if (!ParseAddress(address, port, destination, length))
+    return -1;
+
+  auto fd = socket(destination.ss_family, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    std::perror("socket");
+    return -1;
+  }
+  int hops = 1;
+  if (destination.ss_family == AF_INET) {
+    unsigned char ttl = 1;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  } else {
+    setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+  }
+  return fd;
+}
+
+#endif /* Socket_h */
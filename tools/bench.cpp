@@ -0,0 +1,496 @@
+/* Micro-benchmarks of the stages of the output path of the plug-in, built
+ * from its own sources with Google Benchmark, on Linux as well as macOS:
+ * the volume curve, the sample conversions, sanitizing, metering, the
+ * limiter, packetizing a cycle into datagrams sent to a loopback socket, the
+ * cycles of several devices sending through their transports, one device
+ * sending to several destinations, the cost of the metrics of a cycle, and
+ * logging from the IO thread against logging synchronously.
+ *
+ * Every benchmark processes IO cycles of 512 stereo frames unless its name
+ * says otherwise, and reports frames per second. Results can be written as
+ * JSON to compare releases, e.g.:
+ *
+ *   bench --benchmark_out=bench.json --benchmark_out_format=json
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <mach/mach_time.h>
+
+#include "Limiter.h"
+#include "LogRing.h"
+#include "Metrics.h"
+#include "Packetizer.h"
+#include "SampleConversion.h"
+#include "Socket.h"
+#include "Transport.h"
+#include "VolumeCurve.h"
+#include "log.h"
+
+namespace {
+  constexpr uint32_t cycleFrames { 512 };
+  constexpr uint32_t channels { 2 };
+
+  /** A 1 kHz tone at a given peak level, as interleaved float frames. */
+  std::vector<float> Tone(uint32_t frames, float level) {
+    std::vector<float> samples(frames * channels);
+    for (uint32_t frame = 0; frame < frames; frame++) {
+      const auto value = level * std::sin(2.0 * M_PI * 1000.0 * frame / 48000.0);
+      for (uint32_t channel = 0; channel < channels; channel++)
+        samples[frame * channels + channel] = static_cast<float>(value);
+    }
+    return samples;
+  }
+
+  void SetFramesProcessed(benchmark::State& state, uint32_t framesPerIteration) {
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * framesPerIteration);
+  }
+
+  /** Opens a socket on a free port of the loopback interface.
+   *
+   * @param port Set to the port of the socket.
+   * @return The socket, or -1 if it cannot be opened.
+   */
+  int OpenLoopbackReceiver(unsigned short& port) {
+    auto receiver = OpenReceiveSocket("127.0.0.1", 0);
+    sockaddr_in local {};
+    socklen_t length = sizeof(local);
+    if (receiver >= 0)
+      getsockname(receiver, reinterpret_cast<sockaddr*>(&local), &length);
+    port = ntohs(local.sin_port);
+    return receiver;
+  }
+
+  /** Reads and discards the datagrams waiting on a socket. */
+  void Discard(int receiver) {
+    static std::vector<uint8_t> datagram(65536);
+    while (recv(receiver, datagram.data(), datagram.size(), MSG_DONTWAIT) > 0) {}
+  }
+
+  void BM_ScalarToDecibels(benchmark::State& state) {
+    float scalar = 0;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(ScalarToDecibels(scalar));
+      scalar = scalar < 1 ? scalar + 0.001f : 0;
+    }
+  }
+  BENCHMARK(BM_ScalarToDecibels);
+
+  void BM_DecibelsToScalar(benchmark::State& state) {
+    float decibels = kVolumeMinDB;
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(DecibelsToScalar(decibels));
+      decibels = decibels < kVolumeMaxDB ? decibels + 0.1f : kVolumeMinDB;
+    }
+  }
+  BENCHMARK(BM_DecibelsToScalar);
+
+  /** A cycle of a tone in a given sample format. */
+  std::vector<uint8_t> ToneIn(SampleFormat format, uint32_t frames, float level) {
+    const auto tone = Tone(frames, level);
+    std::vector<uint8_t> samples(tone.size() * BytesPerSample(format));
+    if (format == SampleFormat::Float32)
+      std::memcpy(samples.data(), tone.data(), samples.size());
+    else
+      GetSampleConverter(SampleFormat::Float32, format)(
+          tone.data(), samples.data(), static_cast<uint32_t>(tone.size()));
+    return samples;
+  }
+
+  /** From the physical format given as the first argument to the wire
+   * format given as the second one.
+   */
+  void BM_ConvertSamples(benchmark::State& state) {
+    const auto inputFormat = static_cast<SampleFormat>(state.range(0));
+    const auto format = static_cast<SampleFormat>(state.range(1));
+    const auto input = ToneIn(inputFormat, cycleFrames, 0.5f);
+    std::vector<uint8_t> output(cycleFrames * channels * BytesPerSample(format));
+    const auto convert = GetSampleConverter(inputFormat, format);
+    for (auto _ : state) {
+      convert(input.data(), output.data(), cycleFrames * channels);
+      benchmark::ClobberMemory();
+    }
+    SetFramesProcessed(state, cycleFrames);
+  }
+
+  /** Every pair of different formats; the same format needs no conversion. */
+  void ConvertSamplesArguments(benchmark::internal::Benchmark* benchmark) {
+    const SampleFormat formats[] = {
+      SampleFormat::Float32, SampleFormat::Int32, SampleFormat::Int24, SampleFormat::Int16
+    };
+    benchmark->ArgNames({ "in", "out" });
+    for (auto in : formats) {
+      for (auto out : formats) {
+        if (in != out)
+          benchmark->Args({ static_cast<int>(in), static_cast<int>(out) });
+      }
+    }
+  }
+  BENCHMARK(BM_ConvertSamples)->Apply(ConvertSamplesArguments);
+
+  /** Fade of a cycle in the sample format given as the argument. */
+  void BM_ApplyGainRamp(benchmark::State& state) {
+    const auto format = static_cast<SampleFormat>(state.range(0));
+    auto samples = ToneIn(format, cycleFrames, 0.5f);
+    for (auto _ : state) {
+      ApplyGainRamp(samples.data(), format, channels, cycleFrames,
+                    1.0f, -1.0f / (1 << 20));
+      benchmark::ClobberMemory();
+    }
+    SetFramesProcessed(state, cycleFrames);
+  }
+  BENCHMARK(BM_ApplyGainRamp)
+      ->Arg(static_cast<int>(SampleFormat::Float32))
+      ->Arg(static_cast<int>(SampleFormat::Int16));
+
+  void BM_SanitizeSamples(benchmark::State& state) {
+    auto samples = Tone(cycleFrames, 0.5f);
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(SanitizeSamples(samples.data(),
+                                               static_cast<uint32_t>(samples.size())));
+      benchmark::ClobberMemory();
+    }
+    SetFramesProcessed(state, cycleFrames);
+  }
+  BENCHMARK(BM_SanitizeSamples);
+
+  void BM_MeasureLevels(benchmark::State& state) {
+    const auto samples = Tone(cycleFrames, 0.5f);
+    float peaks[channels];
+    float rms[channels];
+    for (auto _ : state) {
+      MeasureLevels(samples.data(), SampleFormat::Float32, channels,
+                    cycleFrames, peaks, rms);
+      benchmark::DoNotOptimize(peaks);
+      benchmark::DoNotOptimize(rms);
+    }
+    SetFramesProcessed(state, cycleFrames);
+  }
+  BENCHMARK(BM_MeasureLevels);
+
+  /** The limiter on a tone at the peak level (dBFS) given as the argument,
+   * with a ceiling of -1 dBFS: -6 leaves it idle, 0 keeps it limiting.
+   */
+  void BM_LimiterProcess(benchmark::State& state) {
+    const auto level = static_cast<float>(std::pow(10.0, state.range(0) / 20.0));
+    const auto tone = Tone(cycleFrames, level);
+    auto samples = tone;
+    Limiter limiter(channels);
+    limiter.SetCeiling(static_cast<float>(std::pow(10.0, -1.0 / 20.0)));
+    for (auto _ : state) {
+      state.PauseTiming();
+      samples = tone;
+      state.ResumeTiming();
+      benchmark::DoNotOptimize(limiter.Process(samples.data(), cycleFrames));
+    }
+    SetFramesProcessed(state, cycleFrames);
+  }
+  BENCHMARK(BM_LimiterProcess)->Arg(-6)->Arg(0);
+
+  /** What LOG_RT costs the IO thread: the level check and a push into a
+   * LogRing. The ring is emptied out of the timing whenever it is half
+   * full, as the log writer thread of the plug-in does, so no record is
+   * dropped.
+   */
+  void BM_LogRT(benchmark::State& state) {
+    auto ring = std::make_unique<LogRing>();
+    UInt64 packets = 0;
+    size_t pending = 0;
+    for (auto _ : state) {
+      if (logCompiledIn(LogCategory::Network, LogLevel::Error)
+          && logEnabled(LogCategory::Network, LogLevel::Error))
+        ring->Push(LogRecord{ LogMessageID::SendFailed, { packets, ENETUNREACH } });
+      packets++;
+
+      if (++pending == LogRing::capacity / 2) {
+        state.PauseTiming();
+        LogRecord record;
+        while (ring->Pop(record)) {}
+        pending = 0;
+        state.ResumeTiming();
+      }
+    }
+  }
+  BENCHMARK(BM_LogRT);
+
+  /** What LOG costs the thread calling it, for the same message as
+   * BM_LogRT: formatting it and writing it out, to /dev/null rather than
+   * to the system log.
+   */
+  void BM_LogSync(benchmark::State& state) {
+    setLogFile("/dev/null");
+    UInt64 packets = 0;
+    for (auto _ : state) {
+      LOG(Network, Error,
+          boost::format("### WriteOutputData: %1% packets not sent (error %2%)")
+          % packets % ENETUNREACH);
+      packets++;
+    }
+    setLogFile(nullptr);
+  }
+  BENCHMARK(BM_LogSync);
+
+  /** A cycle split into datagrams and sent to a loopback socket, with the
+   * wire format and the sample rate given as the arguments. Besides frames
+   * per second, reports the seconds of audio sent per second of CPU at that
+   * rate (realTime), whose inverse is the share of a core the stream takes.
+   * The rates go past the 192 kHz the device offers, up to 384 kHz, to show
+   * the headroom left.
+   */
+  void BM_Packetize(benchmark::State& state) {
+    const auto format = static_cast<SampleFormat>(state.range(0));
+    const auto sampleRate = static_cast<Float64>(state.range(1));
+    auto receiver = OpenReceiveSocket("127.0.0.1", 0);
+    sockaddr_storage destination;
+    socklen_t length = sizeof(destination);
+    getsockname(receiver, reinterpret_cast<sockaddr*>(&destination), &length);
+    reinterpret_cast<sockaddr_in&>(destination).sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    auto sender = socket(AF_INET, SOCK_DGRAM, 0);
+    if (receiver < 0 || sender < 0) {
+      state.SkipWithError("cannot open the loopback sockets");
+      return;
+    }
+
+    Packetizer packetizer;
+    packetizer.SetFormat(sampleRate, channels, SampleFormat::Float32, format);
+    const auto samples = Tone(cycleFrames, 0.5f);
+    uint8_t datagram[Packetizer::maxDatagramSize];
+    std::vector<uint8_t> discard(65536);
+    Float64 sampleTime = 0;
+    for (auto _ : state) {
+      packetizer.Packetize(samples.data(), cycleFrames, sampleTime,
+                           [&](const std::array<boost::asio::const_buffer, 2>& buffers) {
+        size_t size = 0;
+        for (const auto& buffer : buffers) {
+          std::memcpy(datagram + size,
+                      boost::asio::buffer_cast<const void*>(buffer),
+                      boost::asio::buffer_size(buffer));
+          size += boost::asio::buffer_size(buffer);
+        }
+        sendto(sender, datagram, size, 0,
+               reinterpret_cast<const sockaddr*>(&destination), length);
+      });
+      sampleTime += cycleFrames;
+
+      // Keeps the receive buffer from filling up, out of the timing.
+      state.PauseTiming();
+      while (recv(receiver, discard.data(), discard.size(), MSG_DONTWAIT) > 0) {}
+      state.ResumeTiming();
+    }
+    SetFramesProcessed(state, cycleFrames);
+    state.counters["realTime"] = benchmark::Counter(
+        static_cast<double>(state.iterations()) * cycleFrames / sampleRate,
+        benchmark::Counter::kIsRate);
+    close(sender);
+    close(receiver);
+  }
+  BENCHMARK(BM_Packetize)
+      ->ArgNames({ "format", "rate" })
+      ->ArgsProduct({ { static_cast<int>(SampleFormat::Float32),
+                        static_cast<int>(SampleFormat::Int24),
+                        static_cast<int>(SampleFormat::Int16) },
+                      { 44100, 48000, 88200, 96000, 176400, 192000, 352800, 384000 } });
+
+  /** One IO cycle of as many devices as the argument, sent to a loopback
+   * socket. Every device packetizes its cycle and sends it through a
+   * Transport of its own, and all the sockets belong to one IO service, as
+   * in the plug-in. The frames per second are counted over all the devices,
+   * so they stay flat as long as the cost grows linearly with the number of
+   * devices.
+   */
+  void BM_Devices(benchmark::State& state) {
+    struct SimulatedDevice {
+      DeviceMetrics metrics {};
+      std::unique_ptr<Transport> transport;
+      Packetizer packetizer;
+    };
+
+    const auto count = static_cast<unsigned>(state.range(0));
+    unsigned short port;
+    auto receiver = OpenLoopbackReceiver(port);
+    if (receiver < 0) {
+      state.SkipWithError("cannot open the loopback socket");
+      return;
+    }
+
+    boost::asio::io_service ioService;
+    DeviceConfiguration configuration;
+    configuration.destinations = { { "127.0.0.1", port } };
+    std::vector<std::unique_ptr<SimulatedDevice>> devices;
+    for (unsigned i = 0; i < count; i++) {
+      auto device = std::make_unique<SimulatedDevice>();
+      device->transport = std::make_unique<Transport>(ioService, 1000 + i, configuration,
+                                                      device->metrics);
+      device->packetizer.SetFormat(48000, channels, SampleFormat::Float32,
+                                   SampleFormat::Float32);
+      devices.push_back(std::move(device));
+    }
+
+    const auto samples = Tone(cycleFrames, 0.5f);
+    Float64 sampleTime = 0;
+    for (auto _ : state) {
+      for (auto& device : devices) {
+        auto& transport = *device->transport;
+        transport.Flush();
+        device->packetizer.Packetize(samples.data(), cycleFrames, sampleTime,
+                                     [&](const std::array<boost::asio::const_buffer, 2>& buffers) {
+          transport.Send(buffers);
+        });
+      }
+      sampleTime += cycleFrames;
+
+      state.PauseTiming();
+      Discard(receiver);
+      state.ResumeTiming();
+    }
+    SetFramesProcessed(state, count * cycleFrames);
+    devices.clear();
+    close(receiver);
+  }
+  BENCHMARK(BM_Devices)->RangeMultiplier(2)->Range(1, 32);
+
+  /** One IO cycle of a device sent through its Transport to as many
+   * loopback destinations as the argument, up to Transport::maxDestinations.
+   * The cycle is packetized once; the frames per second are counted per
+   * destination reached.
+   */
+  void BM_FanOut(benchmark::State& state) {
+    const auto count = static_cast<unsigned>(state.range(0));
+    std::vector<int> receivers;
+    DeviceConfiguration configuration;
+    configuration.destinations.clear();
+    for (unsigned i = 0; i < count; i++) {
+      unsigned short port;
+      auto receiver = OpenLoopbackReceiver(port);
+      if (receiver < 0)
+        break;
+      receivers.push_back(receiver);
+      configuration.destinations.push_back({ "127.0.0.1", port });
+    }
+    if (receivers.size() < count) {
+      for (auto receiver : receivers)
+        close(receiver);
+      state.SkipWithError("cannot open the loopback sockets");
+      return;
+    }
+
+    boost::asio::io_service ioService;
+    DeviceMetrics metrics {};
+    Transport transport(ioService, 1000, configuration, metrics);
+    Packetizer packetizer;
+    packetizer.SetFormat(48000, channels, SampleFormat::Float32, SampleFormat::Float32);
+    const auto samples = Tone(cycleFrames, 0.5f);
+    Float64 sampleTime = 0;
+    for (auto _ : state) {
+      transport.Flush();
+      packetizer.Packetize(samples.data(), cycleFrames, sampleTime,
+                           [&](const std::array<boost::asio::const_buffer, 2>& buffers) {
+        transport.Send(buffers);
+      });
+      sampleTime += cycleFrames;
+
+      state.PauseTiming();
+      for (auto receiver : receivers)
+        Discard(receiver);
+      state.ResumeTiming();
+    }
+    SetFramesProcessed(state, count * cycleFrames);
+    for (auto receiver : receivers)
+      close(receiver);
+  }
+  BENCHMARK(BM_FanOut)->RangeMultiplier(2)->Range(1, Transport::maxDestinations);
+
+  /** What the metrics add to an IO cycle: the counters, the duration
+   * histogram and the level meters that Device::WriteOutputData() updates.
+   * The rest of the cycle sanitizes, limits and packetizes 512 frames to a
+   * loopback socket through a Transport, whose own counters are part of
+   * both runs. Every iteration runs the cycle once without the metrics and
+   * once with them. The counters give the time of a cycle without them, the
+   * time they add, that time in percent of the work of the cycle, and in
+   * percent of the 10.7 ms period of the cycle, the budget it must fit in.
+   */
+  void BM_MetricsOverhead(benchmark::State& state) {
+    typedef std::chrono::steady_clock Clock;
+
+    unsigned short port;
+    auto receiver = OpenLoopbackReceiver(port);
+    if (receiver < 0) {
+      state.SkipWithError("cannot open the loopback socket");
+      return;
+    }
+
+    boost::asio::io_service ioService;
+    DeviceConfiguration configuration;
+    configuration.destinations = { { "127.0.0.1", port } };
+    DeviceMetrics metrics {};
+    Transport transport(ioService, 1000, configuration, metrics);
+    Packetizer packetizer;
+    packetizer.SetFormat(48000, channels, SampleFormat::Float32, SampleFormat::Float32);
+    Limiter limiter(channels);
+    limiter.SetCeiling(static_cast<float>(std::pow(10.0, -1.0 / 20.0)));
+    limiter.Reset(48000);
+
+    const auto tone = Tone(cycleFrames, 0.5f);
+    auto samples = tone;
+    Float64 sampleTime = 0;
+    auto cycle = [&](bool measure) {
+      const auto start = mach_absolute_time();
+      const auto sanitized = SanitizeSamples(samples.data(),
+                                             static_cast<uint32_t>(samples.size()));
+      const auto limited = limiter.Process(samples.data(), cycleFrames);
+      if (measure) {
+        Metrics::Add(metrics.ioCycles);
+        if (sanitized > 0)
+          Metrics::Add(metrics.sanitizedSamples, sanitized);
+        if (limited)
+          Metrics::Add(metrics.limitedCycles);
+        float peaks[channels];
+        float rms[channels];
+        MeasureLevels(samples.data(), SampleFormat::Float32, channels,
+                      cycleFrames, peaks, rms);
+        for (uint32_t channel = 0; channel < channels; channel++) {
+          Metrics::Set(metrics.peakLevels[channel], peaks[channel]);
+          Metrics::Set(metrics.rmsLevels[channel], rms[channel]);
+        }
+      }
+
+      transport.Flush();
+      packetizer.Packetize(samples.data(), cycleFrames, sampleTime,
+                           [&](const std::array<boost::asio::const_buffer, 2>& buffers) {
+        transport.Send(buffers);
+      });
+      sampleTime += cycleFrames;
+      if (measure)
+        Metrics::Record(metrics.ioOperationDuration, mach_absolute_time() - start);
+    };
+
+    std::chrono::duration<double, std::nano> without {};
+    std::chrono::duration<double, std::nano> with {};
+    for (auto _ : state) {
+      for (const bool measure : { false, true }) {
+        samples = tone;
+        Discard(receiver);
+        const auto start = Clock::now();
+        cycle(measure);
+        (measure ? with : without) += Clock::now() - start;
+      }
+    }
+
+    const auto iterations = static_cast<double>(state.iterations());
+    state.counters["cycleNs"] = without.count() / iterations;
+    state.counters["metricsNs"] = (with - without).count() / iterations;
+    state.counters["overheadPercent"] = 100.0 * (with - without).count() / without.count();
+    state.counters["periodPercent"] = 100.0 * (with - without).count() / iterations
+        / (1e9 * cycleFrames / 48000);
+    close(receiver);
+  }
+  BENCHMARK(BM_MetricsOverhead);
+}
+
+BENCHMARK_MAIN();
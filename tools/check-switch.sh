@@ -0,0 +1,62 @@
+#!/bin/sh
+# Plays sample rate switches (switch-sim) through the relay into the
+# receiver, on the loopback interface, and checks the counters:
+# - without losses, every frame sent is played or skipped by the jitter
+#   buffer, and none is dropped at a switch;
+# - with losses, the receiver counts exactly the datagrams the relay lost,
+#   and still drops nothing at a switch.
+
+set -e
+cd "$(dirname "$0")"
+
+receiverPort=39101
+relayPort=39102
+seconds=0.5
+duration=4
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# Prints the number following a label at the start of a line of a report.
+value() {
+  sed -n "s/^ *$2[^0-9]*\([0-9][0-9]*\).*/\1/p" "$1" | head -n 1
+}
+
+run() {
+  loss=$1
+  ./receiver -a 127.0.0.1 -p $receiverPort -m 50 -d $duration > "$work/receiver" &
+  receiver=$!
+  ./relay -l 127.0.0.1:$relayPort -f 127.0.0.1:$receiverPort -s 7 -L "$loss" \
+    -t $duration > "$work/relay" &
+  relay=$!
+  sleep 0.2
+  ./switch-sim -f 127.0.0.1:$relayPort -s $seconds > "$work/sender"
+  wait $receiver $relay
+
+  sent=$(value "$work/sender" "frames")
+  played=$(value "$work/receiver" "played frames")
+  skipped=$(value "$work/receiver" "skipped frames")
+  dropped=$(value "$work/receiver" "dropped frames")
+  lost=$(value "$work/receiver" "lost")
+  relayLost=$(value "$work/relay" '"randomLosses"')
+  echo "loss $loss%: sent $sent, played $played, skipped $skipped," \
+       "dropped $dropped, lost $lost (relay $relayLost)"
+
+  status=0
+  if [ "$dropped" -ne 0 ]; then
+    echo "FAIL: $dropped frames dropped at a switch"
+    status=1
+  fi
+  if [ "$lost" -ne "$relayLost" ]; then
+    echo "FAIL: the receiver counted $lost lost datagrams, the relay $relayLost"
+    status=1
+  fi
+  if [ "$loss" = 0 ] && [ $((played + skipped)) -ne "$sent" ]; then
+    echo "FAIL: $((sent - played - skipped)) frames missing"
+    status=1
+  fi
+  return $status
+}
+
+run 0
+run 2
+echo "OK"
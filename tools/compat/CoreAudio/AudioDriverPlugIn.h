@@ -0,0 +1,10 @@
+#ifndef AudioDriverPlugIn_h
+#define AudioDriverPlugIn_h
+
+/* Included by log.h; everything it needs is in AudioServerPlugIn.h. On
+ * macOS the system header is used.
+ */
+
+#include <CoreAudio/AudioServerPlugIn.h>
+
+#endif /* AudioDriverPlugIn_h */
@@ -0,0 +1,103 @@
+#ifndef AudioServerPlugIn_h
+#define AudioServerPlugIn_h
+
+/* The CoreAudio types and constants used by the plug-in sources that the
+ * tools build on Linux (the channel layouts of the limiter, the errors of
+ * the transport, the property names of the log). On macOS the system
+ * header is used.
+ */
+
+#include <MacTypes.h>
+
+typedef UInt32 AudioObjectID;
+typedef UInt32 AudioChannelLabel;
+typedef UInt32 AudioChannelLayoutTag;
+typedef UInt32 AudioObjectPropertySelector;
+
+enum : AudioObjectID {
+  kAudioObjectUnknown = 0,
+  kAudioObjectPlugInObject = 1,
+};
+
+enum : OSStatus {
+  kAudioHardwareUnspecifiedError = 0x77686174, // 'what'
+  kAudioHardwareIllegalOperationError = 0x6e6f7065, // 'nope'
+};
+
+enum : AudioChannelLayoutTag {
+  kAudioChannelLayoutTag_Stereo = (101U << 16) | 2,
+  kAudioChannelLayoutTag_MPEG_5_1_A = (121U << 16) | 6,
+  kAudioChannelLayoutTag_MPEG_7_1_C = (127U << 16) | 8,
+};
+
+enum : AudioChannelLabel {
+  kAudioChannelLabel_Left = 1,
+  kAudioChannelLabel_Right = 2,
+  kAudioChannelLabel_Center = 3,
+  kAudioChannelLabel_LFEScreen = 4,
+  kAudioChannelLabel_LeftSurround = 5,
+  kAudioChannelLabel_RightSurround = 6,
+  kAudioChannelLabel_RearSurroundLeft = 33,
+  kAudioChannelLabel_RearSurroundRight = 34,
+};
+
+enum : AudioObjectPropertySelector {
+  kAudioObjectPropertyBaseClass = 0x62636c73, // 'bcls'
+  kAudioObjectPropertyClass = 0x636c6173, // 'clas'
+  kAudioObjectPropertyOwner = 0x73746476, // 'stdv'
+  kAudioObjectPropertyName = 0x6c6e616d, // 'lnam'
+  kAudioObjectPropertyModelName = 0x6c6d6f64, // 'lmod'
+  kAudioObjectPropertyManufacturer = 0x6c6d616b, // 'lmak'
+  kAudioObjectPropertyOwnedObjects = 0x6f776e64, // 'ownd'
+  kAudioObjectPropertyIdentify = 0x6964656e, // 'iden'
+  kAudioObjectPropertySerialNumber = 0x736e756d, // 'snum'
+  kAudioObjectPropertyFirmwareVersion = 0x6677766e, // 'fwvn'
+  kAudioObjectPropertyControlList = 0x6374726c, // 'ctrl'
+  kAudioPlugInPropertyDeviceList = 0x64657623, // 'dev#'
+  kAudioPlugInPropertyTranslateUIDToDevice = 0x75696464, // 'uidd'
+  kAudioPlugInPropertyBoxList = 0x626f7823, // 'box#'
+  kAudioPlugInPropertyTranslateUIDToBox = 0x75696462, // 'uidb'
+  kAudioPlugInPropertyResourceBundle = 0x72737263, // 'rsrc'
+  kAudioDevicePropertyDeviceUID = 0x75696420, // 'uid '
+  kAudioDevicePropertyModelUID = 0x6d756964, // 'muid'
+  kAudioDevicePropertyTransportType = 0x7472616e, // 'tran'
+  kAudioDevicePropertyRelatedDevices = 0x616b696e, // 'akin'
+  kAudioDevicePropertyClockDomain = 0x636c6b64, // 'clkd'
+  kAudioDevicePropertyDeviceIsAlive = 0x6c69766e, // 'livn'
+  kAudioDevicePropertyDeviceIsRunning = 0x676f696e, // 'goin'
+  kAudioDevicePropertyDeviceCanBeDefaultDevice = 0x64666c74, // 'dflt'
+  kAudioDevicePropertyDeviceCanBeDefaultSystemDevice = 0x73666c74, // 'sflt'
+  kAudioDevicePropertyLatency = 0x6c746e63, // 'ltnc'
+  kAudioDevicePropertyStreams = 0x73746d23, // 'stm#'
+  kAudioDevicePropertySafetyOffset = 0x73616674, // 'saft'
+  kAudioDevicePropertyNominalSampleRate = 0x6e737274, // 'nsrt'
+  kAudioDevicePropertyAvailableNominalSampleRates = 0x6e737223, // 'nsr#'
+  kAudioDevicePropertyIcon = 0x69636f6e, // 'icon'
+  kAudioDevicePropertyIsHidden = 0x6869646e, // 'hidn'
+  kAudioDevicePropertyPreferredChannelsForStereo = 0x64636832, // 'dch2'
+  kAudioDevicePropertyPreferredChannelLayout = 0x73726e64, // 'srnd'
+  kAudioDevicePropertyZeroTimeStampPeriod = 0x72696e67, // 'ring'
+  kAudioStreamPropertyIsActive = 0x73616374, // 'sact'
+  kAudioStreamPropertyDirection = 0x73646972, // 'sdir'
+  kAudioStreamPropertyTerminalType = 0x7465726d, // 'term'
+  kAudioStreamPropertyStartingChannel = 0x7363686e, // 'schn'
+  kAudioStreamPropertyLatency = kAudioDevicePropertyLatency,
+  kAudioStreamPropertyVirtualFormat = 0x73666d74, // 'sfmt'
+  kAudioStreamPropertyAvailableVirtualFormats = 0x73666d61, // 'sfma'
+  kAudioStreamPropertyPhysicalFormat = 0x70667420, // 'pft '
+  kAudioStreamPropertyAvailablePhysicalFormats = 0x70667461, // 'pfta'
+  kAudioControlPropertyScope = 0x63736370, // 'cscp'
+  kAudioControlPropertyElement = 0x63656c6d, // 'celm'
+  kAudioLevelControlPropertyScalarValue = 0x6c637376, // 'lcsv'
+  kAudioLevelControlPropertyDecibelValue = 0x6c636476, // 'lcdv'
+  kAudioLevelControlPropertyDecibelRange = 0x6c636472, // 'lcdr'
+  kAudioLevelControlPropertyConvertScalarToDecibels = 0x6c637364, // 'lcsd'
+  kAudioLevelControlPropertyConvertDecibelsToScalar = 0x6c636473, // 'lcds'
+  kAudioBooleanControlPropertyValue = 0x6263766c, // 'bcvl'
+  kAudioSelectorControlPropertyCurrentItem = 0x73636369, // 'scci'
+  kAudioSelectorControlPropertyAvailableItems = 0x73636169, // 'scai'
+  kAudioSelectorControlPropertyItemName = 0x7363696e, // 'scin'
+  kAudioSelectorControlPropertyItemKind = 0x636c6b6b, // 'clkk'
+};
+
+#endif /* AudioServerPlugIn_h */
@@ -0,0 +1,23 @@
+#ifndef MacTypes_h
+#define MacTypes_h
+
+/* The CoreServices types used by the plug-in sources that the tools build
+ * on Linux (DSP, packetization). On macOS the system header is used.
+ */
+
+#include <cstdint>
+
+typedef uint8_t UInt8;
+typedef int8_t SInt8;
+typedef uint16_t UInt16;
+typedef int16_t SInt16;
+typedef uint32_t UInt32;
+typedef int32_t SInt32;
+typedef uint64_t UInt64;
+typedef int64_t SInt64;
+typedef float Float32;
+typedef double Float64;
+typedef unsigned char Boolean;
+typedef SInt32 OSStatus;
+
+#endif /* MacTypes_h */
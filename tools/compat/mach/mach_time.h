@@ -0,0 +1,30 @@
+#ifndef mach_time_h
+#define mach_time_h
+
+/* Host time for the plug-in sources that the tools build on Linux (the
+ * transport): monotonic nanoseconds, i.e. a timebase of 1/1. On macOS the
+ * system header is used.
+ */
+
+#include <cstdint>
+#include <ctime>
+
+struct mach_timebase_info {
+  uint32_t numer;
+  uint32_t denom;
+};
+typedef struct mach_timebase_info mach_timebase_info_data_t;
+
+inline int mach_timebase_info(mach_timebase_info_data_t* info) {
+  info->numer = 1;
+  info->denom = 1;
+  return 0;
+}
+
+inline uint64_t mach_absolute_time() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+#endif /* mach_time_h */
@@ -0,0 +1,288 @@
+/* Checks the bytes the plug-in puts on the wire against reference vectors
+ * checked in under golden/, and times every stage that produces them.
+ *
+ * A fixed stereo input (tones at -6 dBFS, full scale and beyond it, a tone
+ * loud enough to be clamped, silence, special values such as NaNs,
+ * infinities, denormals and half steps of the integer formats, and noise)
+ * goes through the plug-in's own SanitizeSamples(), then through its
+ * Packetizer once per wire format. Every format gives a stream of datagrams
+ * (a format packet, then the audio packets) that must match
+ * golden/<format>.bin byte for byte; the first difference is reported with
+ * the datagram and the sample it falls in.
+ *
+ * The input is generated without depending on the C library's rounding:
+ * the tones are quantized to 2^-20 and the noise comes from an integer
+ * generator, so the vectors are the same on every platform. When the wire
+ * format changes on purpose, -u rewrites the vectors instead of checking
+ * them, and the new files go in the same commit.
+ *
+ * Usage: golden-check [-d directory] [-n repetitions] [-u]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "Packetizer.h"
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  constexpr unsigned channels { 2 };
+  constexpr double sampleRate { 48000 };
+  constexpr unsigned segmentFrames { 256 };
+  constexpr Float64 firstSampleTime { 512 };
+
+  struct WireFormat {
+    const char* name;
+    SampleFormat format;
+  };
+
+  const WireFormat wireFormats[] = {
+    { "float32", SampleFormat::Float32 },
+    { "int24", SampleFormat::Int24 },
+    { "int16", SampleFormat::Int16 },
+    { "int32", SampleFormat::Int32 },
+  };
+
+  /** Appends a segment of a tone, quantized to 2^-20 before scaling by a
+   * power of two, so that the last bit of sin() never matters. The right
+   * channel is the left one inverted.
+   */
+  void AppendTone(std::vector<float>& samples, double frequency, float level) {
+    for (unsigned frame = 0; frame < segmentFrames; frame++) {
+      const auto value = std::round(std::sin(2.0 * M_PI * frequency * frame / sampleRate)
+                                    * (1 << 20)) / (1 << 20);
+      samples.push_back(static_cast<float>(value) * level);
+      samples.push_back(-static_cast<float>(value) * level);
+    }
+  }
+
+  /** Appends a segment of values at the edges of the conversions. */
+  void AppendSpecialValues(std::vector<float>& samples) {
+    const float half16 = 0.5f / 32768;
+    const float half24 = 0.5f / 8388608;
+    const float values[] = {
+      std::numeric_limits<float>::quiet_NaN(),
+      std::numeric_limits<float>::infinity(),
+      -std::numeric_limits<float>::infinity(),
+      std::numeric_limits<float>::denorm_min(),
+      -std::numeric_limits<float>::denorm_min(),
+      std::numeric_limits<float>::min(),
+      -0.0f,
+      half16, -half16, 3 * half16, -3 * half16,
+      half24, -half24, 3 * half24, -3 * half24,
+      1.0f, -1.0f,
+      1.0f - half24, -1.0f + half24,
+      1.0f - half16, -1.0f + half16,
+      1.0f + half16, -1.0f - half16,
+      4.0f, -4.0f, 1e30f, -1e30f,
+    };
+    const auto count = sizeof(values) / sizeof(values[0]);
+    for (unsigned sample = 0; sample < segmentFrames * channels; sample++)
+      samples.push_back(values[sample % count]);
+  }
+
+  /** Appends a segment of white noise at full scale, from a linear
+   * congruential generator: every value is an integer scaled by a power of
+   * two, so it converts to the same float everywhere.
+   */
+  void AppendNoise(std::vector<float>& samples) {
+    uint32_t state = 0x6d327270;
+    for (unsigned sample = 0; sample < segmentFrames * channels; sample++) {
+      state = state * 1664525u + 1013904223u;
+      samples.push_back(static_cast<float>(static_cast<int32_t>(state)) / 2147483648.0f);
+    }
+  }
+
+  std::vector<float> MakeInput() {
+    std::vector<float> samples;
+    AppendTone(samples, 997, 0.5f);
+    AppendTone(samples, 1999, 1.0f);
+    AppendTone(samples, 440, 2.0f);
+    AppendTone(samples, 100, 8.0f);
+    samples.insert(samples.end(), segmentFrames * channels, 0.0f);
+    AppendSpecialValues(samples);
+    AppendNoise(samples);
+    return samples;
+  }
+
+  /** Packetizes the input in one wire format, format packet first. */
+  void Packetize(const std::vector<float>& input,
+                 SampleFormat format,
+                 std::vector<uint8_t>& output) {
+    Packetizer packetizer;
+    packetizer.SetFormat(sampleRate, channels, SampleFormat::Float32, format);
+    output.clear();
+    auto append = [&](const std::array<boost::asio::const_buffer, 2>& buffers) {
+      for (const auto& buffer : buffers) {
+        auto data = boost::asio::buffer_cast<const uint8_t*>(buffer);
+        output.insert(output.end(), data, data + boost::asio::buffer_size(buffer));
+      }
+    };
+    const auto header = packetizer.MakeHeader(PacketType::Format, 0, 0);
+    append({{ boost::asio::buffer(&header, sizeof(header)),
+              boost::asio::const_buffer() }});
+    packetizer.Packetize(input.data(),
+                         static_cast<UInt32>(input.size() / channels),
+                         firstSampleTime,
+                         append);
+  }
+
+  /** Describes where a byte offset falls in a stream of datagrams. */
+  std::string Locate(const std::vector<uint8_t>& stream, size_t offset) {
+    size_t start = 0;
+    for (unsigned datagram = 0; start + sizeof(PacketHeader) <= stream.size(); datagram++) {
+      PacketHeader header;
+      std::memcpy(&header, &stream[start], sizeof(header));
+      const auto bytesPerSample = BytesPerSample(header.format);
+      const size_t payload = header.type == PacketType::Audio
+          ? header.frameCount * header.channels * bytesPerSample : 0;
+      if (offset < start + sizeof(header))
+        return "datagram " + std::to_string(datagram) + ", header byte "
+            + std::to_string(offset - start);
+      if (offset < start + sizeof(header) + payload) {
+        const auto sample = (offset - start - sizeof(header)) / bytesPerSample;
+        return "datagram " + std::to_string(datagram) + ", frame "
+            + std::to_string(header.sampleTime - static_cast<uint64_t>(firstSampleTime)
+                             + sample / header.channels)
+            + ", channel " + std::to_string(sample % header.channels);
+      }
+      start += sizeof(header) + payload;
+    }
+    return "past the end";
+  }
+
+  bool ReadFile(const std::string& path, std::vector<uint8_t>& content) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+    content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+  }
+
+  bool WriteFile(const std::string& path, const std::vector<uint8_t>& content) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(content.data()),
+               static_cast<std::streamsize>(content.size()));
+    return static_cast<bool>(file);
+  }
+
+  /** Runs a stage over and over and returns its best time per frame, in
+   * nanoseconds.
+   */
+  template<typename Stage>
+  double Time(unsigned repetitions, size_t frames, Stage stage) {
+    double best = std::numeric_limits<double>::max();
+    for (unsigned i = 0; i < repetitions; i++) {
+      const auto start = Clock::now();
+      stage();
+      const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+      best = std::min(best, elapsed.count() / frames);
+    }
+    return best;
+  }
+
+  void Usage() {
+    std::fprintf(stderr, "usage: golden-check [-d directory] [-n repetitions] [-u]\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::string directory = "golden";
+  unsigned repetitions = 200;
+  bool update = false;
+  int option;
+  while ((option = getopt(argc, argv, "d:n:u")) != -1) {
+    switch (option) {
+      case 'd':
+        directory = optarg;
+        break;
+      case 'n':
+        repetitions = static_cast<unsigned>(std::atoi(optarg));
+        break;
+      case 'u':
+        update = true;
+        break;
+      default:
+        Usage();
+        return 2;
+    }
+  }
+  if (optind != argc || repetitions == 0) {
+    Usage();
+    return 2;
+  }
+
+  const auto input = MakeInput();
+  const auto frames = input.size() / channels;
+  auto sanitized = input;
+  const auto fixed = SanitizeSamples(sanitized.data(), static_cast<uint32_t>(sanitized.size()));
+  std::printf("%zu frames of input, %u samples fixed by the sanitizer\n",
+              frames, fixed);
+
+  // Every stage works on copies made outside of the timing.
+  std::vector<float> scratch(input.size());
+  const auto sanitizeTime = Time(repetitions, frames, [&] {
+    std::memcpy(scratch.data(), input.data(), input.size() * sizeof(float));
+    SanitizeSamples(scratch.data(), static_cast<uint32_t>(scratch.size()));
+  });
+  const auto copyTime = Time(repetitions, frames, [&] {
+    std::memcpy(scratch.data(), input.data(), input.size() * sizeof(float));
+  });
+  std::printf("  %-18s %8.2f ns/frame\n", "sanitize", std::max(0.0, sanitizeTime - copyTime));
+
+  int failures = 0;
+  std::vector<uint8_t> stream;
+  stream.reserve(2 * input.size() * sizeof(float));
+  for (const auto& wireFormat : wireFormats) {
+    const auto time = Time(repetitions, frames, [&] {
+      Packetize(sanitized, wireFormat.format, stream);
+    });
+    const auto path = directory + "/" + wireFormat.name + ".bin";
+    std::printf("  %-18s %8.2f ns/frame, %zu bytes: ",
+                (std::string("packetize ") + wireFormat.name).c_str(), time, stream.size());
+
+    if (update) {
+      if (!WriteFile(path, stream)) {
+        std::printf("cannot write %s\n", path.c_str());
+        return 1;
+      }
+      std::printf("written to %s\n", path.c_str());
+      continue;
+    }
+
+    std::vector<uint8_t> expected;
+    if (!ReadFile(path, expected)) {
+      std::printf("cannot read %s\n", path.c_str());
+      failures++;
+      continue;
+    }
+    const auto mismatch = std::mismatch(stream.begin(), stream.end(),
+                                        expected.begin(), expected.end());
+    if (mismatch.first == stream.end() && mismatch.second == expected.end()) {
+      std::printf("matches %s\n", path.c_str());
+      continue;
+    }
+    const auto offset = static_cast<size_t>(mismatch.second - expected.begin());
+    std::printf("differs from %s at byte %zu (%s)%s\n",
+                path.c_str(), offset, Locate(expected, offset).c_str(),
+                stream.size() != expected.size() ? ", and in size" : "");
+    failures++;
+  }
+
+  if (failures > 0) {
+    std::printf("FAIL: %d wire formats differ from the reference vectors\n", failures);
+    return 1;
+  }
+  return 0;
+}
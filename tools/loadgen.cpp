@@ -0,0 +1,445 @@
+/* Synthetic multi-device load generator: finds how many concurrent streams
+ * one sender can sustain before IO cycles go late.
+ *
+ * Every simulated device has its own virtual HAL clock (a random drift of
+ * up to -D ppm and a random phase) and IO buffer size, and runs the output
+ * path of Device::WriteOutputData() on a pool of worker threads: flush the
+ * transport backlog, then split the cycle into datagrams with the real
+ * Packetizer and send them with the real Transport, e.g. to a loopback
+ * tools/receiver. A cycle misses its deadline when it is not done by the
+ * time the HAL would start the next one; the HAL then skips ahead, and so
+ * does the generator. On exit it reports the deadline misses and response
+ * times of every stream, and the CPU time of the whole process.
+ *
+ * With -L, every cycle also goes through the sanitize and limiter stage
+ * with the given ceiling in dBFS (the test tone is at -12 dBFS, so -L -15
+ * keeps the limiter busy), and the time it takes is reported separately.
+ *
+ * Builds from the plug-in sources on macOS, and on Linux against the few
+ * Mac types and constants they need in compat/.
+ *
+ * Usage: loadgen [-n streams] [-b frames[,frames...]] [-r rate[,rate...]]
+ *                [-c channels] [-F float32|int32|int24|int16] [-w threads]
+ *                [-D ppm] [-S seed] [-t seconds] [-s] [-L ceiling-dB]
+ *                [-d address:port]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "Limiter.h"
+#include "Metrics.h"
+#include "Packetizer.h"
+#include "Socket.h"
+#include "Transport.h"
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  volatile std::sig_atomic_t stopRequested = 0;
+
+  double Seconds(Clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+  }
+
+  struct Options {
+    unsigned streams { 4 };
+    std::vector<unsigned> bufferSizes { 512 };
+    std::vector<double> sampleRates { 48000 };
+    unsigned channels { 2 };
+    SampleFormat wireFormat { SampleFormat::Float32 };
+    unsigned threads { std::max(1u, std::thread::hardware_concurrency()) };
+    double drift { 100 };
+    uint64_t seed { 1 };
+    double duration { 10 };
+    std::string address { "127.0.0.1" };
+    unsigned short port { 30001 };
+    /** Sends every stream to its own port, from port on. */
+    bool spreadPorts { false };
+    /** Runs the sanitize and limiter stage, with limiterCeiling in dBFS. */
+    bool limit { false };
+    double limiterCeiling { 0 };
+  };
+
+  /** A device driven by a virtual HAL clock. */
+  class SimulatedDevice {
+  public:
+    SimulatedDevice(unsigned index,
+                    boost::asio::io_service& ioService,
+                    const Options& options,
+                    std::mt19937_64& random,
+                    Clock::time_point start)
+      : deviceID_(1000 + index)
+      , bufferSize_(options.bufferSizes[index % options.bufferSizes.size()])
+      , sampleRate_(options.sampleRates[index % options.sampleRates.size()])
+      , metrics_(Metrics::GetInstance().Acquire(deviceID_))
+      , transport_(ioService, deviceID_, Configuration(index, options), metrics_)
+      , frames_(bufferSize_ * options.channels)
+      , limit_(options.limit)
+      , limiter_(options.channels)
+      , limited_(frames_.size())
+    {
+      // The clock of every device runs at its own slightly wrong rate.
+      std::uniform_real_distribution<double> drift(-options.drift, options.drift);
+      period_ = bufferSize_ / sampleRate_ * (1 + drift(random) / 1e6);
+      std::uniform_real_distribution<double> phase(0, period_);
+      start_ = start + ToDuration(phase(random));
+      due_ = start_;
+
+      packetizer_.SetFormat(sampleRate_,
+                            static_cast<UInt8>(options.channels),
+                            SampleFormat::Float32,
+                            options.wireFormat);
+      for (size_t i = 0; i < frames_.size(); i++)
+        frames_[i] = 0.25f * static_cast<float>(
+            std::sin(2 * M_PI * 440 * (i / options.channels) / sampleRate_));
+      limiter_.SetCeiling(static_cast<float>(std::pow(10.0, options.limiterCeiling / 20)));
+      limiter_.Reset(sampleRate_);
+    }
+
+    ~SimulatedDevice() {
+      Metrics::GetInstance().Release(metrics_);
+    }
+
+    SimulatedDevice(const SimulatedDevice&) = delete;
+    SimulatedDevice& operator=(const SimulatedDevice&) = delete;
+
+    /** When the next IO cycle starts. */
+    Clock::time_point Due() const { return due_; }
+
+    /** Runs the IO cycle that is due. */
+    void RunCycle() {
+      auto now = Clock::now();
+      if (now >= due_ + ToDuration(period_)) {
+        // Too late for this cycle already: the HAL would skip ahead.
+        auto skipped = static_cast<uint64_t>(Seconds(now - due_) / period_);
+        misses_ += skipped;
+        cycles_ += skipped;
+        sampleTime_ += skipped * bufferSize_;
+        due_ += ToDuration(skipped * period_);
+      }
+
+      transport_.Flush();
+
+      // The HAL hands over a new buffer every cycle; the stage works in
+      // place, so it gets a copy of the test tone.
+      const float* frames = frames_.data();
+      if (limit_) {
+        std::copy(frames_.begin(), frames_.end(), limited_.begin());
+        auto stageStart = Clock::now();
+        SanitizeSamples(limited_.data(), static_cast<uint32_t>(limited_.size()));
+        limiter_.Process(limited_.data(), bufferSize_);
+        stageTimes_.push_back(static_cast<float>(Seconds(Clock::now() - stageStart)));
+        frames = limited_.data();
+      }
+
+      packetizer_.Packetize(frames,
+                            bufferSize_,
+                            sampleTime_,
+                            [this](const std::array<boost::asio::const_buffer, 2>& buffers) {
+        transport_.Send(buffers);
+      });
+
+      auto response = Seconds(Clock::now() - due_);
+      responseTimes_.push_back(static_cast<float>(response));
+      if (response > period_)
+        misses_++;
+      cycles_++;
+      sampleTime_ += bufferSize_;
+      due_ = start_ + ToDuration(cycles_ * period_);
+    }
+
+    void PrintReport() const {
+      auto sorted = responseTimes_;
+      std::sort(sorted.begin(), sorted.end());
+      auto percentile = [&sorted](double fraction) {
+        if (sorted.empty())
+          return 0.0;
+        auto index = std::min(static_cast<size_t>(fraction * sorted.size()),
+                              sorted.size() - 1);
+        return sorted[index] * 1000.0;
+      };
+      std::printf("  %4u %6u %8.0f %8.3f %8llu %8llu %8.3f %8.3f %8.3f %8llu %8llu\n",
+                  deviceID_,
+                  bufferSize_,
+                  sampleRate_,
+                  period_ * 1000.0,
+                  static_cast<unsigned long long>(cycles_),
+                  static_cast<unsigned long long>(misses_),
+                  percentile(0.5),
+                  percentile(0.99),
+                  sorted.empty() ? 0.0 : sorted.back() * 1000.0,
+                  static_cast<unsigned long long>(metrics_.packetsDropped),
+                  static_cast<unsigned long long>(metrics_.sendErrors));
+    }
+
+    /** Time the sanitize and limiter stage took in every cycle, in
+     * seconds.
+     */
+    const std::vector<float>& StageTimes() const { return stageTimes_; }
+
+    /** Duration of an IO cycle, in seconds. */
+    double Period() const { return period_; }
+
+    uint64_t Cycles() const { return cycles_; }
+    uint64_t Misses() const { return misses_; }
+
+  private:
+    static Clock::duration ToDuration(double seconds) {
+      return std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(seconds));
+    }
+
+    static DeviceConfiguration Configuration(unsigned index, const Options& options) {
+      DeviceConfiguration configuration;
+      configuration.uid = "loadgen-" + std::to_string(index);
+      configuration.name = configuration.uid;
+      auto port = options.spreadPorts ? options.port + index : options.port;
+      configuration.destinations = {
+        { options.address, static_cast<unsigned short>(port) }
+      };
+      return configuration;
+    }
+
+    const UInt32 deviceID_;
+    const UInt32 bufferSize_;
+    const Float64 sampleRate_;
+    DeviceMetrics& metrics_;
+    Transport transport_;
+    Packetizer packetizer_;
+    std::vector<float> frames_;
+    const bool limit_;
+    Limiter limiter_;
+    std::vector<float> limited_;
+    std::vector<float> stageTimes_;
+
+    /** Duration of an IO cycle on the clock of the device, in seconds. */
+    double period_;
+    Clock::time_point start_;
+    Clock::time_point due_;
+    Float64 sampleTime_ { 0 };
+    uint64_t cycles_ { 0 };
+    uint64_t misses_ { 0 };
+
+    /** Time from the start of every cycle to the end of its last send, in
+     * seconds.
+     */
+    std::vector<float> responseTimes_;
+  };
+
+  /** Runs the cycles of some devices, earliest deadline first. */
+  void RunWorker(const std::vector<SimulatedDevice*>& devices,
+                 Clock::time_point end) {
+    if (devices.empty())
+      return;
+    while (!stopRequested) {
+      auto next = *std::min_element(devices.begin(), devices.end(),
+                                    [](const SimulatedDevice* a, const SimulatedDevice* b) {
+        return a->Due() < b->Due();
+      });
+      if (next->Due() >= end)
+        return;
+      std::this_thread::sleep_until(next->Due());
+      next->RunCycle();
+    }
+  }
+
+  double CpuSeconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+        + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  }
+
+  template<typename T>
+  bool ParseList(const char* text, std::vector<T>& values) {
+    values.clear();
+    std::string list(text);
+    size_t position = 0;
+    while (position <= list.size()) {
+      auto comma = list.find(',', position);
+      if (comma == std::string::npos)
+        comma = list.size();
+      auto value = std::atof(list.substr(position, comma - position).c_str());
+      if (value <= 0)
+        return false;
+      values.push_back(static_cast<T>(value));
+      position = comma + 1;
+    }
+    return !values.empty();
+  }
+
+  bool ParseFormat(const char* text, SampleFormat& format) {
+    static const struct {
+      const char* name;
+      SampleFormat format;
+    } formats[] = {
+      { "float32", SampleFormat::Float32 },
+      { "int32", SampleFormat::Int32 },
+      { "int24", SampleFormat::Int24 },
+      { "int16", SampleFormat::Int16 },
+    };
+    for (const auto& entry : formats) {
+      if (std::strcmp(text, entry.name) == 0) {
+        format = entry.format;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Usage() {
+    std::fprintf(stderr,
+                 "usage: loadgen [-n streams] [-b frames[,frames...]] [-r rate[,rate...]]\n"
+                 "               [-c channels] [-F float32|int32|int24|int16] [-w threads]\n"
+                 "               [-D ppm] [-S seed] [-t seconds] [-s] [-L ceiling-dB]\n"
+                 "               [-d address:port]\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  bool valid = true;
+
+  int option;
+  while ((option = getopt(argc, argv, "n:b:r:c:F:w:D:S:t:sL:d:")) != -1) {
+    switch (option) {
+      case 'n':
+        options.streams = static_cast<unsigned>(std::atoi(optarg));
+        break;
+      case 'b':
+        valid &= ParseList(optarg, options.bufferSizes);
+        break;
+      case 'r':
+        valid &= ParseList(optarg, options.sampleRates);
+        break;
+      case 'c':
+        options.channels = static_cast<unsigned>(std::atoi(optarg));
+        break;
+      case 'F':
+        valid &= ParseFormat(optarg, options.wireFormat);
+        break;
+      case 'w':
+        options.threads = static_cast<unsigned>(std::atoi(optarg));
+        break;
+      case 'D':
+        options.drift = std::atof(optarg);
+        break;
+      case 'S':
+        options.seed = std::strtoull(optarg, nullptr, 0);
+        break;
+      case 't':
+        options.duration = std::atof(optarg);
+        break;
+      case 's':
+        options.spreadPorts = true;
+        break;
+      case 'L':
+        options.limit = true;
+        options.limiterCeiling = std::atof(optarg);
+        break;
+      case 'd': {
+        std::string address;
+        unsigned short port = 0;
+        valid &= SplitEndpoint(optarg, address, port);
+        options.address = address;
+        options.port = port;
+        break;
+      }
+      default:
+        valid = false;
+        break;
+    }
+  }
+  if (!valid || optind != argc || options.streams == 0 || options.threads == 0
+      || options.channels == 0 || options.channels > 255
+      || (options.limit && (options.channels > ChannelLayout::maxChannels
+                            || options.limiterCeiling > 0))) {
+    Usage();
+    return 2;
+  }
+
+  std::signal(SIGINT, [](int) { stopRequested = 1; });
+  std::signal(SIGTERM, [](int) { stopRequested = 1; });
+
+  // Give every device a little time to be created before its first cycle.
+  boost::asio::io_service ioService;
+  std::mt19937_64 random(options.seed);
+  const auto start = Clock::now() + std::chrono::milliseconds(100);
+  std::vector<std::unique_ptr<SimulatedDevice>> devices;
+  try {
+    for (unsigned i = 0; i < options.streams; i++)
+      devices.push_back(std::make_unique<SimulatedDevice>(i, ioService, options,
+                                                          random, start));
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "Cannot create the devices: %s\n", e.what());
+    return 1;
+  }
+
+  std::printf("%u streams on %u threads for %.1f s\n",
+              options.streams, options.threads, options.duration);
+
+  const auto end = start + std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(options.duration));
+  std::vector<std::vector<SimulatedDevice*>> assignments(options.threads);
+  for (size_t i = 0; i < devices.size(); i++)
+    assignments[i % options.threads].push_back(devices[i].get());
+
+  const auto cpuStart = CpuSeconds();
+  std::vector<std::thread> workers;
+  for (const auto& assignment : assignments)
+    workers.emplace_back(RunWorker, std::cref(assignment), end);
+  for (auto& worker : workers)
+    worker.join();
+  const auto cpu = CpuSeconds() - cpuStart;
+  const auto elapsed = std::max(Seconds(Clock::now() - start), 1e-9);
+
+  std::printf("\n  %4s %6s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n",
+              "dev", "frames", "rate", "period", "cycles", "misses",
+              "p50 ms", "p99 ms", "max ms", "dropped", "errors");
+  uint64_t cycles = 0, misses = 0;
+  std::vector<float> stageTimes;
+  double shortestPeriod = HUGE_VAL;
+  for (const auto& device : devices) {
+    device->PrintReport();
+    cycles += device->Cycles();
+    misses += device->Misses();
+    const auto& times = device->StageTimes();
+    stageTimes.insert(stageTimes.end(), times.begin(), times.end());
+    shortestPeriod = std::min(shortestPeriod, device->Period());
+  }
+  std::printf("\n%llu cycles, %llu deadline misses (%.3f%%)\n",
+              static_cast<unsigned long long>(cycles),
+              static_cast<unsigned long long>(misses),
+              cycles > 0 ? 100.0 * misses / cycles : 0.0);
+  if (!stageTimes.empty()) {
+    std::sort(stageTimes.begin(), stageTimes.end());
+    auto p99 = stageTimes[std::min(static_cast<size_t>(0.99 * stageTimes.size()),
+                                   stageTimes.size() - 1)];
+    std::printf("Sanitize and limit: p50 %.1f us, p99 %.1f us, max %.1f us "
+                "(p99 is %.3f%% of the shortest period)\n",
+                stageTimes[stageTimes.size() / 2] * 1e6,
+                p99 * 1e6,
+                stageTimes.back() * 1e6,
+                100.0 * p99 / shortestPeriod);
+  }
+  std::printf("CPU %.3f s in %.3f s: %.1f%% of one core, %.1f%% of %u cores\n",
+              cpu, elapsed, 100.0 * cpu / elapsed,
+              100.0 * cpu / elapsed / std::max(1u, std::thread::hardware_concurrency()),
+              std::max(1u, std::thread::hardware_concurrency()));
+  return misses > 0 ? 3 : 0;
+}
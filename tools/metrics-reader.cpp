@@ -0,0 +1,157 @@
+/* Prints the metrics the plug-in publishes in shared memory (see
+ * MetricsFormat.h). Only reads the segment, so it has no effect on
+ * coreaudiod.
+ *
+ * Usage: metrics-reader [-i seconds]
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "MetricsFormat.h"
+
+namespace {
+  uint64_t Load(const uint64_t& value) {
+    return __atomic_load_n(&value, __ATOMIC_RELAXED);
+  }
+
+  /** Returns the smallest value below which a fraction of the samples are. */
+  uint64_t Percentile(const MetricsHistogram& histogram,
+                      uint64_t count,
+                      double fraction) {
+    auto target = static_cast<uint64_t>(count * fraction);
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < kHistogramBuckets; bucket++) {
+      seen += Load(histogram.buckets[bucket]);
+      if (seen > target)
+        return HistogramBucketLowerBound(bucket);
+    }
+    return Load(histogram.max);
+  }
+
+  void PrintHistogram(const MetricsSegment& segment,
+                      const char* name,
+                      const MetricsHistogram& histogram) {
+    auto toMicroseconds = [&](uint64_t ticks) {
+      return static_cast<double>(ticks)
+          * segment.timebaseNumer / segment.timebaseDenom / 1000.0;
+    };
+
+    auto count = Load(histogram.count);
+    if (count == 0) {
+      std::printf("  %-20s no samples\n", name);
+      return;
+    }
+
+    std::printf("  %-20s n=%llu mean=%.1f p50=%.1f p99=%.1f p99.9=%.1f "
+                "max=%.1f us\n",
+                name,
+                static_cast<unsigned long long>(count),
+                toMicroseconds(Load(histogram.sum)) / count,
+                toMicroseconds(Percentile(histogram, count, 0.5)),
+                toMicroseconds(Percentile(histogram, count, 0.99)),
+                toMicroseconds(Percentile(histogram, count, 0.999)),
+                toMicroseconds(Load(histogram.max)));
+  }
+
+  void PrintCounter(const char* name, const uint64_t& value) {
+    std::printf("  %-20s %llu\n",
+                name, static_cast<unsigned long long>(Load(value)));
+  }
+
+  /** Prints levels in full scale as dBFS, one per channel. */
+  void PrintLevels(const char* name, uint32_t channels, const float* levels) {
+    std::printf("  %-20s", name);
+    for (uint32_t channel = 0; channel < channels && channel < kMetricsMaxChannels; channel++) {
+      float level;
+      __atomic_load(&levels[channel], &level, __ATOMIC_RELAXED);
+      if (level > 0)
+        std::printf(" %6.1f", 20 * std::log10(level));
+      else
+        std::printf(" %6s", "-inf");
+    }
+    std::printf("\n");
+  }
+
+  void Print(const MetricsSegment& segment) {
+    for (const auto& device : segment.devices) {
+      if (__atomic_load_n(&device.inUse, __ATOMIC_ACQUIRE) == 0)
+        continue;
+
+      std::printf("Device %u\n", device.deviceID);
+      PrintCounter("io_cycles", device.ioCycles);
+      PrintCounter("packets_sent", device.packetsSent);
+      PrintCounter("bytes_sent", device.bytesSent);
+      PrintCounter("send_errors", device.sendErrors);
+      PrintCounter("send_would_block", device.sendWouldBlock);
+      PrintCounter("packets_dropped", device.packetsDropped);
+      PrintCounter("degraded_cycles", device.degradedCycles);
+      PrintCounter("ring_overruns", device.ringOverruns);
+      PrintCounter("silence_cycles", device.silenceCycles);
+      PrintCounter("timestamp_reanchors", device.timeStampReanchors);
+      PrintCounter("socket_rebuilds", device.socketRebuilds);
+      PrintCounter("suspensions", device.suspensions);
+      PrintCounter("suspended_cycles", device.suspendedCycles);
+      PrintCounter("sanitized_samples", device.sanitizedSamples);
+      PrintCounter("limited_cycles", device.limitedCycles);
+      const auto channels = __atomic_load_n(&device.channels, __ATOMIC_RELAXED);
+      PrintLevels("peak_dbfs", channels, device.peakLevels);
+      PrintLevels("rms_dbfs", channels, device.rmsLevels);
+      PrintHistogram(segment, "io_operation", device.ioOperationDuration);
+      PrintHistogram(segment, "send", device.sendDuration);
+      PrintHistogram(segment, "resume", device.resumeDuration);
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  unsigned interval = 0;
+
+  int option;
+  while ((option = getopt(argc, argv, "i:")) != -1) {
+    if (option != 'i') {
+      std::fprintf(stderr, "usage: metrics-reader [-i seconds]\n");
+      return 2;
+    }
+    interval = static_cast<unsigned>(std::atoi(optarg));
+  }
+
+  auto fd = shm_open(kMetricsSegmentName, O_RDONLY, 0);
+  if (fd < 0) {
+    std::perror(kMetricsSegmentName);
+    return 1;
+  }
+
+  auto mapping = mmap(nullptr, sizeof(MetricsSegment), PROT_READ,
+                      MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    std::perror("mmap");
+    return 1;
+  }
+
+  const auto& segment = *static_cast<const MetricsSegment*>(mapping);
+  if (__atomic_load_n(&segment.magic, __ATOMIC_ACQUIRE) != kMetricsMagic
+      || segment.version != kMetricsVersion
+      || segment.timebaseDenom == 0) {
+    std::fprintf(stderr, "%s: not initialized or unsupported version\n",
+                 kMetricsSegmentName);
+    return 1;
+  }
+
+  for (;;) {
+    Print(segment);
+    if (interval == 0)
+      break;
+    std::printf("\n");
+    std::fflush(stdout);
+    sleep(interval);
+  }
+
+  return 0;
+}
@@ -0,0 +1,901 @@
+/* Reference receiver for the stream of the plug-in (see Packet.h), to
+ * measure jitter and losses without a Raspberry Pi. Listens on a unicast
+ * port or joins a multicast group, decodes every wire format to 32-bit
+ * float, and plays the audio out of an adaptive jitter buffer in real time
+ * into a file (raw interleaved float) or nowhere.
+ *
+ * The jitter buffer aims for a depth of a few times the measured jitter
+ * (RFC 3550 estimator) plus one packet. Once per report interval it skips
+ * audio if the buffer stayed deeper than needed, and inserts silence if it
+ * ran too low.
+ *
+ * A start marker (PacketType::Start) resets the buffer, which the pre-roll
+ * that follows fills at once. An end marker lets it play out what it has,
+ * fading out the last frames, and stop without counting underruns. What is
+ * left of a stream when a new one starts, or when the sample rate or the
+ * channels change, goes to the sink at once; only resyncs drop frames.
+ *
+ * When the plug-in sends latency probes (see ProbePayload), it also reports
+ * the distribution of the latency of every stage, from the start of the IO
+ * cycle to the output of the sink, and exits with status 3 if the p99 of
+ * the total goes over the budget given with -P. Across machines, the clocks
+ * must be synchronized (NTP, PTP) for the network stage to be meaningful.
+ *
+ * Usage: receiver [-a address] [-p port] [-o output.raw] [-m min-ms]
+ *                 [-i seconds] [-d seconds] [-P budget-ms]
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "Packet.h"
+#include "SampleConversion.h"
+#include "Socket.h"
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  /** How often audio is handed to the sink, like the period of a sound
+   * card.
+   */
+  constexpr std::chrono::milliseconds sinkPeriod { 5 };
+
+  /** Sample time distance beyond which the stream is considered to have
+   * restarted rather than jittered, in seconds.
+   */
+  constexpr double resyncThreshold { 2.0 };
+
+  /** Multiple of the jitter kept in the buffer. */
+  constexpr double jitterMargin { 4.0 };
+
+  volatile std::sig_atomic_t stopRequested = 0;
+
+  /** Stages of the pipeline measured by latency probes. */
+  enum Stage {
+    /** Start of the IO cycle to the plug-in getting the mixed output. */
+    kStageMix,
+    /** Plug-in getting the output to the last packet being sent. */
+    kStageSend,
+    /** Last packet sent to the probe arriving at the receiver. */
+    kStageNetwork,
+    /** Arrival to the first frame of the cycle leaving the sink. */
+    kStageBuffer,
+    /** Start of the IO cycle to the sink. */
+    kStageTotal,
+    kStageCount
+  };
+
+  const char* const stageNames[kStageCount] = {
+    "mix", "send", "network", "buffer", "total",
+  };
+
+  /** Nanoseconds of the wall clock, as in ProbePayload. */
+  int64_t WallClockNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  /** Returns the value below which a fraction of the sorted values are. */
+  double Percentile(const std::vector<double>& sorted, double fraction) {
+    auto index = static_cast<size_t>(fraction * sorted.size());
+    return sorted[std::min(index, sorted.size() - 1)];
+  }
+
+  double Seconds(Clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+  }
+
+  struct StreamFormat {
+    uint32_t sampleRate { 0 };
+    uint8_t channels { 0 };
+    SampleFormat format { SampleFormat::Float32 };
+
+    bool operator!=(const StreamFormat& other) const {
+      return sampleRate != other.sampleRate
+          || channels != other.channels
+          || format != other.format;
+    }
+  };
+
+  const char* FormatName(SampleFormat format) {
+    switch (format) {
+      case SampleFormat::Float32:
+        return "float32";
+      case SampleFormat::Int24:
+        return "int24";
+      case SampleFormat::Int16:
+        return "int16";
+      case SampleFormat::Int32:
+        return "int32";
+    }
+    return "unknown";
+  }
+
+  /** Counters over a report interval or over the whole run. */
+  struct Stats {
+    uint64_t packets { 0 };
+    uint64_t bytes { 0 };
+    int64_t lost { 0 };
+    uint64_t reordered { 0 };
+    uint64_t late { 0 };
+    uint64_t invalid { 0 };
+    uint64_t underrunFrames { 0 };
+    uint64_t playedFrames { 0 };
+    uint64_t skippedFrames { 0 };
+    uint64_t droppedFrames { 0 };
+    uint64_t insertedFrames { 0 };
+    uint64_t resyncs { 0 };
+    double minDepth { 0 };
+    double maxDepth { 0 };
+    double depthTotal { 0 };
+    uint64_t depthSamples { 0 };
+
+    void RecordDepth(double depth) {
+      if (depthSamples == 0 || depth < minDepth)
+        minDepth = depth;
+      if (depthSamples == 0 || depth > maxDepth)
+        maxDepth = depth;
+      depthTotal += depth;
+      depthSamples++;
+    }
+
+    void Add(const Stats& other) {
+      packets += other.packets;
+      bytes += other.bytes;
+      lost += other.lost;
+      reordered += other.reordered;
+      late += other.late;
+      invalid += other.invalid;
+      underrunFrames += other.underrunFrames;
+      playedFrames += other.playedFrames;
+      skippedFrames += other.skippedFrames;
+      droppedFrames += other.droppedFrames;
+      insertedFrames += other.insertedFrames;
+      resyncs += other.resyncs;
+      if (other.depthSamples > 0) {
+        if (depthSamples == 0 || other.minDepth < minDepth)
+          minDepth = other.minDepth;
+        if (depthSamples == 0 || other.maxDepth > maxDepth)
+          maxDepth = other.maxDepth;
+      }
+      depthTotal += other.depthTotal;
+      depthSamples += other.depthSamples;
+    }
+  };
+
+  /** Decoded audio waiting to be played, indexed by sample time. */
+  class JitterBuffer {
+  public:
+    void Clear() { chunks_.clear(); }
+
+    bool Empty() const { return chunks_.empty(); }
+
+    /** Sample time of the first buffered frame. */
+    uint64_t Start() const { return chunks_.begin()->first; }
+
+    /** Sample time following the last buffered frame. */
+    uint64_t End() const {
+      auto last = chunks_.rbegin();
+      return last->first + last->second.size() / channels_;
+    }
+
+    void SetChannels(unsigned channels) {
+      channels_ = channels;
+      Clear();
+    }
+
+    void Insert(uint64_t sampleTime, std::vector<float> samples) {
+      chunks_[sampleTime] = std::move(samples);
+    }
+
+    /** Copies the frames from \p position on into \p out, with silence
+     * where nothing was received, and forgets everything before the end.
+     *
+     * @return The number of frames missing.
+     */
+    uint64_t Read(uint64_t position, uint64_t frames, float* out) {
+      std::fill(out, out + frames * channels_, 0.0f);
+      uint64_t found = 0;
+      const auto end = position + frames;
+      for (auto it = chunks_.begin(); it != chunks_.end();) {
+        const auto chunkStart = it->first;
+        const auto chunkEnd = chunkStart + it->second.size() / channels_;
+        if (chunkStart >= end)
+          break;
+
+        auto from = std::max(chunkStart, position);
+        auto to = std::min(chunkEnd, end);
+        if (from < to) {
+          std::copy(it->second.begin() + (from - chunkStart) * channels_,
+                    it->second.begin() + (to - chunkStart) * channels_,
+                    out + (from - position) * channels_);
+          found += to - from;
+        }
+
+        if (chunkEnd <= end)
+          it = chunks_.erase(it);
+        else
+          ++it;
+      }
+      return frames - found;
+    }
+
+    /** Returns the number of frames buffered from \p position on. */
+    uint64_t FramesFrom(uint64_t position) const {
+      uint64_t frames = 0;
+      for (const auto& chunk : chunks_) {
+        auto chunkEnd = chunk.first + chunk.second.size() / channels_;
+        if (chunkEnd > position)
+          frames += chunkEnd - std::max(chunk.first, position);
+      }
+      return frames;
+    }
+
+    /** Forgets the frames before a position. */
+    void Discard(uint64_t position) {
+      while (!chunks_.empty()) {
+        auto it = chunks_.begin();
+        if (it->first + it->second.size() / channels_ > position)
+          break;
+        chunks_.erase(it);
+      }
+    }
+
+  private:
+    unsigned channels_ { 1 };
+    std::map<uint64_t, std::vector<float>> chunks_;
+  };
+
+  class Receiver {
+  public:
+    Receiver(FILE* output, double minLatency)
+      : output_(output)
+      , minLatency_(minLatency)
+    {}
+
+    void OnDatagram(const uint8_t* data, size_t size, Clock::time_point now) {
+      PacketHeader header;
+      if (size < sizeof(header)) {
+        interval_.invalid++;
+        return;
+      }
+      std::memcpy(&header, data, sizeof(header));
+      if (header.magic == kPacketMagic && header.version != kPacketVersion) {
+        // The layout of the stream changed along with the version.
+        if (!versionMismatch_)
+          std::fprintf(stderr, "warning: dropping datagrams of protocol "
+                       "version %u, this receiver speaks version %u\n",
+                       static_cast<unsigned>(header.version),
+                       static_cast<unsigned>(kPacketVersion));
+        versionMismatch_ = true;
+        interval_.invalid++;
+        return;
+      }
+      if (header.magic != kPacketMagic
+          || header.channels == 0
+          || header.sampleRate == 0
+          || static_cast<uint8_t>(header.format) > 3) {
+        interval_.invalid++;
+        return;
+      }
+
+      interval_.packets++;
+      interval_.bytes += size;
+      CountSequence(header.sequenceNumber);
+
+      StreamFormat format;
+      format.sampleRate = header.sampleRate;
+      format.channels = header.channels;
+      format.format = header.format;
+      if (format != format_)
+        SetFormat(format);
+
+      if (header.type == PacketType::Probe) {
+        OnProbe(header, data + sizeof(header), size - sizeof(header));
+        return;
+      }
+      if (header.type == PacketType::Start) {
+        OnStart(header);
+        return;
+      }
+      if (header.type == PacketType::End) {
+        OnEnd(header, now);
+        return;
+      }
+      if (header.type != PacketType::Audio)
+        return;
+
+      const auto payloadSize = size - sizeof(header);
+      const auto sampleCount = static_cast<size_t>(header.frameCount)
+          * header.channels;
+      if (payloadSize != sampleCount * BytesPerSample(header.format)) {
+        interval_.invalid++;
+        return;
+      }
+
+      // The pre-roll arrives in a burst, which is not jitter.
+      if (header.sampleTime >= preRollEnd_)
+        UpdateJitter(header.sampleTime, now);
+
+      if (playing_) {
+        auto distance = static_cast<double>(header.sampleTime)
+            - static_cast<double>(playPosition_);
+        if (std::fabs(distance) > resyncThreshold * format_.sampleRate) {
+          interval_.resyncs++;
+          Reset();
+        } else if (header.sampleTime + header.frameCount <= playPosition_) {
+          interval_.late++;
+          return;
+        }
+      }
+
+      std::vector<float> samples(sampleCount);
+      auto convert = GetSampleConverter(header.format, SampleFormat::Float32);
+      if (convert != nullptr)
+        convert(data + sizeof(header), samples.data(),
+                static_cast<uint32_t>(sampleCount));
+      else
+        std::memcpy(samples.data(), data + sizeof(header), payloadSize);
+      buffer_.Insert(header.sampleTime, std::move(samples));
+      packetFrames_ = header.frameCount;
+
+      if (!playing_ && buffer_.End() - buffer_.Start() >= TargetFrames()) {
+        playing_ = true;
+        playPosition_ = buffer_.Start();
+        sinkStart_ = now;
+        sinkFrames_ = 0;
+      }
+    }
+
+    /** Hands the audio due by now to the sink. */
+    void OnTick(Clock::time_point now) {
+      if (!playing_)
+        return;
+
+      auto due = static_cast<uint64_t>(Seconds(now - sinkStart_)
+                                       * format_.sampleRate);
+      auto frames = due - sinkFrames_;
+      if (frames == 0)
+        return;
+      sinkFrames_ = due;
+
+      scratch_.resize(frames * format_.channels);
+      std::fill(scratch_.begin(), scratch_.end(), 0.0f);
+
+      // Silence inserted to grow the buffer comes first.
+      auto inserted = std::min(frames, pendingInsert_);
+      pendingInsert_ -= inserted;
+      interval_.insertedFrames += inserted;
+
+      auto played = frames - inserted;
+      if (ending_) {
+        // Nothing comes after the end of the stream.
+        played = std::min(played, endPosition_ > playPosition_
+                                  ? endPosition_ - playPosition_ : 0);
+        scratch_.resize((inserted + played) * format_.channels);
+      }
+      Play(scratch_.data() + inserted * format_.channels, played);
+      ResolveProbes(played, due - frames + inserted, now);
+      playPosition_ += played;
+
+      if (output_ != nullptr)
+        std::fwrite(scratch_.data(), sizeof(float), scratch_.size(), output_);
+
+      interval_.RecordDepth(DepthSeconds());
+
+      if (ending_ && playPosition_ >= endPosition_) {
+        std::printf("Stream ended at %llu\n",
+                    static_cast<unsigned long long>(endPosition_));
+        Reset();
+      }
+    }
+
+    /** Prints the counters of the interval and adapts the buffer depth. */
+    void Report(double elapsed) {
+      Adapt();
+
+      const auto& s = interval_;
+      std::printf("%7.1f s  %5llu pkts  %4lld lost  %3llu reord  %3llu late  "
+                  "%6llu underrun  jitter %6.3f ms  "
+                  "depth %6.2f/%6.2f/%6.2f ms  target %6.2f ms\n",
+                  elapsed,
+                  static_cast<unsigned long long>(s.packets),
+                  static_cast<long long>(s.lost),
+                  static_cast<unsigned long long>(s.reordered),
+                  static_cast<unsigned long long>(s.late),
+                  static_cast<unsigned long long>(s.underrunFrames),
+                  jitter_ * 1000.0,
+                  s.minDepth * 1000.0,
+                  s.depthSamples > 0 ? s.depthTotal / s.depthSamples * 1000.0 : 0,
+                  s.maxDepth * 1000.0,
+                  TargetSeconds() * 1000.0);
+      std::fflush(stdout);
+
+      total_.Add(interval_);
+      interval_ = Stats();
+    }
+
+    void PrintSummary(double elapsed) {
+      total_.Add(interval_);
+      const auto& s = total_;
+      auto received = static_cast<double>(s.packets);
+      std::printf("\nSummary over %.1f s\n", elapsed);
+      std::printf("  packets            %llu (%llu bytes, %llu invalid)\n",
+                  static_cast<unsigned long long>(s.packets),
+                  static_cast<unsigned long long>(s.bytes),
+                  static_cast<unsigned long long>(s.invalid));
+      std::printf("  lost               %lld (%.3f%%)\n",
+                  static_cast<long long>(s.lost),
+                  received + s.lost > 0 ? 100.0 * s.lost / (received + s.lost) : 0);
+      std::printf("  reordered          %llu\n",
+                  static_cast<unsigned long long>(s.reordered));
+      std::printf("  late               %llu\n",
+                  static_cast<unsigned long long>(s.late));
+      std::printf("  underrun frames    %llu\n",
+                  static_cast<unsigned long long>(s.underrunFrames));
+      std::printf("  played frames      %llu\n",
+                  static_cast<unsigned long long>(s.playedFrames));
+      std::printf("  skipped frames     %llu\n",
+                  static_cast<unsigned long long>(s.skippedFrames));
+      std::printf("  dropped frames     %llu\n",
+                  static_cast<unsigned long long>(s.droppedFrames));
+      std::printf("  inserted frames    %llu\n",
+                  static_cast<unsigned long long>(s.insertedFrames));
+      std::printf("  resyncs            %llu\n",
+                  static_cast<unsigned long long>(s.resyncs));
+      std::printf("  jitter             %.3f ms\n", jitter_ * 1000.0);
+      std::printf("  depth min/avg/max  %.2f/%.2f/%.2f ms\n",
+                  s.minDepth * 1000.0,
+                  s.depthSamples > 0 ? s.depthTotal / s.depthSamples * 1000.0 : 0,
+                  s.maxDepth * 1000.0);
+    }
+
+    /** Prints the latency of every stage.
+     *
+     * @param budget The maximum p99 of the total latency, in seconds, or 0.
+     * @return Whether the latency is within the budget.
+     */
+    bool PrintLatency(double budget) const {
+      if (latencies_[kStageTotal].empty()) {
+        if (budget > 0 || probesMissed_ > 0)
+          std::printf("\nNo latency probes played (%llu missed)\n",
+                      static_cast<unsigned long long>(probesMissed_));
+        return budget <= 0;
+      }
+
+      std::printf("\nLatency over %zu probes (%llu missed), in ms\n",
+                  latencies_[kStageTotal].size(),
+                  static_cast<unsigned long long>(probesMissed_));
+      std::printf("  %-8s %9s %9s %9s %9s %9s\n",
+                  "stage", "p50", "p90", "p99", "p99.9", "max");
+      double totalP99 = 0;
+      for (unsigned stage = 0; stage < kStageCount; stage++) {
+        auto sorted = latencies_[stage];
+        std::sort(sorted.begin(), sorted.end());
+        std::printf("  %-8s %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+                    stageNames[stage],
+                    Percentile(sorted, 0.5),
+                    Percentile(sorted, 0.9),
+                    Percentile(sorted, 0.99),
+                    Percentile(sorted, 0.999),
+                    sorted.back());
+        if (stage == kStageTotal)
+          totalP99 = Percentile(sorted, 0.99) / 1000.0;
+      }
+
+      if (budget > 0 && totalP99 > budget) {
+        std::printf("FAIL: p99 latency %.3f ms over the budget of %.3f ms\n",
+                    totalP99 * 1000.0, budget * 1000.0);
+        return false;
+      }
+      return true;
+    }
+
+  private:
+    /** A probe waiting for its cycle to be played. */
+    struct PendingProbe {
+      ProbePayload payload;
+      int64_t arrivalTime;
+    };
+
+    void OnStart(const PacketHeader& header) {
+      std::printf("Stream started at %llu with %u frames of pre-roll\n",
+                  static_cast<unsigned long long>(header.sampleTime),
+                  header.frameCount);
+      PlayOut();
+      Reset();
+      preRollEnd_ = header.sampleTime + header.frameCount;
+    }
+
+    void OnEnd(const PacketHeader& header, Clock::time_point now) {
+      ending_ = true;
+      endPosition_ = header.sampleTime;
+      fadeOutFrames_ = header.frameCount;
+
+      // Play whatever arrived, even if it never reached the target depth.
+      if (!playing_ && !buffer_.Empty()) {
+        playing_ = true;
+        playPosition_ = buffer_.Start();
+        sinkStart_ = now;
+        sinkFrames_ = 0;
+      }
+      if (!playing_)
+        Reset();
+    }
+
+    /** Reads the next frames of the stream, from playPosition_ on, with
+     * silence where nothing was received.
+     */
+    void Play(float* out, uint64_t frames) {
+      auto missing = buffer_.Read(playPosition_, frames, out);
+      interval_.underrunFrames += missing;
+      interval_.playedFrames += frames - missing;
+      if (ending_)
+        FadeOut(out, frames);
+    }
+
+    /** Hands what is left of the stream to the sink at once, before a new
+     * stream or a new layout replaces it.
+     */
+    void PlayOut() {
+      if (buffer_.Empty())
+        return;
+      if (!playing_)
+        playPosition_ = buffer_.Start();
+      auto end = ending_ ? endPosition_ : buffer_.End();
+      if (end <= playPosition_)
+        return;
+
+      auto frames = end - playPosition_;
+      scratch_.assign(frames * format_.channels, 0.0f);
+      Play(scratch_.data(), frames);
+      playPosition_ = end;
+      if (output_ != nullptr)
+        std::fwrite(scratch_.data(), sizeof(float), scratch_.size(), output_);
+    }
+
+    /** Fades out the frames being played that are among the last ones of
+     * the stream.
+     *
+     * @param out The frames, from playPosition_ on.
+     * @param frames The number of frames.
+     */
+    void FadeOut(float* out, uint64_t frames) {
+      if (fadeOutFrames_ == 0)
+        return;
+      auto fadeStart = endPosition_ > fadeOutFrames_
+          ? endPosition_ - fadeOutFrames_ : 0;
+      auto from = std::max(fadeStart, playPosition_);
+      auto to = playPosition_ + frames;
+      if (from >= to)
+        return;
+      ApplyGainRamp(out + (from - playPosition_) * format_.channels,
+                    SampleFormat::Float32,
+                    format_.channels,
+                    static_cast<uint32_t>(to - from),
+                    static_cast<float>(endPosition_ - 1 - from) / fadeOutFrames_,
+                    -1.0f / fadeOutFrames_);
+    }
+
+    void OnProbe(const PacketHeader& header, const uint8_t* data, size_t size) {
+      if (size != sizeof(ProbePayload)) {
+        interval_.invalid++;
+        return;
+      }
+      if (playing_ && header.sampleTime < playPosition_) {
+        // The cycle was played before its probe arrived.
+        probesMissed_++;
+        return;
+      }
+      PendingProbe probe;
+      std::memcpy(&probe.payload, data, sizeof(probe.payload));
+      probe.arrivalTime = WallClockNow();
+      probes_[header.sampleTime] = probe;
+    }
+
+    /** Records the latency of the probes whose cycle starts in the frames
+     * being played.
+     *
+     * @param frames The number of frames played from playPosition_ on.
+     * @param firstSinkFrame The index of the first of them in the output of
+     *        the sink.
+     */
+    void ResolveProbes(uint64_t frames,
+                       uint64_t firstSinkFrame,
+                       Clock::time_point now) {
+      const auto wallClockNow = WallClockNow();
+      for (auto it = probes_.begin();
+           it != probes_.end() && it->first < playPosition_ + frames;
+           it = probes_.erase(it)) {
+        if (it->first < playPosition_) {
+          // Skipped, or lost in a resync.
+          probesMissed_++;
+          continue;
+        }
+
+        auto sinkTime = sinkStart_ + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(
+                static_cast<double>(firstSinkFrame + it->first - playPosition_)
+                / format_.sampleRate));
+        auto sinkWallClock = wallClockNow
+            - std::chrono::duration_cast<std::chrono::nanoseconds>(
+                now - sinkTime).count();
+
+        const auto& probe = it->second.payload;
+        auto milliseconds = [](uint64_t from, int64_t to) {
+          return static_cast<double>(to - static_cast<int64_t>(from)) / 1e6;
+        };
+        latencies_[kStageMix].push_back(
+            milliseconds(probe.cycleStartTime, probe.writeStartTime));
+        latencies_[kStageSend].push_back(
+            milliseconds(probe.writeStartTime, probe.sendEndTime));
+        latencies_[kStageNetwork].push_back(
+            milliseconds(probe.sendEndTime, it->second.arrivalTime));
+        latencies_[kStageBuffer].push_back(
+            milliseconds(it->second.arrivalTime, sinkWallClock));
+        latencies_[kStageTotal].push_back(
+            milliseconds(probe.cycleStartTime, sinkWallClock));
+      }
+    }
+
+    void SetFormat(const StreamFormat& format) {
+      std::printf("Format: %u Hz, %u channels, %s\n",
+                  format.sampleRate,
+                  static_cast<unsigned>(format.channels),
+                  FormatName(format.format));
+      if (output_ != nullptr && format_.channels != 0
+          && format.channels != format_.channels)
+        std::fprintf(stderr, "warning: the number of channels changed, "
+                     "the output file mixes layouts\n");
+      auto layoutChanged = format.sampleRate != format_.sampleRate
+          || format.channels != format_.channels;
+
+      // The samples are decoded on arrival, so a change of the wire format
+      // alone (e.g. OverloadPolicy::Degrade) does not disturb playback.
+      // Otherwise the rest of the stream is played out in its own layout.
+      if (layoutChanged) {
+        PlayOut();
+        Reset();
+        buffer_.SetChannels(format.channels);
+      }
+      format_ = format;
+    }
+
+    /** Starts buffering again from scratch. */
+    void Reset() {
+      interval_.droppedFrames += buffer_.FramesFrom(playing_ ? playPosition_ : 0);
+      buffer_.Clear();
+      probesMissed_ += probes_.size();
+      probes_.clear();
+      playing_ = false;
+      ending_ = false;
+      pendingInsert_ = 0;
+      jitter_ = 0;
+      hasTransit_ = false;
+    }
+
+    void CountSequence(uint32_t sequenceNumber) {
+      if (hasSequence_) {
+        auto delta = static_cast<int32_t>(sequenceNumber - nextSequence_);
+        if (delta < 0) {
+          // Counted as lost when the gap was seen.
+          interval_.reordered++;
+          interval_.lost--;
+          return;
+        }
+        interval_.lost += delta;
+      }
+      hasSequence_ = true;
+      nextSequence_ = sequenceNumber + 1;
+    }
+
+    /** Interarrival jitter, as in RFC 3550. */
+    void UpdateJitter(uint64_t sampleTime, Clock::time_point now) {
+      auto transit = Seconds(now.time_since_epoch())
+          - static_cast<double>(sampleTime) / format_.sampleRate;
+      if (hasTransit_)
+        jitter_ += (std::fabs(transit - transit_) - jitter_) / 16.0;
+      transit_ = transit;
+      hasTransit_ = true;
+    }
+
+    double TargetSeconds() const {
+      auto packet = format_.sampleRate > 0
+          ? static_cast<double>(packetFrames_) / format_.sampleRate : 0;
+      return std::max(minLatency_, packet + jitterMargin * jitter_);
+    }
+
+    uint64_t TargetFrames() const {
+      return static_cast<uint64_t>(TargetSeconds() * format_.sampleRate);
+    }
+
+    double DepthSeconds() const {
+      auto end = buffer_.Empty() ? playPosition_ : buffer_.End();
+      return (static_cast<double>(end) - static_cast<double>(playPosition_))
+          / format_.sampleRate;
+    }
+
+    /** Moves the play position so that the lowest depth of the interval
+     * gets back to the target.
+     */
+    void Adapt() {
+      if (!playing_ || interval_.depthSamples == 0)
+        return;
+
+      auto target = TargetSeconds();
+      auto error = interval_.minDepth - target;
+      if (error > target / 2) {
+        auto frames = static_cast<uint64_t>(error * format_.sampleRate);
+        playPosition_ += frames;
+        buffer_.Discard(playPosition_);
+        interval_.skippedFrames += frames;
+      } else if (error < -target / 2) {
+        pendingInsert_ += static_cast<uint64_t>(-error * format_.sampleRate);
+      }
+    }
+
+    FILE* output_;
+    const double minLatency_;
+
+    StreamFormat format_;
+    JitterBuffer buffer_;
+    uint32_t packetFrames_ { 0 };
+
+    bool versionMismatch_ { false };
+
+    bool hasSequence_ { false };
+    uint32_t nextSequence_ { 0 };
+
+    bool hasTransit_ { false };
+    double transit_ { 0 };
+    double jitter_ { 0 };
+
+    bool playing_ { false };
+    uint64_t playPosition_ { 0 };
+    Clock::time_point sinkStart_;
+    uint64_t sinkFrames_ { 0 };
+    uint64_t pendingInsert_ { 0 };
+    std::vector<float> scratch_;
+
+    /** Sample time following the pre-roll of the stream. */
+    uint64_t preRollEnd_ { 0 };
+
+    /** Set by an end marker, until the stream is played out. */
+    bool ending_ { false };
+    uint64_t endPosition_ { 0 };
+    uint32_t fadeOutFrames_ { 0 };
+
+    Stats interval_;
+    Stats total_;
+
+    std::map<uint64_t, PendingProbe> probes_;
+    std::array<std::vector<double>, kStageCount> latencies_;
+    uint64_t probesMissed_ { 0 };
+  };
+
+
+  void Usage() {
+    std::fprintf(stderr, "usage: receiver [-a address] [-p port] "
+                 "[-o output.raw] [-m min-ms] [-i seconds] [-d seconds]\n"
+                 "                [-P budget-ms]\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const char* address = "239.255.0.1";
+  unsigned short port = 30001;
+  const char* outputPath = nullptr;
+  double minLatency = 0.005;
+  double interval = 1;
+  double duration = 0;
+  double latencyBudget = 0;
+
+  int option;
+  while ((option = getopt(argc, argv, "a:p:o:m:i:d:P:")) != -1) {
+    switch (option) {
+      case 'a':
+        address = optarg;
+        break;
+      case 'p':
+        port = static_cast<unsigned short>(std::atoi(optarg));
+        break;
+      case 'o':
+        outputPath = optarg;
+        break;
+      case 'm':
+        minLatency = std::atof(optarg) / 1000.0;
+        break;
+      case 'i':
+        interval = std::atof(optarg);
+        break;
+      case 'd':
+        duration = std::atof(optarg);
+        break;
+      case 'P':
+        latencyBudget = std::atof(optarg) / 1000.0;
+        break;
+      default:
+        Usage();
+        return 2;
+    }
+  }
+  if (optind != argc || interval <= 0) {
+    Usage();
+    return 2;
+  }
+
+  FILE* output = nullptr;
+  if (outputPath != nullptr) {
+    output = std::fopen(outputPath, "wb");
+    if (output == nullptr) {
+      std::perror(outputPath);
+      return 1;
+    }
+  }
+
+  auto fd = OpenReceiveSocket(address, port);
+  if (fd < 0)
+    return 1;
+
+  std::signal(SIGINT, [](int) { stopRequested = 1; });
+  std::signal(SIGTERM, [](int) { stopRequested = 1; });
+
+  Receiver receiver(output, minLatency);
+  const auto start = Clock::now();
+  auto nextTick = start + sinkPeriod;
+  auto nextReport = start + std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(interval));
+  std::vector<uint8_t> datagram(65536);
+
+  while (stopRequested == 0) {
+    auto now = Clock::now();
+    if (duration > 0 && Seconds(now - start) >= duration)
+      break;
+
+    auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+        nextTick - now).count();
+    pollfd descriptor { fd, POLLIN, 0 };
+    if (poll(&descriptor, 1, static_cast<int>(std::max<long long>(timeout, 0))) > 0) {
+      // Drain everything that arrived before handing audio to the sink.
+      for (;;) {
+        auto size = recv(fd, datagram.data(), datagram.size(), MSG_DONTWAIT);
+        if (size < 0)
+          break;
+        receiver.OnDatagram(datagram.data(), static_cast<size_t>(size),
+                            Clock::now());
+      }
+    }
+
+    now = Clock::now();
+    if (now >= nextTick) {
+      receiver.OnTick(now);
+      nextTick += sinkPeriod;
+      if (nextTick < now)
+        nextTick = now + sinkPeriod;
+    }
+    if (now >= nextReport) {
+      receiver.Report(Seconds(now - start));
+      nextReport += std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(interval));
+    }
+  }
+
+  receiver.PrintSummary(Seconds(Clock::now() - start));
+  auto withinBudget = receiver.PrintLatency(latencyBudget);
+  close(fd);
+  if (output != nullptr)
+    std::fclose(output);
+  return withinBudget ? 0 : 3;
+}
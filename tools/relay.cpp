@@ -0,0 +1,445 @@
+/* Userspace network impairment emulator: relays the datagrams of the
+ * plug-in to a receiver (e.g. tools/receiver) through a simulated bad
+ * network, without root privileges.
+ *
+ * Every impairment decision is drawn from a seeded generator in the order
+ * the datagrams arrive, so a given seed produces the same losses, delays,
+ * duplicates and reorderings on every run and on every platform. Only the
+ * bandwidth cap depends on the actual arrival times.
+ *
+ * Usage: relay -l address:port -f address:port [-s seed]
+ *              [-L loss%] [-G p%,r%[,bad-loss%[,good-loss%]]]
+ *              [-d delay-ms] [-j jitter-ms] [-u duplicate%]
+ *              [-r reorder%] [-b kbit/s] [-q packets]
+ *              [-t seconds] [-J report.json]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+
+#include "Socket.h"
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  volatile std::sig_atomic_t stopRequested = 0;
+
+  double Seconds(Clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+  }
+
+  /** Deterministic random numbers. The standard distributions are not
+   * specified bit for bit, so they are implemented here to give the same
+   * sequence with every standard library.
+   */
+  class Random {
+  public:
+    explicit Random(uint64_t seed) : state_(seed) {}
+
+    /** splitmix64. */
+    uint64_t Next() {
+      uint64_t z = (state_ += 0x9e3779b97f4a7c15ull);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+    }
+
+    /** Uniform in [0, 1). */
+    double Uniform() { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    bool Chance(double probability) {
+      return probability > 0 && Uniform() < probability;
+    }
+
+    /** Standard normal (Box-Muller). */
+    double Normal() {
+      auto u1 = 1.0 - Uniform();
+      auto u2 = Uniform();
+      return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+    }
+
+  private:
+    uint64_t state_;
+  };
+
+  struct Impairments {
+    uint64_t seed { 1 };
+    /** Independent loss probability. */
+    double loss { 0 };
+    /** Gilbert-Elliott model: probabilities of going from the good to the
+     * bad state and back, and of losing a datagram in each state.
+     */
+    bool gilbertElliott { false };
+    double goodToBad { 0 };
+    double badToGood { 1 };
+    double badLoss { 1 };
+    double goodLoss { 0 };
+    /** Fixed one-way delay and standard deviation of the jitter, in
+     * seconds.
+     */
+    double delay { 0 };
+    double jitter { 0 };
+    double duplicate { 0 };
+    /** Probability that a datagram skips the delay and overtakes the ones
+     * queued before it.
+     */
+    double reorder { 0 };
+    /** Bandwidth cap in bits per second, 0 for none. */
+    double bandwidth { 0 };
+    /** Datagrams waiting for the link beyond which new ones are dropped. */
+    unsigned queueLimit { 1000 };
+  };
+
+  struct Stats {
+    uint64_t received { 0 };
+    uint64_t receivedBytes { 0 };
+    uint64_t forwarded { 0 };
+    uint64_t forwardedBytes { 0 };
+    uint64_t randomLosses { 0 };
+    uint64_t burstLosses { 0 };
+    uint64_t queueDrops { 0 };
+    uint64_t duplicated { 0 };
+    uint64_t reordered { 0 };
+    uint64_t sendErrors { 0 };
+    double delayTotal { 0 };
+    double delayMax { 0 };
+  };
+
+  /** A datagram waiting for its departure time. */
+  struct Pending {
+    Clock::time_point departure;
+    /** Arrival order, to keep the order of datagrams leaving together. */
+    uint64_t index;
+    Clock::time_point arrival;
+    std::vector<uint8_t> data;
+
+    bool operator>(const Pending& other) const {
+      return departure != other.departure
+          ? departure > other.departure
+          : index > other.index;
+    }
+  };
+
+  class Relay {
+  public:
+    explicit Relay(const Impairments& impairments)
+      : impairments_(impairments)
+      , random_(impairments.seed)
+    {}
+
+    /** Decides the fate of a datagram that just arrived. */
+    void OnDatagram(const uint8_t* data, size_t size, Clock::time_point now) {
+      stats_.received++;
+      stats_.receivedBytes += size;
+      const auto index = arrivals_++;
+
+      // Draw every decision, even for datagrams that end up dropped, so
+      // that the sequence of draws does not depend on the outcome.
+      bool bad = badState_;
+      if (impairments_.gilbertElliott)
+        badState_ = random_.Chance(bad ? 1 - impairments_.badToGood
+                                       : impairments_.goodToBad);
+      auto burstLoss = impairments_.gilbertElliott
+          && random_.Chance(bad ? impairments_.badLoss : impairments_.goodLoss);
+      auto randomLoss = random_.Chance(impairments_.loss);
+      auto copies = random_.Chance(impairments_.duplicate) ? 2 : 1;
+      auto reorder = random_.Chance(impairments_.reorder);
+      double delays[2];
+      for (auto& delay : delays)
+        delay = reorder ? 0
+            : std::max(0.0, impairments_.delay
+                            + impairments_.jitter * random_.Normal());
+
+      if (burstLoss) {
+        stats_.burstLosses++;
+        return;
+      }
+      if (randomLoss) {
+        stats_.randomLosses++;
+        return;
+      }
+      if (copies > 1)
+        stats_.duplicated++;
+
+      for (int copy = 0; copy < copies; copy++) {
+        if (queue_.size() >= impairments_.queueLimit) {
+          stats_.queueDrops++;
+          continue;
+        }
+        auto departure = now + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(delays[copy]));
+        queue_.push({ departure, index, now,
+                      std::vector<uint8_t>(data, data + size) });
+      }
+    }
+
+    /** Sends the datagrams that are due. */
+    void SendDue(int fd,
+                 const sockaddr_storage& destination,
+                 socklen_t length,
+                 Clock::time_point now) {
+      while (!queue_.empty() && queue_.top().departure <= now) {
+        // The link serializes datagrams at the capped rate.
+        if (impairments_.bandwidth > 0 && linkFreeAt_ > now)
+          return;
+
+        const auto& pending = queue_.top();
+        auto sent = sendto(fd, pending.data.data(), pending.data.size(), 0,
+                           reinterpret_cast<const sockaddr*>(&destination),
+                           length);
+        if (sent < 0) {
+          stats_.sendErrors++;
+        } else {
+          stats_.forwarded++;
+          stats_.forwardedBytes += pending.data.size();
+          auto delay = Seconds(now - pending.arrival);
+          stats_.delayTotal += delay;
+          stats_.delayMax = std::max(stats_.delayMax, delay);
+          if (hasSent_ && pending.index < lastSentIndex_)
+            stats_.reordered++;
+          lastSentIndex_ = std::max(lastSentIndex_, pending.index);
+          hasSent_ = true;
+        }
+
+        if (impairments_.bandwidth > 0)
+          linkFreeAt_ = now + std::chrono::duration_cast<Clock::duration>(
+              std::chrono::duration<double>(
+                  pending.data.size() * 8.0 / impairments_.bandwidth));
+        queue_.pop();
+      }
+    }
+
+    /** Time until the next datagram may leave. */
+    Clock::time_point NextDeparture(Clock::time_point now) const {
+      if (queue_.empty())
+        return now + std::chrono::milliseconds(100);
+      return std::max(queue_.top().departure,
+                      impairments_.bandwidth > 0 ? linkFreeAt_ : now);
+    }
+
+    const Stats& GetStats() const { return stats_; }
+
+  private:
+    const Impairments impairments_;
+    Random random_;
+    bool badState_ { false };
+    uint64_t arrivals_ { 0 };
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> queue_;
+    Clock::time_point linkFreeAt_;
+    bool hasSent_ { false };
+    uint64_t lastSentIndex_ { 0 };
+    Stats stats_;
+  };
+
+  void PrintReport(FILE* out,
+                   const Impairments& impairments,
+                   const Stats& stats,
+                   double elapsed) {
+    auto lost = stats.randomLosses + stats.burstLosses + stats.queueDrops;
+    std::fprintf(out,
+                 "{\n"
+                 "  \"seed\": %llu,\n"
+                 "  \"duration\": %.3f,\n"
+                 "  \"impairments\": { \"loss\": %g, \"gilbertElliott\": %s, "
+                 "\"goodToBad\": %g, \"badToGood\": %g, \"badLoss\": %g, "
+                 "\"goodLoss\": %g, \"delay\": %g, \"jitter\": %g, "
+                 "\"duplicate\": %g, \"reorder\": %g, \"bandwidth\": %g, "
+                 "\"queueLimit\": %u },\n"
+                 "  \"received\": %llu,\n"
+                 "  \"receivedBytes\": %llu,\n"
+                 "  \"forwarded\": %llu,\n"
+                 "  \"forwardedBytes\": %llu,\n"
+                 "  \"randomLosses\": %llu,\n"
+                 "  \"burstLosses\": %llu,\n"
+                 "  \"queueDrops\": %llu,\n"
+                 "  \"lossRate\": %g,\n"
+                 "  \"duplicated\": %llu,\n"
+                 "  \"reordered\": %llu,\n"
+                 "  \"sendErrors\": %llu,\n"
+                 "  \"meanDelay\": %g,\n"
+                 "  \"maxDelay\": %g\n"
+                 "}\n",
+                 static_cast<unsigned long long>(impairments.seed),
+                 elapsed,
+                 impairments.loss,
+                 impairments.gilbertElliott ? "true" : "false",
+                 impairments.goodToBad,
+                 impairments.badToGood,
+                 impairments.badLoss,
+                 impairments.goodLoss,
+                 impairments.delay,
+                 impairments.jitter,
+                 impairments.duplicate,
+                 impairments.reorder,
+                 impairments.bandwidth,
+                 impairments.queueLimit,
+                 static_cast<unsigned long long>(stats.received),
+                 static_cast<unsigned long long>(stats.receivedBytes),
+                 static_cast<unsigned long long>(stats.forwarded),
+                 static_cast<unsigned long long>(stats.forwardedBytes),
+                 static_cast<unsigned long long>(stats.randomLosses),
+                 static_cast<unsigned long long>(stats.burstLosses),
+                 static_cast<unsigned long long>(stats.queueDrops),
+                 stats.received > 0 ? static_cast<double>(lost) / stats.received : 0,
+                 static_cast<unsigned long long>(stats.duplicated),
+                 static_cast<unsigned long long>(stats.reordered),
+                 static_cast<unsigned long long>(stats.sendErrors),
+                 stats.forwarded > 0 ? stats.delayTotal / stats.forwarded : 0,
+                 stats.delayMax);
+  }
+
+  /** Parses a percentage into a probability. */
+  double Percent(const char* text) {
+    return std::atof(text) / 100.0;
+  }
+
+  void Usage() {
+    std::fprintf(stderr,
+                 "usage: relay -l address:port -f address:port [-s seed]\n"
+                 "             [-L loss%%] [-G p%%,r%%[,bad-loss%%[,good-loss%%]]]\n"
+                 "             [-d delay-ms] [-j jitter-ms] [-u duplicate%%]\n"
+                 "             [-r reorder%%] [-b kbit/s] [-q packets]\n"
+                 "             [-t seconds] [-J report.json]\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const char* listen = nullptr;
+  const char* forward = nullptr;
+  const char* reportPath = nullptr;
+  double duration = 0;
+  Impairments impairments;
+
+  int option;
+  while ((option = getopt(argc, argv, "l:f:s:L:G:d:j:u:r:b:q:t:J:")) != -1) {
+    switch (option) {
+      case 'l':
+        listen = optarg;
+        break;
+      case 'f':
+        forward = optarg;
+        break;
+      case 's':
+        impairments.seed = std::strtoull(optarg, nullptr, 0);
+        break;
+      case 'L':
+        impairments.loss = Percent(optarg);
+        break;
+      case 'G': {
+        double values[4] = { 0, 100, 100, 0 };
+        auto count = std::sscanf(optarg, "%lf,%lf,%lf,%lf",
+                                 &values[0], &values[1], &values[2], &values[3]);
+        if (count < 2) {
+          Usage();
+          return 2;
+        }
+        impairments.gilbertElliott = true;
+        impairments.goodToBad = values[0] / 100.0;
+        impairments.badToGood = values[1] / 100.0;
+        impairments.badLoss = values[2] / 100.0;
+        impairments.goodLoss = values[3] / 100.0;
+        break;
+      }
+      case 'd':
+        impairments.delay = std::atof(optarg) / 1000.0;
+        break;
+      case 'j':
+        impairments.jitter = std::atof(optarg) / 1000.0;
+        break;
+      case 'u':
+        impairments.duplicate = Percent(optarg);
+        break;
+      case 'r':
+        impairments.reorder = Percent(optarg);
+        break;
+      case 'b':
+        impairments.bandwidth = std::atof(optarg) * 1000.0;
+        break;
+      case 'q':
+        impairments.queueLimit = static_cast<unsigned>(std::atoi(optarg));
+        break;
+      case 't':
+        duration = std::atof(optarg);
+        break;
+      case 'J':
+        reportPath = optarg;
+        break;
+      default:
+        Usage();
+        return 2;
+    }
+  }
+
+  std::string listenAddress, forwardAddress;
+  unsigned short listenPort, forwardPort;
+  if (optind != argc
+      || listen == nullptr || !SplitEndpoint(listen, listenAddress, listenPort)
+      || forward == nullptr || !SplitEndpoint(forward, forwardAddress, forwardPort)) {
+    Usage();
+    return 2;
+  }
+
+  auto in = OpenReceiveSocket(listenAddress.c_str(), listenPort);
+  if (in < 0)
+    return 1;
+  sockaddr_storage destination;
+  socklen_t destinationLength;
+  auto out = OpenSendSocket(forwardAddress.c_str(), forwardPort,
+                            destination, destinationLength);
+  if (out < 0)
+    return 1;
+
+  std::signal(SIGINT, [](int) { stopRequested = 1; });
+  std::signal(SIGTERM, [](int) { stopRequested = 1; });
+
+  Relay relay(impairments);
+  const auto start = Clock::now();
+  std::vector<uint8_t> datagram(65536);
+
+  while (stopRequested == 0) {
+    auto now = Clock::now();
+    if (duration > 0 && Seconds(now - start) >= duration)
+      break;
+
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        relay.NextDeparture(now) - now).count();
+    pollfd descriptor { in, POLLIN, 0 };
+    if (poll(&descriptor, 1, static_cast<int>(std::max<long long>(wait, 0))) > 0) {
+      for (;;) {
+        auto size = recv(in, datagram.data(), datagram.size(), MSG_DONTWAIT);
+        if (size < 0)
+          break;
+        relay.OnDatagram(datagram.data(), static_cast<size_t>(size), Clock::now());
+      }
+    }
+
+    relay.SendDue(out, destination, destinationLength, Clock::now());
+  }
+
+  auto elapsed = Seconds(Clock::now() - start);
+  PrintReport(stdout, impairments, relay.GetStats(), elapsed);
+  if (reportPath != nullptr) {
+    auto file = std::fopen(reportPath, "w");
+    if (file == nullptr) {
+      std::perror(reportPath);
+      return 1;
+    }
+    PrintReport(file, impairments, relay.GetStats(), elapsed);
+    std::fclose(file);
+  }
+
+  close(in);
+  close(out);
+  return 0;
+}
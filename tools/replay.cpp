@@ -0,0 +1,299 @@
+/* Replays a packet capture of the plug-in (see CaptureWriter) to one or more
+ * receivers, to reproduce what a receiver got in the field or to load-test
+ * receivers.
+ *
+ * The datagrams go out at their original pace, faster (-s 2 for twice the
+ * speed) or as fast as possible (-s 0). When the capture is looped, the
+ * sequence numbers and sample times are shifted on every pass, so that the
+ * receivers see a continuous stream rather than a jump back in time.
+ *
+ * Usage: replay [-s speed] [-n loops] [-D device] [-l]
+ *               capture-file address:port...
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CaptureFormat.h"
+#include "Packet.h"
+#include "Socket.h"
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  volatile std::sig_atomic_t stopRequested = 0;
+
+  double Seconds(Clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+  }
+
+  /** A captured datagram. */
+  struct Datagram {
+    uint64_t sendTime;
+    uint32_t deviceID;
+    std::vector<uint8_t> data;
+  };
+
+  /** How far the stream of a device moves on every pass of a loop. */
+  struct StreamSpan {
+    uint32_t firstSequence { 0 };
+    uint32_t lastSequence { 0 };
+    uint64_t firstSampleTime { UINT64_MAX };
+    uint64_t endSampleTime { 0 };
+    unsigned datagrams { 0 };
+  };
+
+  struct Capture {
+    CaptureFileHeader header;
+    std::vector<Datagram> datagrams;
+  };
+
+  bool ReadCapture(const char* path, Capture& capture) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      std::perror(path);
+      return false;
+    }
+    if (!file.read(reinterpret_cast<char*>(&capture.header), sizeof(capture.header))
+        || capture.header.magic != kCaptureMagic) {
+      std::fprintf(stderr, "%s: not a capture file\n", path);
+      return false;
+    }
+    if (capture.header.version != kCaptureVersion
+        || capture.header.recordSize < sizeof(CaptureRecord)) {
+      std::fprintf(stderr, "%s: unsupported version %u\n",
+                   path, capture.header.version);
+      return false;
+    }
+
+    // The file may have been copied while it was written: only dataSize
+    // bytes are known to be complete.
+    std::vector<char> data(capture.header.dataSize);
+    file.read(data.data(), data.size());
+    data.resize(file.gcount());
+
+    size_t offset = 0;
+    while (offset + capture.header.recordSize <= data.size()) {
+      CaptureRecord record;
+      std::memcpy(&record, &data[offset], sizeof(record));
+      auto payload = offset + capture.header.recordSize;
+      if (payload + record.size > data.size())
+        break;
+
+      Datagram datagram;
+      datagram.sendTime = record.sendTime;
+      datagram.deviceID = record.deviceID;
+      datagram.data.assign(&data[payload], &data[payload] + record.size);
+      capture.datagrams.push_back(std::move(datagram));
+      offset = (payload + record.size + kCaptureAlignment - 1)
+          / kCaptureAlignment * kCaptureAlignment;
+    }
+    if (data.size() < capture.header.dataSize)
+      std::fprintf(stderr, "%s: truncated, %zu datagrams read\n",
+                   path, capture.datagrams.size());
+    return true;
+  }
+
+  /** Returns the header of a datagram of the plug-in, or nullptr. */
+  PacketHeader* Header(std::vector<uint8_t>& data) {
+    if (data.size() < sizeof(PacketHeader))
+      return nullptr;
+    auto header = reinterpret_cast<PacketHeader*>(data.data());
+    return header->magic == kPacketMagic ? header : nullptr;
+  }
+
+  std::map<uint32_t, StreamSpan> ComputeSpans(std::vector<Datagram>& datagrams) {
+    std::map<uint32_t, StreamSpan> spans;
+    for (auto& datagram : datagrams) {
+      auto header = Header(datagram.data);
+      if (header == nullptr)
+        continue;
+      auto& span = spans[datagram.deviceID];
+      if (span.datagrams++ == 0)
+        span.firstSequence = header->sequenceNumber;
+      span.lastSequence = header->sequenceNumber;
+      if (header->type == PacketType::Audio) {
+        span.firstSampleTime = std::min(span.firstSampleTime, header->sampleTime);
+        span.endSampleTime = std::max(span.endSampleTime,
+                                      header->sampleTime + header->frameCount);
+      }
+    }
+    return spans;
+  }
+
+  void PrintCapture(const Capture& capture,
+                    const std::map<uint32_t, StreamSpan>& spans) {
+    auto duration = capture.datagrams.empty()
+        ? 0.0 : capture.datagrams.back().sendTime / 1e9;
+    std::printf("%zu datagrams over %.3f s, %llu dropped from the capture\n",
+                capture.datagrams.size(), duration,
+                static_cast<unsigned long long>(capture.header.droppedCount));
+    for (const auto& entry : spans) {
+      const auto& span = entry.second;
+      std::printf("  device %u: %u datagrams, sequence %u-%u",
+                  entry.first, span.datagrams,
+                  span.firstSequence, span.lastSequence);
+      if (span.firstSampleTime < span.endSampleTime)
+        std::printf(", samples %llu-%llu",
+                    static_cast<unsigned long long>(span.firstSampleTime),
+                    static_cast<unsigned long long>(span.endSampleTime));
+      std::printf("\n");
+    }
+  }
+
+  /** A receiver the capture is replayed to. */
+  struct Destination {
+    int fd;
+    sockaddr_storage address;
+    socklen_t length;
+  };
+
+  void Usage() {
+    std::fprintf(stderr,
+                 "usage: replay [-s speed] [-n loops] [-D device] [-l]\n"
+                 "              capture-file address:port...\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  double speed = 1;
+  unsigned loops = 1;
+  bool filterDevice = false;
+  uint32_t device = 0;
+  bool listOnly = false;
+
+  int option;
+  while ((option = getopt(argc, argv, "s:n:D:l")) != -1) {
+    switch (option) {
+      case 's':
+        speed = std::atof(optarg);
+        break;
+      case 'n':
+        loops = static_cast<unsigned>(std::atoi(optarg));
+        break;
+      case 'D':
+        filterDevice = true;
+        device = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 0));
+        break;
+      case 'l':
+        listOnly = true;
+        break;
+      default:
+        Usage();
+        return 2;
+    }
+  }
+  if (optind >= argc || speed < 0 || (!listOnly && optind + 1 >= argc)) {
+    Usage();
+    return 2;
+  }
+
+  Capture capture;
+  if (!ReadCapture(argv[optind], capture))
+    return 1;
+  if (filterDevice)
+    capture.datagrams.erase(
+        std::remove_if(capture.datagrams.begin(), capture.datagrams.end(),
+                       [device](const Datagram& datagram) {
+                         return datagram.deviceID != device;
+                       }),
+        capture.datagrams.end());
+  auto spans = ComputeSpans(capture.datagrams);
+  PrintCapture(capture, spans);
+  if (listOnly)
+    return 0;
+  if (capture.datagrams.empty())
+    return 1;
+
+  std::vector<Destination> destinations;
+  for (int i = optind + 1; i < argc; i++) {
+    std::string address;
+    unsigned short port;
+    if (!SplitEndpoint(argv[i], address, port)) {
+      Usage();
+      return 2;
+    }
+    Destination destination;
+    destination.fd = OpenSendSocket(address.c_str(), port,
+                                    destination.address, destination.length);
+    if (destination.fd < 0)
+      return 1;
+    destinations.push_back(destination);
+  }
+
+  std::signal(SIGINT, [](int) { stopRequested = 1; });
+  std::signal(SIGTERM, [](int) { stopRequested = 1; });
+
+  // A pass lasts as long as the capture plus the mean interval, so the
+  // first datagram of the next pass does not follow the last one at once.
+  const auto& datagrams = capture.datagrams;
+  const auto passDuration = datagrams.back().sendTime
+      + datagrams.back().sendTime / std::max<size_t>(datagrams.size() - 1, 1);
+
+  uint64_t sent = 0, bytes = 0, errors = 0;
+  double maxLateness = 0;
+  const auto start = Clock::now();
+  for (unsigned pass = 0; (loops == 0 || pass < loops) && !stopRequested; pass++) {
+    for (const auto& datagram : datagrams) {
+      if (stopRequested)
+        break;
+
+      if (speed > 0) {
+        auto due = start + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(
+                (pass * passDuration + datagram.sendTime) / 1e9 / speed));
+        auto now = Clock::now();
+        if (due > now)
+          std::this_thread::sleep_until(due);
+        else
+          maxLateness = std::max(maxLateness, Seconds(now - due));
+      }
+
+      auto data = datagram.data;
+      if (auto header = Header(data)) {
+        const auto& span = spans[datagram.deviceID];
+        header->sequenceNumber += pass * (span.lastSequence - span.firstSequence + 1);
+        if (span.firstSampleTime < span.endSampleTime)
+          header->sampleTime += pass * (span.endSampleTime - span.firstSampleTime);
+      }
+
+      for (const auto& destination : destinations) {
+        auto result = sendto(destination.fd, data.data(), data.size(), 0,
+                             reinterpret_cast<const sockaddr*>(&destination.address),
+                             destination.length);
+        if (result < 0) {
+          errors++;
+        } else {
+          sent++;
+          bytes += data.size();
+        }
+      }
+    }
+  }
+
+  auto elapsed = Seconds(Clock::now() - start);
+  std::printf("Sent %llu datagrams (%llu bytes, %llu errors) in %.3f s: "
+              "%.0f datagrams/s, %.3f Mbit/s\n",
+              static_cast<unsigned long long>(sent),
+              static_cast<unsigned long long>(bytes),
+              static_cast<unsigned long long>(errors),
+              elapsed,
+              elapsed > 0 ? sent / elapsed : 0.0,
+              elapsed > 0 ? bytes * 8 / elapsed / 1e6 : 0.0);
+  if (speed > 0)
+    std::printf("Max lateness %.3f ms\n", maxLateness * 1000.0);
+
+  for (const auto& destination : destinations)
+    close(destination.fd);
+  return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,229 @@
+/* Checks that the real-time stages of the output path neither allocate nor
+ * lock: runs a simulated stream through the plug-in's own sanitizer,
+ * limiter, meters, fades, sample conversions and packetizer, sending every
+ * datagram to a loopback socket, with a counting operator new (and, on
+ * Linux, pthread_mutex_lock) armed around the IO cycles.
+ *
+ * The stream is a tone with overs, NaNs and denormals mixed in, so that
+ * every stage does real work, and the wire format changes every minute of
+ * stream time, as the Degrade overload policy does on the IO thread. The
+ * cycles run as fast as possible: ten minutes of stream take a few
+ * seconds. Exits with status 1 if anything allocated or locked.
+ *
+ * Usage: rt-check [-t minutes] [-r rate] [-b frames] [-c channels]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <vector>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+#include <sys/uio.h>
+
+#include "Limiter.h"
+#include "Packetizer.h"
+#include "SampleConversion.h"
+#include "Socket.h"
+
+namespace {
+  /** Set while an IO cycle runs. */
+  std::atomic<bool> armed { false };
+  std::atomic<uint64_t> allocations { 0 };
+  std::atomic<uint64_t> locks { 0 };
+
+  void* Allocate(size_t size) {
+    if (armed.load(std::memory_order_relaxed))
+      allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto p = std::malloc(size == 0 ? 1 : size))
+      return p;
+    throw std::bad_alloc();
+  }
+}
+
+void* operator new(size_t size) { return Allocate(size); }
+void* operator new[](size_t size) { return Allocate(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+#ifdef __linux__
+/** Counts the locks taken by std::mutex and friends, and forwards them to
+ * the C library.
+ */
+extern "C" int pthread_mutex_lock(pthread_mutex_t* mutex) {
+  typedef int (*LockFunction)(pthread_mutex_t*);
+  static auto lock = reinterpret_cast<LockFunction>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+  if (armed.load(std::memory_order_relaxed))
+    locks.fetch_add(1, std::memory_order_relaxed);
+  return lock(mutex);
+}
+#endif
+
+namespace {
+  const SampleFormat wireFormats[] = {
+    SampleFormat::Float32, SampleFormat::Int24, SampleFormat::Int16, SampleFormat::Int32,
+  };
+
+  struct Options {
+    double minutes { 10 };
+    double sampleRate { 48000 };
+    uint32_t bufferFrames { 512 };
+    uint32_t channels { 2 };
+  };
+
+  /** Fills a cycle with a tone that goes over full scale now and then, with
+   * a NaN and a denormal in some cycles.
+   */
+  void FillCycle(std::vector<float>& samples,
+                 uint64_t sampleTime,
+                 const Options& options) {
+    const double level = (sampleTime / options.bufferFrames) % 500 < 5 ? 1.5 : 0.5;
+    for (uint32_t frame = 0; frame < options.bufferFrames; frame++) {
+      auto value = static_cast<float>(
+          level * std::sin(2.0 * M_PI * 997.0 * (sampleTime + frame) / options.sampleRate));
+      for (uint32_t channel = 0; channel < options.channels; channel++)
+        samples[frame * options.channels + channel] = value;
+    }
+    if ((sampleTime / options.bufferFrames) % 97 == 0) {
+      samples[0] = std::numeric_limits<float>::quiet_NaN();
+      samples[1] = std::numeric_limits<float>::denorm_min();
+    }
+  }
+
+  void Usage() {
+    std::fprintf(stderr, "usage: rt-check [-t minutes] [-r rate] [-b frames] [-c channels]\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  int option;
+  while ((option = getopt(argc, argv, "t:r:b:c:")) != -1) {
+    switch (option) {
+      case 't':
+        options.minutes = std::atof(optarg);
+        break;
+      case 'r':
+        options.sampleRate = std::atof(optarg);
+        break;
+      case 'b':
+        options.bufferFrames = static_cast<uint32_t>(std::atoi(optarg));
+        break;
+      case 'c':
+        options.channels = static_cast<uint32_t>(std::atoi(optarg));
+        break;
+      default:
+        Usage();
+        return 2;
+    }
+  }
+  if (optind != argc || options.minutes <= 0 || options.sampleRate <= 0
+      || options.bufferFrames == 0 || options.channels == 0
+      || options.channels > ChannelLayout::maxChannels) {
+    Usage();
+    return 2;
+  }
+
+  auto receiver = OpenReceiveSocket("127.0.0.1", 0);
+  if (receiver < 0)
+    return 1;
+  sockaddr_in destination;
+  socklen_t length = sizeof(destination);
+  getsockname(receiver, reinterpret_cast<sockaddr*>(&destination), &length);
+  destination.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  auto sender = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sender < 0) {
+    std::perror("socket");
+    return 1;
+  }
+
+  // Everything the IO cycles use exists before the first one, as in the
+  // plug-in between StartIO() and StopIO().
+  std::vector<float> cycle(options.bufferFrames * options.channels);
+  std::vector<uint8_t> discard(65536);
+  std::vector<float> peaks(options.channels);
+  std::vector<float> rms(options.channels);
+  Limiter limiter(options.channels);
+  limiter.SetCeiling(0.89f);
+  limiter.Reset(options.sampleRate);
+  Packetizer packetizer;
+  const uint32_t fadeFrames = 128;
+  uint64_t datagrams = 0;
+  uint64_t sendErrors = 0;
+  uint64_t limitedCycles = 0;
+  auto send = [&](const std::array<boost::asio::const_buffer, 2>& buffers) {
+    iovec parts[2];
+    for (unsigned i = 0; i < 2; i++) {
+      parts[i].iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(buffers[i]));
+      parts[i].iov_len = boost::asio::buffer_size(buffers[i]);
+    }
+    msghdr message {};
+    message.msg_name = &destination;
+    message.msg_namelen = sizeof(destination);
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+    if (sendmsg(sender, &message, 0) < 0)
+      sendErrors++;
+    datagrams++;
+  };
+
+  const auto cycles = static_cast<uint64_t>(options.minutes * 60 * options.sampleRate
+                                            / options.bufferFrames);
+  const auto cyclesPerFormat = static_cast<uint64_t>(60 * options.sampleRate
+                                                     / options.bufferFrames);
+  uint64_t sampleTime = 0;
+  for (uint64_t index = 0; index < cycles; index++) {
+    FillCycle(cycle, sampleTime, options);
+
+    armed = true;
+    if (index % cyclesPerFormat == 0)
+      packetizer.SetFormat(options.sampleRate,
+                           static_cast<UInt8>(options.channels),
+                           SampleFormat::Float32,
+                           wireFormats[index / cyclesPerFormat % 4]);
+    SanitizeSamples(cycle.data(), static_cast<uint32_t>(cycle.size()));
+    if (limiter.Process(cycle.data(), options.bufferFrames))
+      limitedCycles++;
+    MeasureLevels(cycle.data(), SampleFormat::Float32, options.channels,
+                  options.bufferFrames, peaks.data(), rms.data());
+    if (sampleTime < fadeFrames)
+      ApplyGainRamp(cycle.data(), SampleFormat::Float32, options.channels,
+                    std::min<uint32_t>(fadeFrames - static_cast<uint32_t>(sampleTime),
+                                       options.bufferFrames),
+                    static_cast<float>(sampleTime) / fadeFrames, 1.0f / fadeFrames);
+    packetizer.Packetize(cycle.data(), options.bufferFrames, sampleTime, send);
+    armed = false;
+
+    while (recv(receiver, discard.data(), discard.size(), MSG_DONTWAIT) > 0) {}
+    sampleTime += options.bufferFrames;
+  }
+
+  std::printf("%llu cycles (%.1f minutes of stream), %llu datagrams, "
+              "%llu send errors, %llu limited cycles\n",
+              static_cast<unsigned long long>(cycles),
+              cycles * options.bufferFrames / options.sampleRate / 60,
+              static_cast<unsigned long long>(datagrams),
+              static_cast<unsigned long long>(sendErrors),
+              static_cast<unsigned long long>(limitedCycles));
+  std::printf("allocations %llu, locks %llu\n",
+              static_cast<unsigned long long>(allocations.load()),
+              static_cast<unsigned long long>(locks.load()));
+  close(sender);
+  close(receiver);
+
+  if (allocations > 0 || locks > 0) {
+    std::printf("FAIL: the IO cycles allocated or locked\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,266 @@
+/* Simulates the stream of a device across sample rate switches, to count
+ * the frames a receiver loses at every switch (with tools/relay in between
+ * for network losses on top).
+ *
+ * Every rate is played for a while and sent the way the plug-in does it,
+ * through its own Packetizer: a start marker and the pre-roll, the IO
+ * cycles in real time, then the end marker sent when IO stops for the
+ * configuration change, and the format packet of the new rate. The audio is
+ * a sine tone. The frames and datagrams sent are printed at the end, to be
+ * compared with the played and skipped frames of the receiver.
+ *
+ * Usage: switch-sim -f address:port [-r rate[,rate...]] [-s seconds]
+ *                   [-b frames] [-c channels] [-w wire-format]
+ *                   [-p pre-roll] [-F fade]
+ */
+
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Packetizer.h"
+#include "Socket.h"
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  volatile std::sig_atomic_t stopRequested = 0;
+
+  struct Counters {
+    uint64_t datagrams { 0 };
+    uint64_t sendErrors { 0 };
+    uint64_t frames { 0 };
+    uint64_t preRollFrames { 0 };
+    uint64_t streams { 0 };
+  };
+
+  class Sender {
+  public:
+    Sender(int fd, const sockaddr_storage& destination, socklen_t length)
+      : fd_(fd)
+      , destination_(destination)
+      , length_(length)
+    {}
+
+    void Send(const std::array<boost::asio::const_buffer, 2>& buffers) {
+      size_t size = 0;
+      for (const auto& buffer : buffers) {
+        std::memcpy(datagram_ + size,
+                    boost::asio::buffer_cast<const void*>(buffer),
+                    boost::asio::buffer_size(buffer));
+        size += boost::asio::buffer_size(buffer);
+      }
+      auto sent = sendto(fd_, datagram_, size, 0,
+                         reinterpret_cast<const sockaddr*>(&destination_),
+                         length_);
+      if (sent < 0)
+        counters_.sendErrors++;
+      counters_.datagrams++;
+    }
+
+    void SendHeader(const PacketHeader& header) {
+      Send({{
+        boost::asio::buffer(&header, sizeof(header)),
+        boost::asio::const_buffer(),
+      }});
+    }
+
+    Counters& GetCounters() { return counters_; }
+
+  private:
+    const int fd_;
+    const sockaddr_storage destination_;
+    const socklen_t length_;
+    uint8_t datagram_[Packetizer::maxDatagramSize];
+    Counters counters_;
+  };
+
+  struct Options {
+    std::vector<double> sampleRates { 44100, 48000, 96000, 48000 };
+    double seconds { 1 };
+    unsigned bufferFrames { 512 };
+    unsigned channels { 2 };
+    SampleFormat wireFormat { SampleFormat::Float32 };
+    unsigned preRollFrames { 512 };
+    unsigned fadeFrames { 128 };
+  };
+
+  /** Plays one rate, from StartIO to StopIO, as Device does. */
+  void PlayStream(Sender& sender,
+                  Packetizer& packetizer,
+                  const Options& options,
+                  double sampleRate) {
+    auto& counters = sender.GetCounters();
+    auto send = [&](const std::array<boost::asio::const_buffer, 2>& buffers) {
+      sender.Send(buffers);
+    };
+
+    // The pre-roll takes the place of the frames before the first cycle.
+    sender.SendHeader(packetizer.MakeHeader(PacketType::Start,
+                                            options.preRollFrames, 0));
+    std::vector<float> cycle(options.bufferFrames * options.channels);
+    for (unsigned sent = 0; sent < options.preRollFrames;) {
+      auto frames = std::min(options.bufferFrames, options.preRollFrames - sent);
+      packetizer.Packetize(cycle.data(), frames, sent, send);
+      sent += frames;
+    }
+    counters.preRollFrames += options.preRollFrames;
+    counters.frames += options.preRollFrames;
+    counters.streams++;
+
+    const auto cycles = static_cast<uint64_t>(options.seconds * sampleRate
+                                              / options.bufferFrames);
+    const auto start = Clock::now();
+    uint64_t sampleTime = 0;
+    for (uint64_t index = 0; index < cycles && stopRequested == 0; index++) {
+      std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(sampleTime / sampleRate)));
+
+      for (unsigned frame = 0; frame < options.bufferFrames; frame++) {
+        auto value = static_cast<float>(
+            0.5 * std::sin(2 * M_PI * 1000.0 * (sampleTime + frame) / sampleRate));
+        for (unsigned channel = 0; channel < options.channels; channel++)
+          cycle[frame * options.channels + channel] = value;
+      }
+      packetizer.Packetize(cycle.data(),
+                           options.bufferFrames,
+                           sampleTime + options.preRollFrames,
+                           send);
+      sampleTime += options.bufferFrames;
+      counters.frames += options.bufferFrames;
+    }
+
+    sender.SendHeader(packetizer.MakeHeader(PacketType::End,
+                                            options.fadeFrames,
+                                            sampleTime + options.preRollFrames));
+  }
+
+  bool ParseFormat(const char* name, SampleFormat& format) {
+    const std::pair<const char*, SampleFormat> formats[] = {
+      { "float32", SampleFormat::Float32 },
+      { "int24", SampleFormat::Int24 },
+      { "int16", SampleFormat::Int16 },
+      { "int32", SampleFormat::Int32 },
+    };
+    for (const auto& entry : formats) {
+      if (std::strcmp(name, entry.first) == 0) {
+        format = entry.second;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Usage() {
+    std::fprintf(stderr,
+                 "usage: switch-sim -f address:port [-r rate[,rate...]] [-s seconds]\n"
+                 "                  [-b frames] [-c channels] [-w wire-format]\n"
+                 "                  [-p pre-roll] [-F fade]\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const char* forward = nullptr;
+  Options options;
+
+  int option;
+  while ((option = getopt(argc, argv, "f:r:s:b:c:w:p:F:")) != -1) {
+    switch (option) {
+      case 'f':
+        forward = optarg;
+        break;
+      case 'r': {
+        options.sampleRates.clear();
+        for (char* rate = std::strtok(optarg, ","); rate != nullptr;
+             rate = std::strtok(nullptr, ","))
+          options.sampleRates.push_back(std::atof(rate));
+        break;
+      }
+      case 's':
+        options.seconds = std::atof(optarg);
+        break;
+      case 'b':
+        options.bufferFrames = static_cast<unsigned>(std::atoi(optarg));
+        break;
+      case 'c':
+        options.channels = static_cast<unsigned>(std::atoi(optarg));
+        break;
+      case 'w':
+        if (!ParseFormat(optarg, options.wireFormat)) {
+          Usage();
+          return 2;
+        }
+        break;
+      case 'p':
+        options.preRollFrames = static_cast<unsigned>(std::atoi(optarg));
+        break;
+      case 'F':
+        options.fadeFrames = static_cast<unsigned>(std::atoi(optarg));
+        break;
+      default:
+        Usage();
+        return 2;
+    }
+  }
+
+  std::string address;
+  unsigned short port;
+  if (optind != argc || forward == nullptr
+      || !SplitEndpoint(forward, address, port)
+      || options.sampleRates.empty() || options.bufferFrames == 0
+      || options.channels == 0 || options.channels > 8) {
+    Usage();
+    return 2;
+  }
+  for (auto rate : options.sampleRates) {
+    if (rate <= 0) {
+      Usage();
+      return 2;
+    }
+  }
+
+  sockaddr_storage destination;
+  socklen_t length;
+  auto fd = OpenSendSocket(address.c_str(), port, destination, length);
+  if (fd < 0)
+    return 1;
+
+  std::signal(SIGINT, [](int) { stopRequested = 1; });
+  std::signal(SIGTERM, [](int) { stopRequested = 1; });
+
+  Sender sender(fd, destination, length);
+  Packetizer packetizer;
+  for (size_t index = 0; index < options.sampleRates.size() && stopRequested == 0; index++) {
+    const auto sampleRate = options.sampleRates[index];
+    packetizer.SetFormat(sampleRate,
+                         static_cast<UInt8>(options.channels),
+                         SampleFormat::Float32,
+                         options.wireFormat);
+    // The configuration change happens between StopIO and StartIO.
+    if (index > 0)
+      sender.SendHeader(packetizer.MakeHeader(PacketType::Format, 0, 0));
+    std::printf("Playing %g Hz\n", sampleRate);
+    std::fflush(stdout);
+    PlayStream(sender, packetizer, options, sampleRate);
+  }
+
+  const auto& counters = sender.GetCounters();
+  std::printf("\nSent %llu streams\n",
+              static_cast<unsigned long long>(counters.streams));
+  std::printf("  datagrams          %llu (%llu send errors)\n",
+              static_cast<unsigned long long>(counters.datagrams),
+              static_cast<unsigned long long>(counters.sendErrors));
+  std::printf("  frames             %llu (%llu of pre-roll)\n",
+              static_cast<unsigned long long>(counters.frames),
+              static_cast<unsigned long long>(counters.preRollFrames));
+  close(fd);
+  return counters.sendErrors > 0 ? 1 : 0;
+}
@@ -0,0 +1,294 @@
+/* Reads an IO-cycle trace written by the plug-in (see TraceRecorder.h),
+ * reports late cycles and time stamp jumps, and optionally exports the
+ * timeline as Chrome trace-event JSON (open it in chrome://tracing or
+ * https://ui.perfetto.dev).
+ *
+ * Usage: trace-analyzer [-j output.json] [-v] trace-file
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "TraceFormat.h"
+
+namespace {
+  const char* EventName(TraceEvent event) {
+    switch (event) {
+      case TraceEvent::GetZeroTimeStamp:
+        return "GetZeroTimeStamp";
+      case TraceEvent::BeginIOOperation:
+        return "BeginIOOperation";
+      case TraceEvent::DoIOOperation:
+        return "DoIOOperation";
+      case TraceEvent::WriteOutputData:
+        return "WriteOutputData";
+    }
+    return "unknown";
+  }
+
+  /** The records of a trace file, oldest first. */
+  struct Trace {
+    TraceFileHeader header;
+    std::vector<TraceRecord> records;
+
+    /** Converts host ticks to microseconds. */
+    double ToMicroseconds(double ticks) const {
+      return ticks * header.timebaseNumer / header.timebaseDenom / 1000.0;
+    }
+  };
+
+  bool ReadTrace(const char* path, Trace& trace) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.read(reinterpret_cast<char*>(&trace.header),
+                   sizeof(trace.header))) {
+      std::cerr << path << ": cannot read the header\n";
+      return false;
+    }
+
+    const auto& header = trace.header;
+    if (header.magic != kTraceMagic
+        || header.version != kTraceVersion
+        || header.recordSize != sizeof(TraceRecord)
+        || header.timebaseDenom == 0) {
+      std::cerr << path << ": not a trace file or unsupported version\n";
+      return false;
+    }
+
+    std::vector<TraceRecord> slots(header.capacity);
+    file.read(reinterpret_cast<char*>(slots.data()),
+              slots.size() * sizeof(TraceRecord));
+    if (!file) {
+      std::cerr << path << ": truncated file\n";
+      return false;
+    }
+
+    // The oldest record is the one the next write would overwrite.
+    auto count = std::min<uint64_t>(header.writeCount, header.capacity);
+    for (auto i = header.writeCount - count; i < header.writeCount; i++)
+      trace.records.push_back(slots[i % header.capacity]);
+
+    // Records are written when a call returns, so nested calls come out of
+    // order: sort them by start time.
+    std::stable_sort(trace.records.begin(), trace.records.end(),
+                     [](const TraceRecord& a, const TraceRecord& b) {
+      return a.hostTime < b.hostTime;
+    });
+    return true;
+  }
+
+  /** Host ticks per frame, estimated from the time stamps returned by
+   * GetZeroTimeStamp (median, to ignore the jumps).
+   */
+  double EstimateTicksPerFrame(const std::vector<const TraceRecord*>& records) {
+    std::vector<double> estimates;
+    const TraceRecord* previous = nullptr;
+    for (auto record : records) {
+      if (record->event != TraceEvent::GetZeroTimeStamp)
+        continue;
+      if (previous != nullptr && record->sampleTime > previous->sampleTime)
+        estimates.push_back(
+            static_cast<double>(record->timeStampHostTime
+                                - previous->timeStampHostTime)
+            / (record->sampleTime - previous->sampleTime));
+      previous = record;
+    }
+
+    if (estimates.empty())
+      return 0;
+    std::nth_element(estimates.begin(),
+                     estimates.begin() + estimates.size() / 2,
+                     estimates.end());
+    return estimates[estimates.size() / 2];
+  }
+
+  struct DurationStats {
+    uint64_t count { 0 };
+    double total { 0 };
+    double max { 0 };
+  };
+
+  /** Looks for anomalies in the records of one device.
+   *
+   * @return The number of anomalies found.
+   */
+  unsigned AnalyzeDevice(const Trace& trace,
+                         uint32_t deviceID,
+                         const std::vector<const TraceRecord*>& records,
+                         bool verbose) {
+    const auto start = records.front()->hostTime;
+    auto timeOf = [&](const TraceRecord* record) {
+      return trace.ToMicroseconds(record->hostTime - start) / 1000.0;
+    };
+
+    const auto ticksPerFrame = EstimateTicksPerFrame(records);
+    std::cout << "Device " << deviceID << ": " << records.size()
+              << " records over "
+              << timeOf(records.back()) / 1000.0 << " s";
+    if (ticksPerFrame > 0)
+      std::cout << ", " << trace.ToMicroseconds(ticksPerFrame)
+                << " us per frame";
+    std::cout << "\n";
+
+    unsigned anomalies = 0;
+    auto report = [&](const TraceRecord* record, const std::string& what) {
+      if (verbose || anomalies < 50)
+        std::printf("  %12.3f ms  %-18s %s\n",
+                    timeOf(record), EventName(record->event), what.c_str());
+      anomalies++;
+    };
+
+    std::map<TraceEvent, DurationStats> stats;
+    const TraceRecord* timeStamp = nullptr;
+    const TraceRecord* write = nullptr;
+
+    for (auto record : records) {
+      auto& s = stats[record->event];
+      auto duration = trace.ToMicroseconds(record->duration);
+      s.count++;
+      s.total += duration;
+      s.max = std::max(s.max, duration);
+
+      char buffer[160];
+      if (record->event == TraceEvent::GetZeroTimeStamp) {
+        if (timeStamp != nullptr && ticksPerFrame > 0) {
+          auto frames = record->sampleTime - timeStamp->sampleTime;
+          auto ticks = static_cast<double>(record->timeStampHostTime)
+              - static_cast<double>(timeStamp->timeStampHostTime);
+          if (frames < 0 || ticks < 0
+              || std::fabs(ticks - frames * ticksPerFrame)
+                 > ticksPerFrame) {
+            std::snprintf(buffer, sizeof(buffer),
+                          "time stamp jump: %+.0f frames in %+.3f ms",
+                          frames, trace.ToMicroseconds(ticks) / 1000.0);
+            report(record, buffer);
+          }
+        }
+        timeStamp = record;
+      } else if (record->event == TraceEvent::WriteOutputData) {
+        if (write != nullptr) {
+          auto expected = write->sampleTime + write->frameCount;
+          if (record->sampleTime != expected) {
+            std::snprintf(buffer, sizeof(buffer),
+                          "sample time jump: %.0f instead of %.0f (%+.0f frames)",
+                          record->sampleTime, expected,
+                          record->sampleTime - expected);
+            report(record, buffer);
+          }
+        }
+        write = record;
+
+        // The data must be out before its output time comes.
+        if (timeStamp != nullptr && ticksPerFrame > 0) {
+          auto deadline = timeStamp->timeStampHostTime
+              + (record->sampleTime - timeStamp->sampleTime) * ticksPerFrame;
+          auto end = static_cast<double>(record->hostTime + record->duration);
+          if (end > deadline) {
+            std::snprintf(buffer, sizeof(buffer),
+                          "late cycle: finished %.1f us after the output time",
+                          trace.ToMicroseconds(end - deadline));
+            report(record, buffer);
+          }
+        }
+      }
+    }
+
+    for (const auto& entry : stats)
+      std::printf("  %-18s %8llu calls, mean %8.1f us, max %8.1f us\n",
+                  EventName(entry.first),
+                  static_cast<unsigned long long>(entry.second.count),
+                  entry.second.total / entry.second.count,
+                  entry.second.max);
+    std::cout << "  " << anomalies << " anomalies";
+    if (!verbose && anomalies > 50)
+      std::cout << " (first 50 shown, use -v for all)";
+    std::cout << "\n";
+    return anomalies;
+  }
+
+  bool WriteChromeTrace(const Trace& trace, const char* path) {
+    std::ofstream out(path);
+    if (!out) {
+      std::cerr << path << ": cannot open for writing\n";
+      return false;
+    }
+
+    const auto start = trace.records.empty() ? 0 : trace.records.front().hostTime;
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (const auto& record : trace.records) {
+      char buffer[256];
+      std::snprintf(buffer, sizeof(buffer),
+                    "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                    "\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"args\":{\"sampleTime\":%.0f,\"frames\":%u}}",
+                    first ? "" : ",\n",
+                    EventName(record.event),
+                    record.deviceID,
+                    trace.ToMicroseconds(record.hostTime - start),
+                    trace.ToMicroseconds(record.duration),
+                    record.sampleTime,
+                    record.frameCount);
+      out << buffer;
+      first = false;
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(out);
+  }
+
+  void Usage() {
+    std::cerr << "usage: trace-analyzer [-j output.json] [-v] trace-file\n";
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const char* jsonPath = nullptr;
+  bool verbose = false;
+
+  int option;
+  while ((option = getopt(argc, argv, "j:v")) != -1) {
+    switch (option) {
+      case 'j':
+        jsonPath = optarg;
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        Usage();
+        return 2;
+    }
+  }
+
+  if (optind != argc - 1) {
+    Usage();
+    return 2;
+  }
+
+  Trace trace;
+  if (!ReadTrace(argv[optind], trace))
+    return 1;
+
+  std::cout << trace.records.size() << " records ("
+            << trace.header.writeCount << " written)\n";
+
+  std::map<uint32_t, std::vector<const TraceRecord*>> devices;
+  for (const auto& record : trace.records)
+    devices[record.deviceID].push_back(&record);
+
+  unsigned anomalies = 0;
+  for (const auto& device : devices)
+    anomalies += AnalyzeDevice(trace, device.first, device.second, verbose);
+
+  if (jsonPath != nullptr && !WriteChromeTrace(trace, jsonPath))
+    return 1;
+
+  return anomalies > 0 ? 3 : 0;
+}
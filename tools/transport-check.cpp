@@ -0,0 +1,308 @@
+/* Checks that TransportSupervisor rebuilds the socket of a Transport when
+ * its sends keep failing and when the network interfaces change, and that
+ * the new socket is swapped in under a thread that keeps sending, as the
+ * IO thread does.
+ *
+ * The plug-in's Transport and TransportSupervisor are built into the tool,
+ * which stands in for the C library underneath them: sendmsg() fails with
+ * ENETUNREACH while send errors are injected, and getifaddrs() reports an
+ * extra interface while a network change is simulated. The datagrams go to
+ * a loopback socket, and every phase checks the results of the sends, the
+ * socket they went through and the rebuilds counted in the metrics. Takes
+ * several seconds, since the supervisor checks once a second. Exits with
+ * status 1 if a check fails.
+ *
+ * Usage: transport-check [-i interval-ms]
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dlfcn.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include "Socket.h"
+#include "Transport.h"
+#include "TransportSupervisor.h"
+#include "log.h"
+
+namespace {
+  /** Set to make every send fail. */
+  std::atomic<bool> failSends { false };
+
+  /** Set to report an extra network interface. */
+  std::atomic<bool> extraInterface { false };
+
+  /** The socket of the last send. */
+  std::atomic<int> lastSendSocket { -1 };
+
+  sockaddr_in extraAddress;
+  ifaddrs extraInterfaceEntry;
+  char extraInterfaceName[] = "check0";
+}
+
+extern "C" ssize_t sendmsg(int fd, const msghdr* message, int flags) {
+  typedef ssize_t (*SendFunction)(int, const msghdr*, int);
+  static auto send = reinterpret_cast<SendFunction>(dlsym(RTLD_NEXT, "sendmsg"));
+  lastSendSocket.store(fd, std::memory_order_relaxed);
+  if (failSends.load(std::memory_order_relaxed)) {
+    errno = ENETUNREACH;
+    return -1;
+  }
+  return send(fd, message, flags);
+}
+
+/** Puts the extra interface in front of the real ones. Only the supervisor
+ * calls it, from one thread at a time.
+ */
+extern "C" int getifaddrs(ifaddrs** interfaces) {
+  typedef int (*GetFunction)(ifaddrs**);
+  static auto get = reinterpret_cast<GetFunction>(dlsym(RTLD_NEXT, "getifaddrs"));
+  auto result = get(interfaces);
+  if (result != 0 || !extraInterface)
+    return result;
+
+  extraAddress.sin_family = AF_INET;
+  extraAddress.sin_addr.s_addr = htonl(0xc0000201); // 192.0.2.1
+  extraInterfaceEntry.ifa_name = extraInterfaceName;
+  extraInterfaceEntry.ifa_flags = IFF_UP;
+  extraInterfaceEntry.ifa_addr = reinterpret_cast<sockaddr*>(&extraAddress);
+  extraInterfaceEntry.ifa_next = *interfaces;
+  *interfaces = &extraInterfaceEntry;
+  return 0;
+}
+
+extern "C" void freeifaddrs(ifaddrs* interfaces) {
+  typedef void (*FreeFunction)(ifaddrs*);
+  static auto free = reinterpret_cast<FreeFunction>(dlsym(RTLD_NEXT, "freeifaddrs"));
+  free(interfaces == &extraInterfaceEntry ? interfaces->ifa_next : interfaces);
+}
+
+// The plug-in's log, reduced to stderr: log.cpp needs the whole CoreAudio
+// SDK for its property names.
+std::atomic<LogLevel> logThresholds[static_cast<unsigned>(LogCategory::Count)] {
+  { LogLevel::Info },
+  { LogLevel::Info },
+  { LogLevel::Info },
+  { LogLevel::Info },
+  { LogLevel::Info },
+};
+
+void log(const std::string& s) noexcept {
+  std::fflush(stdout);
+  std::fprintf(stderr, "  [log] %s\n", s.c_str());
+}
+
+void log(const boost::format& fmt) noexcept {
+  try {
+    log(boost::str(fmt));
+  } catch (...) {}
+}
+
+void logRealTime(LogMessageID, UInt64, UInt64) noexcept {}
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  /** Sends a datagram at a fixed interval from its own thread, like the IO
+   * thread of a device, and counts the results.
+   */
+  class Sender {
+  public:
+    Sender(Transport& transport, std::chrono::milliseconds interval)
+      : transport_(transport)
+      , interval_(interval)
+      , thread_(&Sender::Run, this)
+    {}
+
+    ~Sender() {
+      running_ = false;
+      thread_.join();
+    }
+
+    uint64_t Sent() const { return sent_; }
+    uint64_t Failed() const { return failed_; }
+
+    /** Starts counting from zero. */
+    void ResetCounts() {
+      sent_ = 0;
+      failed_ = 0;
+    }
+
+  private:
+    void Run() {
+      uint8_t payload[64] = {};
+      auto next = Clock::now();
+      while (running_) {
+        next += interval_;
+        std::this_thread::sleep_until(next);
+        boost::system::error_code error;
+        switch (transport_.Send({{ boost::asio::buffer(payload),
+                                   boost::asio::const_buffer() }}, error)) {
+          case Transport::SendResult::Sent:
+            sent_++;
+            break;
+          case Transport::SendResult::Failed:
+            failed_++;
+            break;
+          case Transport::SendResult::Queued:
+          case Transport::SendResult::Dropped:
+            break;
+        }
+      }
+    }
+
+    Transport& transport_;
+    const std::chrono::milliseconds interval_;
+    std::atomic<bool> running_ { true };
+    std::atomic<uint64_t> sent_ { 0 };
+    std::atomic<uint64_t> failed_ { 0 };
+    std::thread thread_;
+  };
+
+  int failures = 0;
+
+  void Check(bool condition, const char* description) {
+    std::printf("  %s %s\n", condition ? "ok  " : "FAIL", description);
+    if (!condition)
+      failures++;
+  }
+
+  uint64_t Rebuilds(DeviceMetrics& metrics) {
+    return __atomic_load_n(&metrics.socketRebuilds, __ATOMIC_RELAXED);
+  }
+
+  /** Waits until the socket has been rebuilt more than \p rebuilds times,
+   * for at most a few supervisor checks.
+   */
+  bool WaitForRebuild(DeviceMetrics& metrics, uint64_t rebuilds) {
+    const auto deadline = Clock::now() + 4 * TransportSupervisor::checkInterval;
+    while (Rebuilds(metrics) <= rebuilds && Clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return Rebuilds(metrics) > rebuilds;
+  }
+
+  /** Waits until the transport reports persistent failures. The supervisor
+   * clears them when it rebuilds the socket, so they are polled for.
+   */
+  bool WaitForFailing(const Transport& transport) {
+    const auto deadline = Clock::now() + TransportSupervisor::checkInterval;
+    while (!transport.IsFailing() && Clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return transport.IsFailing();
+  }
+
+  /** Lets the sender run for a while, reading what it sends. */
+  void Run(int receiver, Clock::duration duration, uint64_t& received) {
+    std::vector<uint8_t> datagram(65536);
+    const auto end = Clock::now() + duration;
+    while (Clock::now() < end) {
+      while (recv(receiver, datagram.data(), datagram.size(), MSG_DONTWAIT) > 0)
+        received++;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  void Usage() {
+    std::fprintf(stderr, "usage: transport-check [-i interval-ms]\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  int intervalMilliseconds = 2;
+  int option;
+  while ((option = getopt(argc, argv, "i:")) != -1) {
+    switch (option) {
+      case 'i':
+        intervalMilliseconds = std::atoi(optarg);
+        break;
+      default:
+        Usage();
+        return 2;
+    }
+  }
+  if (optind != argc || intervalMilliseconds <= 0) {
+    Usage();
+    return 2;
+  }
+
+  auto receiver = OpenReceiveSocket("127.0.0.1", 0);
+  if (receiver < 0)
+    return 1;
+  sockaddr_in local;
+  socklen_t length = sizeof(local);
+  getsockname(receiver, reinterpret_cast<sockaddr*>(&local), &length);
+
+  boost::asio::io_service ioService;
+  DeviceConfiguration configuration;
+  configuration.destinations = { { "127.0.0.1", ntohs(local.sin_port) } };
+  DeviceMetrics metrics {};
+  Transport transport(ioService, 1, configuration, metrics);
+  Sender sender(transport, std::chrono::milliseconds(intervalMilliseconds));
+  const auto checkInterval = std::chrono::duration_cast<Clock::duration>(
+      TransportSupervisor::checkInterval);
+  uint64_t received = 0;
+
+  std::printf("Sending\n");
+  Run(receiver, 3 * checkInterval / 2, received);
+  const int firstSocket = lastSendSocket;
+  Check(sender.Sent() > 0 && sender.Failed() == 0, "every send succeeds");
+  Check(Rebuilds(metrics) == 0, "the socket is not rebuilt");
+
+  std::printf("Failing every send\n");
+  failSends = true;
+  const auto rebuilds = Rebuilds(metrics);
+  Check(WaitForFailing(transport), "the transport reports persistent failures");
+  Check(sender.Failed() >= Transport::persistentFailureCount, "sends fail");
+  Check(WaitForRebuild(metrics, rebuilds), "the socket is rebuilt");
+  Run(receiver, checkInterval / 10, received);
+  Check(lastSendSocket != firstSocket, "sends go through a new socket");
+
+  std::printf("Sending again\n");
+  failSends = false;
+  Run(receiver, checkInterval / 4, received);
+  sender.ResetCounts();
+  received = 0;
+  const auto recovered = Rebuilds(metrics);
+  const int recoveredSocket = lastSendSocket;
+  Run(receiver, 2 * checkInterval, received);
+  Check(sender.Sent() > 0 && sender.Failed() == 0, "every send succeeds");
+  Check(!transport.IsFailing(), "the transport does not report failures");
+  Check(Rebuilds(metrics) == recovered, "the socket is not rebuilt");
+  Check(lastSendSocket == recoveredSocket, "sends keep the same socket");
+
+  std::printf("Changing the network interfaces\n");
+  extraInterface = true;
+  Check(WaitForRebuild(metrics, recovered), "the socket is rebuilt");
+  Run(receiver, checkInterval / 10, received);
+  Check(lastSendSocket != recoveredSocket, "sends go through a new socket");
+  extraInterface = false;
+  Check(WaitForRebuild(metrics, recovered + 1),
+        "the socket is rebuilt when the interface goes away");
+  Run(receiver, checkInterval / 4, received);
+  Check(sender.Failed() == 0, "no send fails across the rebuilds");
+
+  // Whatever is still in flight arrives before the count.
+  const auto sent = sender.Sent();
+  Run(receiver, std::chrono::milliseconds(100), received);
+  Check(received >= sent, "every datagram sent arrives");
+  std::printf("%llu datagrams sent, %llu received, %llu socket rebuilds\n",
+              static_cast<unsigned long long>(sender.Sent()),
+              static_cast<unsigned long long>(received),
+              static_cast<unsigned long long>(Rebuilds(metrics)));
+
+  close(receiver);
+  if (failures > 0) {
+    std::printf("FAIL: %d checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}